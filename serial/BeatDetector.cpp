@@ -0,0 +1,275 @@
+/**
+ * \file    BeatDetector.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "BeatDetector.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+static const double HIGH_PASS_HZ = 5.0;
+static const double LOW_PASS_HZ = 15.0;
+static const double WINDOW_S = 0.150;
+static const double REFRACTORY_S = 0.200;
+static const double LEARNING_S = 2.0;
+// Band passed samples kept for the fiducial search, also of search back beats.
+static const double HISTORY_S = 4.0;
+static const double SEARCH_BACK_RR = 1.66;
+
+BeatDetector::BeatDetector(double sampleRate) :
+    sampleRate_(sampleRate),
+    highPass_(design(sampleRate, HIGH_PASS_HZ, true)),
+    lowPass_(design(sampleRate, LOW_PASS_HZ, false)),
+    window_(std::max<size_t>(1, static_cast<size_t>(WINDOW_S * sampleRate + 0.5))),
+    refractory_(static_cast<size_t>(REFRACTORY_S * sampleRate)),
+    learning_(static_cast<uint64_t>(LEARNING_S * sampleRate))
+{
+    // Delay from an R peak to the peak of the band passed R wave: filter a typical R wave, a Gaussian with a
+    // 10 ms standard deviation, and find where the response peaks.
+    const int center = static_cast<int>(0.1 * sampleRate);
+    Biquad hp = highPass_;
+    Biquad lp = lowPass_;
+    float best = 0.0f;
+    groupDelay_ = 0.0;
+    for (int i = 0; i < 4 * center; ++i) {
+        const double d = (i - center) / (0.010 * sampleRate);
+        float x = static_cast<float>(std::exp(-0.5 * d * d));
+        Biquad* filters[] = {&hp, &lp};
+        for (int k = 0; k < 2; ++k) {
+            Biquad& f = *filters[k];
+            const float y = f.b0 * x + f.z1;
+            f.z1 = f.b1 * x - f.a1 * y + f.z2;
+            f.z2 = f.b2 * x - f.a2 * y;
+            x = y;
+        }
+        if (std::fabs(x) > best) {
+            best = std::fabs(x);
+            groupDelay_ = i - center;
+        }
+    }
+
+    size_t history = 64;
+    while (history < HISTORY_S * sampleRate) {
+        history <<= 1;
+    }
+    filtered_.resize(history);
+    integrated_.resize(window_);
+    reset();
+}
+
+BeatDetector::Biquad BeatDetector::design(double sampleRate, double hz, bool highPass)
+{
+    // Second order Butterworth, from the audio EQ cookbook.
+    const double w0 = 2 * M_PI * hz / sampleRate;
+    const double alpha = std::sin(w0) / std::sqrt(2.0);
+    const double cosw = std::cos(w0);
+    const double a0 = 1 + alpha;
+    Biquad f;
+    if (highPass) {
+        f.b0 = static_cast<float>((1 + cosw) / 2 / a0);
+        f.b1 = static_cast<float>(-(1 + cosw) / a0);
+    } else {
+        f.b0 = static_cast<float>((1 - cosw) / 2 / a0);
+        f.b1 = static_cast<float>((1 - cosw) / a0);
+    }
+    f.b2 = f.b0;
+    f.a1 = static_cast<float>(-2 * cosw / a0);
+    f.a2 = static_cast<float>((1 - alpha) / a0);
+    f.z1 = 0.0f;
+    f.z2 = 0.0f;
+    return f;
+}
+
+void BeatDetector::reset()
+{
+    highPass_.z1 = highPass_.z2 = 0.0f;
+    lowPass_.z1 = lowPass_.z2 = 0.0f;
+    std::memset(buffer_, 0, sizeof(buffer_));
+    std::fill(integrated_.begin(), integrated_.end(), 0.0f);
+    std::fill(filtered_.begin(), filtered_.end(), 0.0f);
+    sum_ = 0.0;
+    sample_ = 0;
+    frameStart_ = 0;
+    frameStartUs_ = 0;
+    prev1_ = prev2_ = 0.0f;
+    learnMax_ = 0.0f;
+    learnSum_ = 0.0;
+    signalLevel_ = 0.0f;
+    noiseLevel_ = 0.0f;
+    inRegion_ = false;
+    regionMax_ = 0.0f;
+    regionMaxSample_ = 0;
+    backMax_ = 0.0f;
+    backMaxSample_ = 0;
+    lastBeat_ = 0;
+    lastFiducial_ = 0;
+    haveBeat_ = false;
+    rrCount_ = 0;
+    heartRate_ = 0.0f;
+}
+
+size_t BeatDetector::process(const int16_t* samples, size_t n, int64_t timestampUs, std::vector<Beat>& beats)
+{
+    const size_t before = beats.size();
+    for (size_t done = 0; done < n; done += BEAT_BLOCK) {
+        processBlock(samples + done, std::min(BEAT_BLOCK, n - done),
+                     timestampUs + static_cast<int64_t>(done * 1e6 / sampleRate_), beats);
+    }
+    return beats.size() - before;
+}
+
+void BeatDetector::processBlock(const int16_t* samples, size_t n, int64_t timestampUs, std::vector<Beat>& beats)
+{
+    frameStart_ = sample_;
+    frameStartUs_ = timestampUs;
+    const size_t mask = filtered_.size() - 1;
+    float* bp = buffer_ + 4;
+    for (size_t i = 0; i < n; ++i) {
+        float x = samples[i];
+        Biquad* filters[] = {&highPass_, &lowPass_};
+        for (int k = 0; k < 2; ++k) {
+            Biquad& f = *filters[k];
+            const float y = f.b0 * x + f.z1;
+            f.z1 = f.b1 * x - f.a1 * y + f.z2;
+            f.z2 = f.b2 * x - f.a2 * y;
+            x = y;
+        }
+        bp[i] = x;
+        filtered_[(sample_ + i) & mask] = x;
+    }
+
+    // Five point derivative 2x[n] + x[n-1] - x[n-3] - 2x[n-4], squared.
+    size_t i = 0;
+#ifdef __SSE__
+    const __m128 two = _mm_set1_ps(2.0f);
+    for (; i + 4 <= n; i += 4) {
+        const __m128 d = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(two, _mm_loadu_ps(bp + i)), _mm_loadu_ps(bp + i - 1)),
+                                    _mm_add_ps(_mm_loadu_ps(bp + i - 3), _mm_mul_ps(two, _mm_loadu_ps(bp + i - 4))));
+        _mm_storeu_ps(squared_ + i, _mm_mul_ps(d, d));
+    }
+#endif
+    for (; i < n; ++i) {
+        const float d = 2 * bp[i] + bp[i - 1] - bp[i - 3] - 2 * bp[i - 4];
+        squared_[i] = d * d;
+    }
+
+    for (i = 0; i < n; ++i) {
+        const uint64_t s = sample_ + i;
+        float& slot = integrated_[s % window_];
+        sum_ += squared_[i] - slot;
+        slot = squared_[i];
+        const float v = static_cast<float>(std::max(0.0, sum_) / window_);
+
+        if (s < learning_) {
+            learnMax_ = std::max(learnMax_, v);
+            learnSum_ += v;
+            if (s + 1 == learning_) {
+                signalLevel_ = learnMax_ / 3;
+                noiseLevel_ = static_cast<float>(learnSum_ / learning_ / 2);
+            }
+        } else {
+            const float threshold = noiseLevel_ + 0.25f * (signalLevel_ - noiseLevel_);
+            const bool refractory = haveBeat_ && s - lastBeat_ <= refractory_;
+            if (inRegion_) {
+                if (v > regionMax_) {
+                    regionMax_ = v;
+                    regionMaxSample_ = s;
+                } else if (v < 0.5f * regionMax_) {
+                    inRegion_ = false;
+                    detected(regionMaxSample_, regionMax_, false, s, beats);
+                }
+            } else if (v > threshold && !refractory) {
+                inRegion_ = true;
+                regionMax_ = v;
+                regionMaxSample_ = s;
+            } else if (prev1_ > prev2_ && prev1_ >= v) {
+                // Local maximum below the threshold: noise, and a search back candidate.
+                if (prev1_ < threshold) {
+                    noiseLevel_ = 0.125f * prev1_ + 0.875f * noiseLevel_;
+                }
+                if (!refractory && prev1_ > 0.5f * threshold && prev1_ > backMax_) {
+                    backMax_ = prev1_;
+                    backMaxSample_ = s - 1;
+                }
+            }
+            if (!inRegion_ && haveBeat_ && rrCount_ > 0 && backMax_ > 0.0f) {
+                float rr = 0.0f;
+                for (size_t k = 0; k < rrCount_; ++k) {
+                    rr += rr_[k];
+                }
+                const double rrSamples = rr / rrCount_ * sampleRate_ / 1000.0;
+                if (s - lastBeat_ > SEARCH_BACK_RR * rrSamples) {
+                    detected(backMaxSample_, backMax_, true, s, beats);
+                }
+            }
+        }
+        prev2_ = prev1_;
+        prev1_ = v;
+    }
+    std::memcpy(buffer_, bp + n - 4, 4 * sizeof(float));
+    sample_ += n;
+}
+
+uint64_t BeatDetector::fiducial(uint64_t peakSample) const
+{
+    // The QRS is in the integration window that ends at the peak, and the derivative adds two samples.
+    const uint64_t end = peakSample;
+    const uint64_t span = window_ + 2;
+    const uint64_t oldest = sample_ > filtered_.size() - BEAT_BLOCK ? sample_ - (filtered_.size() - BEAT_BLOCK) : 0;
+    const uint64_t begin = std::max(oldest, end > span ? end - span : 0);
+    const size_t mask = filtered_.size() - 1;
+    uint64_t best = end;
+    float bestValue = -1.0f;
+    for (uint64_t s = begin; s <= end; ++s) {
+        const float a = std::fabs(filtered_[s & mask]);
+        if (a > bestValue) {
+            bestValue = a;
+            best = s;
+        }
+    }
+    const uint64_t delay = static_cast<uint64_t>(groupDelay_ + 0.5);
+    return best > delay ? best - delay : 0;
+}
+
+void BeatDetector::detected(uint64_t peakSample, float peak, bool searchBack, uint64_t now, std::vector<Beat>& beats)
+{
+    signalLevel_ = searchBack ? 0.25f * peak + 0.75f * signalLevel_ : 0.125f * peak + 0.875f * signalLevel_;
+    const uint64_t r = fiducial(peakSample);
+    Beat b;
+    b.sample = r;
+    b.timestampUs = frameStartUs_ + static_cast<int64_t>((static_cast<double>(r) - frameStart_) * 1e6 / sampleRate_);
+    b.detectedAt = now;
+    b.rrMs = 0.0f;
+    b.searchBack = searchBack;
+    if (haveBeat_ && r > lastFiducial_) {
+        b.rrMs = static_cast<float>((r - lastFiducial_) * 1000.0 / sampleRate_);
+        const size_t slots = sizeof(rr_) / sizeof(rr_[0]);
+        if (rrCount_ < slots) {
+            rr_[rrCount_++] = b.rrMs;
+        } else {
+            std::memmove(rr_, rr_ + 1, (slots - 1) * sizeof(float));
+            rr_[slots - 1] = b.rrMs;
+        }
+        float sum = 0.0f;
+        for (size_t k = 0; k < rrCount_; ++k) {
+            sum += rr_[k];
+        }
+        heartRate_ = 60000.0f * rrCount_ / sum;
+    }
+    b.heartRate = heartRate_;
+    beats.push_back(b);
+    haveBeat_ = true;
+    lastBeat_ = peakSample;
+    lastFiducial_ = r;
+    backMax_ = 0.0f;
+}
@@ -0,0 +1,104 @@
+/******************************************************************************/
+/**
+ * \file    BeatDetector.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Streaming QRS detector for an ECG channel, after Pan and Tompkins: a 5-15 Hz band pass (two biquads,
+ * designed for the channel's sample rate), a five point derivative, squaring and a 150 ms moving window
+ * integration. Samples are processed in blocks of at most BEAT_BLOCK samples; the derivative and squaring
+ * of a block run four samples at a time with SSE, the recursive filters and the integration are scalar.
+ *
+ * A beat is a region where the integrated signal rises above an adaptive threshold between the signal
+ * and noise peak levels, and ends when it falls below half of the region's peak. The beat's time is the
+ * largest band passed sample in the integration window before the peak, corrected for the delay of the
+ * band pass. Regions within 200 ms of the previous beat are ignored. When no beat has come for 1.66 of
+ * the average RR interval, the largest peak since the last beat above half the threshold is taken as a
+ * beat (search back). The first two seconds only learn the peak levels.
+ *
+ * All state is fixed size after construction, so a detector per channel is cheap to keep.
+ **/
+
+#ifndef BEAT_DETECTOR_HPP
+#define BEAT_DETECTOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+static const size_t BEAT_BLOCK = 128;
+
+struct Beat {
+    uint64_t sample;       // Index of the R peak in the channel's samples.
+    int64_t timestampUs;   // Host time of the R peak.
+    uint64_t detectedAt;   // Index of the sample that completed the detection.
+    float rrMs;            // Time since the previous beat, 0 for the first.
+    float heartRate;       // Beats per minute over the last eight RR intervals.
+    bool searchBack;       // Found by search back with the lowered threshold.
+};
+
+class BeatDetector
+{
+public:
+    explicit BeatDetector(double sampleRate);
+
+    // Filters n samples; the first is at timestampUs. Beats found are appended to beats, returns how many.
+    size_t process(const int16_t* samples, size_t n, int64_t timestampUs, std::vector<Beat>& beats);
+    double sampleRate() const {return sampleRate_;}
+    float heartRate() const {return heartRate_;}
+    // Samples from an R peak to the peak of the band passed R wave.
+    double groupDelay() const {return groupDelay_;}
+    void reset();
+
+private:
+    struct Biquad {
+        float b0, b1, b2, a1, a2;
+        float z1, z2;
+    };
+
+    static Biquad design(double sampleRate, double hz, bool highPass);
+    void processBlock(const int16_t* samples, size_t n, int64_t timestampUs, std::vector<Beat>& beats);
+    void detected(uint64_t peakSample, float peak, bool searchBack, uint64_t now, std::vector<Beat>& beats);
+    uint64_t fiducial(uint64_t peakSample) const;
+
+    double sampleRate_;
+    Biquad highPass_;
+    Biquad lowPass_;
+    double groupDelay_;
+    size_t window_;              // Integration window in samples.
+    size_t refractory_;
+    uint64_t learning_;          // Samples of the learning phase.
+
+    float buffer_[4 + BEAT_BLOCK];       // Four band passed samples of the previous block, then this block.
+    float squared_[BEAT_BLOCK];
+    std::vector<float> integrated_;      // Squared samples of the integration window, circular.
+    std::vector<float> filtered_;        // Band passed samples, circular, for the fiducial search.
+    double sum_;
+    uint64_t sample_;                    // Index of the next sample.
+    uint64_t frameStart_;                // Index and time of the first sample of the current block.
+    int64_t frameStartUs_;
+
+    float prev1_, prev2_;                // The two previous integrated values, for local maxima.
+    float learnMax_;
+    double learnSum_;
+    float signalLevel_;
+    float noiseLevel_;
+    bool inRegion_;
+    float regionMax_;
+    uint64_t regionMaxSample_;
+    float backMax_;                      // Largest peak since the last beat, for search back.
+    uint64_t backMaxSample_;
+    uint64_t lastBeat_;                  // Integrated peak of the last beat.
+    uint64_t lastFiducial_;
+    bool haveBeat_;
+    float rr_[8];
+    size_t rrCount_;
+    float heartRate_;
+};
+
+#endif // BEAT_DETECTOR_HPP
@@ -0,0 +1,160 @@
+/**
+ * \file    BusyPoller.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "BusyPoller.hpp"
+#include "CpuRelax.hpp"
+#include "SerialDriver.hpp"
+#include "Trace.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static inline int64_t monotonicUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+BusyPoller::BusyPoller(int cpu, long idleUs, const FrameDecoder::FrameHandler& handler) :
+    cpu_(cpu),
+    idleUs_(idleUs),
+    handler_(handler),
+    epollFd_(-1),
+    wakeFd_(-1),
+    running_(false),
+    fallbacks_(0),
+    wakeups_(0)
+{
+}
+
+BusyPoller::~BusyPoller()
+{
+    stop();
+    if (wakeFd_ >= 0) {
+        ::close(wakeFd_);
+    }
+    if (epollFd_ >= 0) {
+        ::close(epollFd_);
+    }
+}
+
+bool BusyPoller::start()
+{
+    TRACE();
+    if (thread_.joinable()) {
+        TRACE_RETURN(true);
+    }
+    // Restarted after a failed handover, start over with a fresh epoll set.
+    if (epollFd_ >= 0) {
+        ::close(epollFd_);
+    }
+    if (wakeFd_ >= 0) {
+        ::close(wakeFd_);
+    }
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd_ < 0 || wakeFd_ < 0) {
+        std::cerr << "BusyPoller: " << strerror(errno) << std::endl;
+        TRACE_RETURN(false);
+    }
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeFd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev);
+    for (size_t i = 0; i < ports_.size(); ++i) {
+        ev.data.fd = ports_[i]->fd();
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, ports_[i]->fd(), &ev) != 0) {
+            std::cerr << ports_[i]->path() << ": epoll_ctl: " << strerror(errno) << std::endl;
+            TRACE_RETURN(false);
+        }
+    }
+    running_ = true;
+    thread_ = std::thread(&BusyPoller::run, this);
+    TRACE_RETURN(true);
+}
+
+void BusyPoller::stop()
+{
+    if (!thread_.joinable()) {
+        return;
+    }
+    running_ = false;
+    const uint64_t one = 1;
+    (void) write(wakeFd_, &one, sizeof(one));
+    thread_.join();
+}
+
+void BusyPoller::removePort(size_t i)
+{
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, ports_[i]->fd(), nullptr);
+    ports_[i]->close();
+    ports_.erase(ports_.begin() + i);
+}
+
+void BusyPoller::run()
+{
+    if (cpu_ >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu_, &set);
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            std::cerr << "BusyPoller: cannot pin to cpu " << cpu_ << ": " << strerror(err) << std::endl;
+        }
+    }
+
+    int64_t lastDataUs = monotonicUs();
+    struct epoll_event events[16];
+    while (running_) {
+        bool gotData = false;
+        const int64_t now = SerialDriver::nowUs();
+        for (size_t i = 0; i < ports_.size(); ++i) {
+            const ssize_t n = ports_[i]->readAvailable(now, handler_);
+            if (n < 0) {
+                removePort(i--);
+            } else if (n > 0) {
+                gotData = true;
+            }
+        }
+        if (gotData) {
+            lastDataUs = monotonicUs();
+            continue;
+        }
+        if (idleUs_ < 0 || monotonicUs() - lastDataUs < idleUs_) {
+            cpuRelax();
+            continue;
+        }
+
+        // Idle long enough, block until any port has data again.
+        fallbacks_++;
+        const int n = epoll_wait(epollFd_, events, 16, -1);
+        for (int i = 0; i < n; ++i) {
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                for (size_t p = 0; p < ports_.size(); ++p) {
+                    if (ports_[p]->fd() == events[i].data.fd) {
+                        removePort(p);
+                        break;
+                    }
+                }
+            }
+        }
+        wakeups_++;
+        lastDataUs = monotonicUs();
+    }
+}
@@ -0,0 +1,60 @@
+/******************************************************************************/
+/**
+ * \file    BusyPoller.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * BusyPoller reads a set of high priority ports from a dedicated thread, optionally pinned to a core.
+ * While data keeps arriving it spins on non-blocking reads, avoiding the epoll wake-up latency. When no
+ * data has arrived for idleUs it blocks in epoll_wait on the same ports, and spins again on the next
+ * data. idleUs 0 gives plain epoll behaviour, a negative idleUs never blocks.
+ **/
+
+#ifndef BUSY_POLLER_HPP
+#define BUSY_POLLER_HPP
+
+#include "SerialPort.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+class BusyPoller
+{
+public:
+    explicit BusyPoller(int cpu, long idleUs, const FrameDecoder::FrameHandler& handler);
+    ~BusyPoller();
+
+    // Ports must be added before start(), they are not owned.
+    void addPort(SerialPort* port) {ports_.push_back(port);}
+    bool empty() const {return ports_.empty();}
+
+    bool start();
+    void stop();
+
+    // Times the thread went from spinning to blocking, and wake-ups from epoll_wait.
+    unsigned long fallbacks() const {return fallbacks_;}
+    unsigned long wakeups() const {return wakeups_;}
+
+private:
+    void run();
+    void removePort(size_t i);
+
+    int cpu_;
+    long idleUs_;
+    FrameDecoder::FrameHandler handler_;
+    std::vector<SerialPort*> ports_;
+    int epollFd_;
+    int wakeFd_;
+    std::atomic<bool> running_;
+    std::atomic<unsigned long> fallbacks_;
+    std::atomic<unsigned long> wakeups_;
+    std::thread thread_;
+};
+
+#endif // BUSY_POLLER_HPP
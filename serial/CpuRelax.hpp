@@ -0,0 +1,32 @@
+/******************************************************************************/
+/**
+ * \file    CpuRelax.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * cpuRelax() goes in the body of a spin loop. It tells the core that it is spinning, which saves power and
+ * leaves the pipeline to a sibling hyperthread, and does nothing where no such hint is known.
+ **/
+
+#ifndef CPU_RELAX_HPP
+#define CPU_RELAX_HPP
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+static inline void cpuRelax()
+{
+#ifdef __SSE__
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+#endif // CPU_RELAX_HPP
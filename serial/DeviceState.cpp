@@ -0,0 +1,41 @@
+/**
+ * \file    DeviceState.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "DeviceState.hpp"
+
+#include <cmath>
+
+// Fraction of a positive offset error applied per frame.
+static const double OFFSET_GAIN = 0.001;
+// An offset error larger than this means the device was reset or the model is stale, relock.
+static const double RELOCK_LIMIT_US = 1000000.0;
+
+int64_t TimestampModel::toHostUs(uint32_t ticks, int64_t nowUs)
+{
+    if (locked && ticks < lastTicks && (lastTicks - ticks) > 0x80000000u) {
+        wraps++;
+    }
+    double deviceUs = (static_cast<double>(wraps) * 4294967296.0 + ticks) * tickUs;
+    double observed = static_cast<double>(nowUs) - deviceUs;
+
+    if (!locked || std::fabs(observed - offsetUs) > RELOCK_LIMIT_US) {
+        // First frame, or the device was reset while we were away: start over from the current ticks.
+        wraps = 0;
+        deviceUs = ticks * tickUs;
+        observed = static_cast<double>(nowUs) - deviceUs;
+        offsetUs = observed;
+        locked = true;
+    } else if (observed < offsetUs) {
+        offsetUs = observed;
+    } else {
+        offsetUs += (observed - offsetUs) * OFFSET_GAIN;
+    }
+    lastTicks = ticks;
+    return static_cast<int64_t>(deviceUs + offsetUs);
+}
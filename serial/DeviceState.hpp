@@ -0,0 +1,61 @@
+/******************************************************************************/
+/**
+ * \file    DeviceState.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Per device state learned while streaming. Everything here is part of the driver snapshot, so a restarted
+ * driver can continue where the previous one stopped instead of detecting baud rates and relocking
+ * timestamps again. Add new members at the end and bump SNAPSHOT_VERSION in DriverSnapshot.cpp.
+ **/
+
+#ifndef DEVICE_STATE_HPP
+#define DEVICE_STATE_HPP
+
+#include <cstdint>
+#include <string>
+
+#include <boost/serialization/string.hpp>
+
+// Maps device ticks to host time. The offset follows the minimum observed transport delay,
+// i.e. it jumps down at once and creeps up slowly, which filters out scheduling jitter.
+struct TimestampModel {
+    explicit TimestampModel(){tickUs=1000.0;offsetUs=0.0;locked=false;lastTicks=0;wraps=0;}
+
+    // Returns the host time in microseconds for a frame with the given device time, received at nowUs.
+    int64_t toHostUs(uint32_t ticks, int64_t nowUs);
+
+    double tickUs;      // Length of one device tick.
+    double offsetUs;    // Host time minus device time.
+    bool locked;
+    uint32_t lastTicks;
+    uint32_t wraps;     // Number of device time wrap-arounds.
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int /*version*/) {
+        ar & tickUs & offsetUs & locked & lastTicks & wraps;
+    }
+};
+
+struct DeviceState {
+    explicit DeviceState(){baudRate=0;seqValid=false;lastSeq=0;lostFrames=0;}
+
+    std::string port;   // Device path, identifies the state in a snapshot.
+    int baudRate;       // Detected or configured baud rate, 0 if not yet known.
+    bool seqValid;
+    uint16_t lastSeq;
+    unsigned long lostFrames;
+    TimestampModel timestamps;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int /*version*/) {
+        ar & port & baudRate & seqValid & lastSeq & lostFrames & timestamps;
+    }
+};
+
+#endif // DEVICE_STATE_HPP
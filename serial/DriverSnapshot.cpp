@@ -0,0 +1,105 @@
+/**
+ * \file    DriverSnapshot.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "DriverSnapshot.hpp"
+#include "Trace.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static const uint32_t SNAPSHOT_MAGIC = 0x676E5353; // "gnSS"
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+bool writeSnapshot(std::ostream& os, const std::vector<DeviceState>& states)
+{
+    try
+    {
+        // no_header: the archive header is larger than a typical snapshot, we have our own.
+        boost::archive::binary_oarchive oa(os, boost::archive::no_header);
+        oa << SNAPSHOT_MAGIC << SNAPSHOT_VERSION;
+        oa << states;
+    } catch(std::exception& e)
+    {
+        std::cerr << "Failed to write snapshot: " << e.what() << std::endl;
+        return false;
+    }
+    return static_cast<bool>(os);
+}
+
+bool readSnapshot(std::istream& is, std::vector<DeviceState>& states)
+{
+    try
+    {
+        boost::archive::binary_iarchive ia(is, boost::archive::no_header);
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        ia >> magic >> version;
+        if (magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION) {
+            std::cerr << "Snapshot has unknown format, ignored" << std::endl;
+            return false;
+        }
+        ia >> states;
+    } catch(std::exception& e)
+    {
+        std::cerr << "Failed to read snapshot: " << e.what() << std::endl;
+        states.clear();
+        return false;
+    }
+    return true;
+}
+
+bool writeSnapshotFile(const std::string& path, const std::vector<DeviceState>& states)
+{
+    TRACE();
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream os(tmpPath, std::ios_base::binary | std::ios_base::trunc);
+        if (!os) {
+            std::cerr << tmpPath << ": " << strerror(errno) << std::endl;
+            TRACE_RETURN(false);
+        }
+        if (!writeSnapshot(os, states)) {
+            std::remove(tmpPath.c_str());
+            TRACE_RETURN(false);
+        }
+    }
+    // fsync before rename, otherwise a power loss can leave an empty snapshot behind.
+    const int fd = ::open(tmpPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        (void) fsync(fd);
+        ::close(fd);
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        std::remove(tmpPath.c_str());
+        TRACE_RETURN(false);
+    }
+    TRACE_RETURN(true);
+}
+
+bool readSnapshotFile(const std::string& path, std::vector<DeviceState>& states)
+{
+    TRACE();
+    std::ifstream is(path, std::ios_base::binary);
+    if (!is) {
+        // No snapshot is normal at first start.
+        TRACE_RETURN(false);
+    }
+    TRACE_RETURN(readSnapshot(is, states));
+}
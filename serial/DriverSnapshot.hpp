@@ -0,0 +1,32 @@
+/******************************************************************************/
+/**
+ * \file    DriverSnapshot.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Binary snapshot of the driver's device states (boost::serialization binary archive). Snapshots are
+ * written periodically and at shutdown, and read at startup so devices resume without resynchronizing.
+ **/
+
+#ifndef DRIVER_SNAPSHOT_HPP
+#define DRIVER_SNAPSHOT_HPP
+
+#include "DeviceState.hpp"
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+bool writeSnapshot(std::ostream& os, const std::vector<DeviceState>& states);
+bool readSnapshot(std::istream& is, std::vector<DeviceState>& states);
+
+// File variants. writeSnapshotFile() replaces the file atomically.
+bool writeSnapshotFile(const std::string& path, const std::vector<DeviceState>& states);
+bool readSnapshotFile(const std::string& path, std::vector<DeviceState>& states);
+
+#endif // DRIVER_SNAPSHOT_HPP
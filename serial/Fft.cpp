@@ -0,0 +1,153 @@
+/**
+ * \file    Fft.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "Fft.hpp"
+
+#include <cmath>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+Fft::Fft(size_t size) :
+    size_(0)
+{
+    if (size < 2 || (size & (size - 1)) != 0) {
+        return;
+    }
+    size_ = size;
+    for (size_t block = size; block >= 4; block /= 4) {
+        Stage s;
+        s.quarter = block / 4;
+        s.twiddles = twiddles_.size();
+        twiddles_.resize(twiddles_.size() + 6 * s.quarter);
+        float* w = &twiddles_[s.twiddles];
+        for (size_t j = 0; j < s.quarter; ++j) {
+            for (int m = 1; m <= 3; ++m) {
+                const double a = -2 * M_PI * m * j / block;
+                w[(m - 1) * 2 * s.quarter + j] = static_cast<float>(std::cos(a));
+                w[(m - 1) * 2 * s.quarter + s.quarter + j] = static_cast<float>(std::sin(a));
+            }
+        }
+        stages_.push_back(s);
+    }
+    int bits = 0;
+    while ((static_cast<size_t>(1) << bits) < size) {
+        bits++;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        size_t r = 0;
+        for (int b = 0; b < bits; ++b) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        if (i < r) {
+            swaps_.push_back(static_cast<uint32_t>(i));
+            swaps_.push_back(static_cast<uint32_t>(r));
+        }
+    }
+}
+
+// Outputs, at j, j + q, j + 2q and j + 3q of the block:
+//   y0 = (x0 + x2) + (x1 + x3)
+//   y1 = ((x0 + x2) - (x1 + x3)) w^2j
+//   y2 = ((x0 - x2) - i (x1 - x3)) w^j
+//   y3 = ((x0 - x2) + i (x1 - x3)) w^3j
+void Fft::radix4(const Stage& s, float* re, float* im) const
+{
+    const size_t q = s.quarter;
+    const float* w1r = &twiddles_[s.twiddles];
+    const float* w1i = w1r + q;
+    const float* w2r = w1i + q;
+    const float* w2i = w2r + q;
+    const float* w3r = w2i + q;
+    const float* w3i = w3r + q;
+    for (size_t base = 0; base < size_; base += 4 * q) {
+        float* r0 = re + base;
+        float* i0 = im + base;
+        float* r1 = r0 + q;
+        float* i1 = i0 + q;
+        float* r2 = r1 + q;
+        float* i2 = i1 + q;
+        float* r3 = r2 + q;
+        float* i3 = i2 + q;
+        size_t j = 0;
+#ifdef __SSE__
+        for (; j + 4 <= q; j += 4) {
+            const __m128 x0r = _mm_loadu_ps(r0 + j), x0i = _mm_loadu_ps(i0 + j);
+            const __m128 x1r = _mm_loadu_ps(r1 + j), x1i = _mm_loadu_ps(i1 + j);
+            const __m128 x2r = _mm_loadu_ps(r2 + j), x2i = _mm_loadu_ps(i2 + j);
+            const __m128 x3r = _mm_loadu_ps(r3 + j), x3i = _mm_loadu_ps(i3 + j);
+            const __m128 s02r = _mm_add_ps(x0r, x2r), s02i = _mm_add_ps(x0i, x2i);
+            const __m128 d02r = _mm_sub_ps(x0r, x2r), d02i = _mm_sub_ps(x0i, x2i);
+            const __m128 s13r = _mm_add_ps(x1r, x3r), s13i = _mm_add_ps(x1i, x3i);
+            const __m128 d13r = _mm_sub_ps(x1r, x3r), d13i = _mm_sub_ps(x1i, x3i);
+            _mm_storeu_ps(r0 + j, _mm_add_ps(s02r, s13r));
+            _mm_storeu_ps(i0 + j, _mm_add_ps(s02i, s13i));
+            const __m128 ar = _mm_sub_ps(s02r, s13r), ai = _mm_sub_ps(s02i, s13i);
+            const __m128 br = _mm_add_ps(d02r, d13i), bi = _mm_sub_ps(d02i, d13r);
+            const __m128 cr = _mm_sub_ps(d02r, d13i), ci = _mm_add_ps(d02i, d13r);
+            const __m128 v2r = _mm_loadu_ps(w2r + j), v2i = _mm_loadu_ps(w2i + j);
+            const __m128 v1r = _mm_loadu_ps(w1r + j), v1i = _mm_loadu_ps(w1i + j);
+            const __m128 v3r = _mm_loadu_ps(w3r + j), v3i = _mm_loadu_ps(w3i + j);
+            _mm_storeu_ps(r1 + j, _mm_sub_ps(_mm_mul_ps(ar, v2r), _mm_mul_ps(ai, v2i)));
+            _mm_storeu_ps(i1 + j, _mm_add_ps(_mm_mul_ps(ar, v2i), _mm_mul_ps(ai, v2r)));
+            _mm_storeu_ps(r2 + j, _mm_sub_ps(_mm_mul_ps(br, v1r), _mm_mul_ps(bi, v1i)));
+            _mm_storeu_ps(i2 + j, _mm_add_ps(_mm_mul_ps(br, v1i), _mm_mul_ps(bi, v1r)));
+            _mm_storeu_ps(r3 + j, _mm_sub_ps(_mm_mul_ps(cr, v3r), _mm_mul_ps(ci, v3i)));
+            _mm_storeu_ps(i3 + j, _mm_add_ps(_mm_mul_ps(cr, v3i), _mm_mul_ps(ci, v3r)));
+        }
+#endif
+        for (; j < q; ++j) {
+            const float s02r = r0[j] + r2[j], s02i = i0[j] + i2[j];
+            const float d02r = r0[j] - r2[j], d02i = i0[j] - i2[j];
+            const float s13r = r1[j] + r3[j], s13i = i1[j] + i3[j];
+            const float d13r = r1[j] - r3[j], d13i = i1[j] - i3[j];
+            r0[j] = s02r + s13r;
+            i0[j] = s02i + s13i;
+            const float ar = s02r - s13r, ai = s02i - s13i;
+            const float br = d02r + d13i, bi = d02i - d13r;
+            const float cr = d02r - d13i, ci = d02i + d13r;
+            r1[j] = ar * w2r[j] - ai * w2i[j];
+            i1[j] = ar * w2i[j] + ai * w2r[j];
+            r2[j] = br * w1r[j] - bi * w1i[j];
+            i2[j] = br * w1i[j] + bi * w1r[j];
+            r3[j] = cr * w3r[j] - ci * w3i[j];
+            i3[j] = cr * w3i[j] + ci * w3r[j];
+        }
+    }
+}
+
+void Fft::forward(float* re, float* im) const
+{
+    if (!valid()) {
+        return;
+    }
+    for (size_t s = 0; s < stages_.size(); ++s) {
+        radix4(stages_[s], re, im);
+    }
+    if ((stages_.empty() ? size_ : stages_.back().quarter) == 2) {
+        // Odd power of two: a last radix-2 stage, its twiddles are all 1.
+        for (size_t k = 0; k < size_; k += 2) {
+            const float ar = re[k], ai = im[k];
+            re[k] = ar + re[k + 1];
+            im[k] = ai + im[k + 1];
+            re[k + 1] = ar - re[k + 1];
+            im[k + 1] = ai - im[k + 1];
+        }
+    }
+    for (size_t k = 0; k < swaps_.size(); k += 2) {
+        const uint32_t a = swaps_[k];
+        const uint32_t b = swaps_[k + 1];
+        const float tr = re[a], ti = im[a];
+        re[a] = re[b];
+        im[a] = im[b];
+        re[b] = tr;
+        im[b] = ti;
+    }
+}
@@ -0,0 +1,54 @@
+/******************************************************************************/
+/**
+ * \file    Fft.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * In place complex FFT of a power of two size, on split real and imaginary arrays.
+ *
+ * Decimation in frequency: radix-4 stages, plus one radix-2 stage when the size is an odd power of two,
+ * then a bit reversal. Each radix-4 butterfly is two radix-2 stages merged, with its outputs in radix-2
+ * order, so one bit reversal table serves all sizes. Twiddles and the bit reversal table are computed in
+ * the constructor, and the butterflies of a stage run four at a time with SSE once a stage has at least
+ * four of them per block.
+ **/
+
+#ifndef FFT_HPP
+#define FFT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Fft
+{
+public:
+    // size must be a power of two, at least 2.
+    explicit Fft(size_t size);
+
+    bool valid() const {return size_ != 0;}
+    size_t size() const {return size_;}
+
+    // Forward transform, X[k] = sum x[n] e^(-2 pi i n k / N), in place.
+    void forward(float* re, float* im) const;
+
+private:
+    struct Stage {
+        size_t quarter;       // Butterfly span, a quarter of the block.
+        size_t twiddles;      // Offset of the stage's twiddles: w1, w2, w3, each re[quarter] then im[quarter].
+    };
+
+    void radix4(const Stage& s, float* re, float* im) const;
+
+    size_t size_;
+    std::vector<Stage> stages_;
+    std::vector<float> twiddles_;
+    std::vector<uint32_t> swaps_;   // Index pairs exchanged by the bit reversal.
+};
+
+#endif // FFT_HPP
@@ -0,0 +1,54 @@
+/**
+ * \file    Frame.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "Frame.hpp"
+
+#include <cstring>
+
+uint16_t frameCrc(const uint8_t* data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+        for (int b = 0; b < 8; ++b) {
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+size_t encodeFrame(const Frame& f, uint8_t* out)
+{
+    out[0] = FRAME_SOF;
+    out[1] = f.frameClass;
+    out[2] = f.channel;
+    out[3] = f.seq & 0xFF;
+    out[4] = f.seq >> 8;
+    out[5] = f.deviceTime & 0xFF;
+    out[6] = (f.deviceTime >> 8) & 0xFF;
+    out[7] = (f.deviceTime >> 16) & 0xFF;
+    out[8] = (f.deviceTime >> 24) & 0xFF;
+    out[9] = f.length;
+    std::memcpy(out + FRAME_HEADER_SIZE, f.payload, f.length);
+    const uint16_t crc = frameCrc(out + 1, FRAME_HEADER_SIZE - 1 + f.length);
+    out[FRAME_HEADER_SIZE + f.length] = crc & 0xFF;
+    out[FRAME_HEADER_SIZE + f.length + 1] = crc >> 8;
+    return FRAME_HEADER_SIZE + f.length + FRAME_CRC_SIZE;
+}
+
+const char* frameClassName(int frameClass)
+{
+    switch (frameClass) {
+    case FRAME_ALARM: return "alarm";
+    case FRAME_PARAMETER: return "parameter";
+    case FRAME_WAVEFORM: return "waveform";
+    case FRAME_DIAGNOSTIC: return "diagnostic";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,59 @@
+/******************************************************************************/
+/**
+ * \file    Frame.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Serial frame format used by the devices:
+ *
+ *   SOF(0x7E) | class(1) | channel(1) | seq(2) | deviceTime(4) | length(1) | payload(length) | crc(2)
+ *
+ * Multi-byte fields are little endian. deviceTime counts device ticks (1 ms unless configured otherwise).
+ * The CRC is CRC-16/CCITT-FALSE over class..payload.
+ * Parameter frames carry one float32 value, waveform frames carry int16 samples.
+ **/
+
+#ifndef FRAME_HPP
+#define FRAME_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+enum FrameClass {
+    FRAME_ALARM = 0,
+    FRAME_PARAMETER = 1,
+    FRAME_WAVEFORM = 2,
+    FRAME_DIAGNOSTIC = 3,
+    FRAME_CLASS_COUNT
+};
+
+static const uint8_t FRAME_SOF = 0x7E;
+static const size_t FRAME_HEADER_SIZE = 10;
+static const size_t FRAME_CRC_SIZE = 2;
+static const size_t FRAME_MAX_PAYLOAD = 255;
+static const size_t FRAME_MAX_SIZE = FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + FRAME_CRC_SIZE;
+
+struct Frame {
+    int port;            // Index of the port the frame arrived on.
+    uint8_t frameClass;
+    uint8_t channel;
+    uint16_t seq;
+    uint32_t deviceTime;
+    int64_t timestampUs; // Host time (microseconds since epoch) from the port's timestamp model.
+    uint8_t length;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+};
+
+uint16_t frameCrc(const uint8_t* data, size_t len);
+
+// Encodes f into out, which must hold FRAME_MAX_SIZE bytes. Returns the encoded size.
+size_t encodeFrame(const Frame& f, uint8_t* out);
+
+const char* frameClassName(int frameClass);
+
+#endif // FRAME_HPP
@@ -0,0 +1,97 @@
+/**
+ * \file    FrameDecoder.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "FrameDecoder.hpp"
+
+#include <cstring>
+
+FrameDecoder::FrameDecoder(int port, DeviceState& state) :
+    port_(port),
+    state_(state),
+    readPos_(0),
+    bytesSinceSync_(0),
+    crcErrors_(0),
+    staleFrames_(0),
+    framesDecoded_(0)
+{
+    buffer_.reserve(4 * FRAME_MAX_SIZE);
+    frame_.port = port;
+}
+
+void FrameDecoder::reset()
+{
+    buffer_.clear();
+    readPos_ = 0;
+    bytesSinceSync_ = 0;
+}
+
+size_t FrameDecoder::feed(const uint8_t* data, size_t len, int64_t nowUs, const FrameHandler& handler)
+{
+    // Compact before appending so the buffer does not grow with the stream.
+    if (readPos_ > 0) {
+        buffer_.erase(buffer_.begin(), buffer_.begin() + readPos_);
+        readPos_ = 0;
+    }
+    buffer_.insert(buffer_.end(), data, data + len);
+
+    size_t decoded = 0;
+    const uint8_t* buf = buffer_.data();
+    const size_t size = buffer_.size();
+
+    while (size - readPos_ >= FRAME_HEADER_SIZE + FRAME_CRC_SIZE) {
+        const uint8_t* p = buf + readPos_;
+        if (p[0] != FRAME_SOF) {
+            const void* sof = std::memchr(p, FRAME_SOF, size - readPos_);
+            const size_t skip = sof ? static_cast<const uint8_t*>(sof) - p : size - readPos_;
+            readPos_ += skip;
+            bytesSinceSync_ += skip;
+            continue;
+        }
+        const size_t frameSize = FRAME_HEADER_SIZE + p[9] + FRAME_CRC_SIZE;
+        if (size - readPos_ < frameSize) {
+            break;
+        }
+        const uint16_t crc = p[frameSize - 2] | (p[frameSize - 1] << 8);
+        if (crc != frameCrc(p + 1, frameSize - 1 - FRAME_CRC_SIZE)) {
+            // Not a frame after all, resynchronize on the next SOF.
+            crcErrors_++;
+            readPos_++;
+            bytesSinceSync_++;
+            continue;
+        }
+
+        frame_.frameClass = p[1];
+        frame_.channel = p[2];
+        frame_.seq = p[3] | (p[4] << 8);
+        frame_.deviceTime = p[5] | (p[6] << 8) | (p[7] << 16) | (static_cast<uint32_t>(p[8]) << 24);
+        frame_.length = p[9];
+        std::memcpy(frame_.payload, p + FRAME_HEADER_SIZE, frame_.length);
+        frame_.timestampUs = state_.timestamps.toHostUs(frame_.deviceTime, nowUs);
+
+        // A small step forward is a gap of lost frames. A step back (half the sequence space or more) is a
+        // duplicate or a frame out of order; it is counted on its own and does not move lastSeq back.
+        const uint16_t gap = static_cast<uint16_t>(frame_.seq - static_cast<uint16_t>(state_.lastSeq + 1));
+        if (!state_.seqValid || gap < 0x8000) {
+            if (state_.seqValid) {
+                state_.lostFrames += gap;
+            }
+            state_.lastSeq = frame_.seq;
+            state_.seqValid = true;
+        } else {
+            staleFrames_++;
+        }
+
+        readPos_ += frameSize;
+        bytesSinceSync_ = 0;
+        framesDecoded_++;
+        decoded++;
+        handler(frame_);
+    }
+    return decoded;
+}
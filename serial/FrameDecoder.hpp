@@ -0,0 +1,62 @@
+/******************************************************************************/
+/**
+ * \file    FrameDecoder.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * FrameDecoder turns the byte stream of one port into Frames (see Frame.hpp). Bytes that do not form a
+ * complete frame yet are kept until the next call. Sequence numbers and the timestamp model are kept in
+ * the DeviceState passed to the constructor.
+ **/
+
+#ifndef FRAME_DECODER_HPP
+#define FRAME_DECODER_HPP
+
+#include "Frame.hpp"
+#include "DeviceState.hpp"
+
+#include <functional>
+#include <vector>
+
+class FrameDecoder
+{
+public:
+    typedef std::function<void(const Frame&)> FrameHandler;
+
+    explicit FrameDecoder(int port, DeviceState& state);
+
+    // Appends received bytes and calls handler for every complete frame. Returns the number of frames decoded.
+    size_t feed(const uint8_t* data, size_t len, int64_t nowUs, const FrameHandler& handler);
+
+    // Received bytes not yet decoded.
+    const uint8_t* pending() const {return buffer_.data() + readPos_;}
+    size_t pendingSize() const {return buffer_.size() - readPos_;}
+
+    // Bytes skipped while searching for a valid frame since the last decoded frame.
+    size_t bytesSinceSync() const {return bytesSinceSync_;}
+    unsigned long crcErrors() const {return crcErrors_;}
+    // Duplicate or reordered frames, sequence numbers behind the last one. Not counted as lost.
+    unsigned long staleFrames() const {return staleFrames_;}
+    unsigned long framesDecoded() const {return framesDecoded_;}
+
+    // Drops pending bytes, e.g. after a baud rate change.
+    void reset();
+
+private:
+    int port_;
+    DeviceState& state_;
+    std::vector<uint8_t> buffer_;
+    size_t readPos_;
+    size_t bytesSinceSync_;
+    unsigned long crcErrors_;
+    unsigned long staleFrames_;
+    unsigned long framesDecoded_;
+    Frame frame_;
+};
+
+#endif // FRAME_DECODER_HPP
@@ -0,0 +1,71 @@
+/**
+ * \file    FramePool.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "FramePool.hpp"
+#include "MemoryPlacement.hpp"
+
+FramePool::FramePool(size_t capacity, const std::string& name, int node) :
+    slots_(capacity > 0 ? static_cast<Slot*>(allocateBuffer(capacity * sizeof(Slot), name, node)) : nullptr),
+    capacity_(capacity),
+    local_(nullptr),
+    remote_(nullptr),
+    heap_(0),
+    refills_(0)
+{
+    for (size_t i = 0; i < capacity_; ++i) {
+        slots_[i].pool = this;
+        slots_[i].next = i + 1 < capacity_ ? &slots_[i + 1] : nullptr;
+    }
+    local_ = slots_;
+}
+
+FramePool::~FramePool()
+{
+    freeBuffer(slots_);
+}
+
+Frame* FramePool::get()
+{
+    if (local_ == nullptr) {
+        local_ = remote_.exchange(nullptr, std::memory_order_acquire);
+        if (local_ == nullptr) {
+            heap_.store(heap_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            Slot* s = new Slot;
+            s->pool = nullptr;
+            return &s->frame;
+        }
+        refills_.store(refills_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    Slot* s = local_;
+    local_ = s->next;
+    return &s->frame;
+}
+
+void FramePool::put(Frame* f)
+{
+    Slot* s = reinterpret_cast<Slot*>(f);
+    FramePool* pool = s->pool;
+    if (pool == nullptr) {
+        delete s;
+        return;
+    }
+    Slot* head = pool->remote_.load(std::memory_order_relaxed);
+    do {
+        s->next = head;
+    } while (!pool->remote_.compare_exchange_weak(head, s, std::memory_order_release, std::memory_order_relaxed));
+}
+
+FramePoolStats FramePool::stats() const
+{
+    FramePoolStats s;
+    s.capacity = capacity_;
+    s.heap = heap_.load(std::memory_order_relaxed);
+    s.refills = refills_.load(std::memory_order_relaxed);
+    return s;
+}
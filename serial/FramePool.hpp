@@ -0,0 +1,71 @@
+/******************************************************************************/
+/**
+ * \file    FramePool.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Fixed set of Frames for one port, so decoded frames are queued and delivered without a heap allocation
+ * per frame. A Frame holds its payload, so a pooled frame is both the descriptor and the payload buffer.
+ *
+ * get() is called by the thread reading the port (one thread at a time, the epoll loop or a BusyPoller)
+ * and takes frames from a local free list without atomics. Frames are returned with put() from any
+ * thread, usually the dispatcher. Returned frames go onto a lock-free remote free list (a Treiber stack);
+ * when the local list is empty, get() takes the whole remote list in one exchange. The owner only ever
+ * takes the whole list, so there is no ABA problem. When all frames are in use, get() falls back to the
+ * heap and counts it, and put() deletes such frames again.
+ *
+ * The frames are one buffer from allocateBuffer(), on huge pages and the node of the reading thread when
+ * available (see MemoryPlacement.hpp). Frames must all be returned before the pool is destroyed.
+ **/
+
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include "Frame.hpp"
+
+#include <atomic>
+#include <string>
+
+struct FramePoolStats {
+    explicit FramePoolStats(){capacity=0;heap=0;refills=0;}
+    unsigned long capacity;
+    unsigned long heap;       // Frames allocated from the heap because the pool was empty.
+    unsigned long refills;    // Remote free lists taken over by get().
+};
+
+class FramePool
+{
+public:
+    // On node, -1 for the node of the calling thread.
+    explicit FramePool(size_t capacity=4096, const std::string& name="frame pool", int node=-1);
+    ~FramePool();
+
+    // Only from the thread reading the port. Never fails, the frame comes from the heap if the pool is empty.
+    Frame* get();
+    // Returns a frame from get() of any pool, from any thread.
+    static void put(Frame* f);
+
+    size_t capacity() const {return capacity_;}
+    FramePoolStats stats() const;
+
+private:
+    struct Slot {
+        Frame frame;          // First, so a Frame* is the address of its Slot.
+        FramePool* pool;      // Null for frames from the heap.
+        Slot* next;
+    };
+
+    Slot* slots_;
+    size_t capacity_;
+    Slot* local_;                     // Owner thread only.
+    std::atomic<Slot*> remote_;
+    std::atomic<unsigned long> heap_;
+    std::atomic<unsigned long> refills_;
+};
+
+#endif // FRAME_POOL_HPP
@@ -0,0 +1,194 @@
+/**
+ * \file    FrameQueue.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "FrameQueue.hpp"
+#include "FramePool.hpp"
+
+#include <chrono>
+
+// Default weighted round: 8 parameters, 4 waveforms, 1 diagnostic.
+static const unsigned DEFAULT_WEIGHTS[FRAME_CLASS_COUNT] = {1, 8, 4, 1};
+
+FrameQueue::FrameQueue(size_t capacity) :
+    policy_(SCHEDULE_STRICT),
+    capacity_(capacity),
+    depth_(0),
+    closed_(false)
+{
+    setWeights(DEFAULT_WEIGHTS);
+}
+
+FrameQueue::~FrameQueue()
+{
+    for (int c = 0; c < FRAME_CLASS_COUNT; ++c) {
+        while (!queues_[c].empty()) {
+            FramePool::put(queues_[c].popFront());
+        }
+    }
+}
+
+void FrameQueue::Ring::pushBack(Frame* f)
+{
+    if (size_ == slots_.size()) {
+        std::vector<Frame*> grown(slots_.empty() ? 64 : 2 * slots_.size());
+        for (size_t i = 0; i < size_; ++i) {
+            grown[i] = slots_[(head_ + i) & (slots_.size() - 1)];
+        }
+        slots_.swap(grown);
+        head_ = 0;
+    }
+    slots_[(head_ + size_) & (slots_.size() - 1)] = f;
+    size_++;
+}
+
+Frame* FrameQueue::Ring::popFront()
+{
+    Frame* f = slots_[head_];
+    head_ = (head_ + 1) & (slots_.size() - 1);
+    size_--;
+    return f;
+}
+
+void FrameQueue::setWeights(const unsigned weights[FRAME_CLASS_COUNT])
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int c = 0; c < FRAME_CLASS_COUNT; ++c) {
+        weights_[c] = weights[c] > 0 ? weights[c] : 1;
+        credits_[c] = weights_[c];
+    }
+}
+
+size_t FrameQueue::shedLimit(int frameClass) const
+{
+    switch (frameClass) {
+    case FRAME_DIAGNOSTIC: return capacity_ / 2;
+    case FRAME_WAVEFORM: return capacity_ - capacity_ / 4;
+    default: return capacity_;
+    }
+}
+
+bool FrameQueue::push(Frame* f)
+{
+    const int c = f->frameClass < FRAME_CLASS_COUNT ? f->frameClass : FRAME_DIAGNOSTIC;
+    Frame* shed = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Ring& q = queues_[c];
+        FrameClassStats& s = stats_[c];
+        if (c != FRAME_ALARM && depth_ >= shedLimit(c)) {
+            // The oldest frame of the lowest class with frames goes, down to the class of the new frame.
+            int victim = FRAME_DIAGNOSTIC;
+            while (victim > c && queues_[victim].empty()) {
+                victim--;
+            }
+            if (queues_[victim].empty()) {
+                // Only alarms and higher classes are queued, the new frame is the one to go.
+                s.dropped++;
+                shed = f;
+            } else {
+                stats_[victim].shed++;
+                shed = queues_[victim].popFront();
+                depth_--;
+            }
+        }
+        if (shed != f) {
+            q.pushBack(f);
+            depth_++;
+            s.enqueued++;
+            if (q.size() > s.maxDepth) {
+                s.maxDepth = q.size();
+            }
+        }
+    }
+    if (shed != nullptr) {
+        FramePool::put(shed);
+    }
+    if (shed == f) {
+        return false;
+    }
+    ready_.notify_one();
+    return shed == nullptr;
+}
+
+int FrameQueue::nextClass()
+{
+    if (!queues_[FRAME_ALARM].empty()) {
+        return FRAME_ALARM;
+    }
+    if (policy_ == SCHEDULE_STRICT) {
+        for (int c = FRAME_ALARM + 1; c < FRAME_CLASS_COUNT; ++c) {
+            if (!queues_[c].empty()) {
+                return c;
+            }
+        }
+        return -1;
+    }
+    // Deficit round robin: the highest class with frames and credits left. When every class with frames
+    // has used its credits, a new round starts.
+    for (int round = 0; round < 2; ++round) {
+        for (int c = FRAME_ALARM + 1; c < FRAME_CLASS_COUNT; ++c) {
+            if (!queues_[c].empty() && credits_[c] > 0) {
+                credits_[c]--;
+                return c;
+            }
+        }
+        for (int c = FRAME_ALARM + 1; c < FRAME_CLASS_COUNT; ++c) {
+            credits_[c] = weights_[c];
+        }
+    }
+    return -1;
+}
+
+bool FrameQueue::pop(Frame*& f, int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    const auto ready = [this] { return depth_ > 0 || closed_; };
+    if (timeoutMs < 0) {
+        ready_.wait(lock, ready);
+    } else if (!ready_.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready)) {
+        return false;
+    }
+    const int c = nextClass();
+    if (c < 0) {
+        return false;
+    }
+    f = queues_[c].popFront();
+    depth_--;
+    stats_[c].delivered++;
+    return true;
+}
+
+void FrameQueue::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+    ready_.notify_all();
+}
+
+bool FrameQueue::closed() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_;
+}
+
+size_t FrameQueue::depth() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return depth_;
+}
+
+FrameClassStats FrameQueue::stats(int frameClass) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    FrameClassStats s = stats_[frameClass];
+    s.depth = queues_[frameClass].size();
+    return s;
+}
@@ -0,0 +1,109 @@
+/******************************************************************************/
+/**
+ * \file    FrameQueue.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * FrameQueue sits between the port readers and the consumers of decoded frames. Each frame class has its
+ * own queue, and pop() takes frames by priority: alarm > parameter > waveform > diagnostic.
+ *
+ * Alarms always go first and are never shed. The other classes are scheduled either strictly by priority,
+ * or weighted (deficit round robin), which keeps a flood of parameters from starving waveforms. Under
+ * pressure the low priority classes are shed first: a frame of a class makes room once the total queue
+ * depth reaches its share of the capacity (diagnostic 1/2, waveform 3/4, parameter all of it). It drops
+ * the oldest frame of the lowest class that has frames queued (diagnostic, then waveform), and of its own
+ * class only when no lower class has any, since the newest data is the most useful. If only higher
+ * classes are queued, the new frame is dropped on arrival, which is counted apart from the shed frames.
+ *
+ * Frames are queued by pointer, from a FramePool: push() takes the frame over and pop() hands it to the
+ * caller, who returns it with FramePool::put(). Shed frames are returned by the queue. The queue of each
+ * class is a ring that grows to the largest depth seen and never shrinks, so queuing does not allocate in
+ * steady state.
+ **/
+
+#ifndef FRAME_QUEUE_HPP
+#define FRAME_QUEUE_HPP
+
+#include "Frame.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+enum SchedulePolicy {
+    SCHEDULE_STRICT,
+    SCHEDULE_WEIGHTED
+};
+
+// enqueued == delivered + shed + depth for each class.
+struct FrameClassStats {
+    explicit FrameClassStats(){enqueued=0;delivered=0;shed=0;dropped=0;depth=0;maxDepth=0;}
+    unsigned long enqueued;
+    unsigned long delivered;
+    unsigned long shed;      // Queued frames dropped to make room.
+    unsigned long dropped;   // New frames dropped on arrival, never enqueued.
+    unsigned long depth;     // Queued now.
+    unsigned long maxDepth;
+};
+
+class FrameQueue
+{
+public:
+    explicit FrameQueue(size_t capacity=4096);
+    ~FrameQueue();
+
+    void setPolicy(SchedulePolicy policy) {policy_ = policy;}
+    // Frames of each class taken per weighted round. The alarm weight is ignored, alarms always go first.
+    void setWeights(const unsigned weights[FRAME_CLASS_COUNT]);
+    void setCapacity(size_t capacity) {capacity_ = capacity;}
+    size_t capacity() const {return capacity_;}
+
+    // Takes over f, a frame from FramePool::get(). Returns false if a frame had to be shed to make room.
+    bool push(Frame* f);
+    // Waits up to timeoutMs (-1 forever) for a frame, which the caller returns with FramePool::put(). After
+    // close(), returns the remaining frames and then false.
+    bool pop(Frame*& f, int timeoutMs=-1);
+    void close();
+    bool closed() const;
+
+    size_t depth() const;
+    FrameClassStats stats(int frameClass) const;
+
+private:
+    // FIFO of the frames of one class.
+    class Ring
+    {
+    public:
+        explicit Ring() : head_(0), size_(0) {}
+        bool empty() const {return size_ == 0;}
+        size_t size() const {return size_;}
+        void pushBack(Frame* f);
+        Frame* popFront();
+
+    private:
+        std::vector<Frame*> slots_;   // Power of two.
+        size_t head_;
+        size_t size_;
+    };
+
+    int nextClass();
+    size_t shedLimit(int frameClass) const;
+
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    Ring queues_[FRAME_CLASS_COUNT];
+    FrameClassStats stats_[FRAME_CLASS_COUNT];
+    unsigned weights_[FRAME_CLASS_COUNT];
+    unsigned credits_[FRAME_CLASS_COUNT];
+    SchedulePolicy policy_;
+    size_t capacity_;
+    size_t depth_;
+    bool closed_;
+};
+
+#endif // FRAME_QUEUE_HPP
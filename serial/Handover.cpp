@@ -0,0 +1,248 @@
+/**
+ * \file    Handover.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "Handover.hpp"
+#include "Trace.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const uint32_t HANDOVER_MAGIC = 0x676E484F; // "gnHO"
+static const uint32_t HANDOVER_VERSION = 1;
+// One fd per port, more ports than this are not expected on a device.
+static const size_t HANDOVER_MAX_FDS = 64;
+
+struct HandoverHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t fdCount;
+    uint32_t payloadSize;
+};
+
+static bool makeAddress(const std::string& path, struct sockaddr_un& addr)
+{
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << path << ": socket path too long" << std::endl;
+        return false;
+    }
+    std::strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+int listenHandover(const std::string& path)
+{
+    TRACE();
+    struct sockaddr_un addr;
+    if (!makeAddress(path, addr)) {
+        TRACE_RETURN(-1);
+    }
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        std::cerr << "socket: " << strerror(errno) << std::endl;
+        TRACE_RETURN(-1);
+    }
+    (void) unlink(path.c_str());
+    if (bind(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(sock, 1) != 0) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        ::close(sock);
+        TRACE_RETURN(-1);
+    }
+    TRACE_RETURN(sock);
+}
+
+int connectHandover(const std::string& path)
+{
+    TRACE();
+    struct sockaddr_un addr;
+    if (!makeAddress(path, addr)) {
+        TRACE_RETURN(-1);
+    }
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        std::cerr << "socket: " << strerror(errno) << std::endl;
+        TRACE_RETURN(-1);
+    }
+    if (connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        ::close(sock);
+        TRACE_RETURN(-1);
+    }
+    TRACE_RETURN(sock);
+}
+
+static bool writeAll(int sock, const char* data, size_t len)
+{
+    while (len > 0) {
+        const ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool readAll(int sock, char* data, size_t len)
+{
+    while (len > 0) {
+        const ssize_t n = recv(sock, data, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool sendHandover(int sock, const std::vector<HandoverPort>& ports)
+{
+    TRACE();
+    if (ports.size() > HANDOVER_MAX_FDS) {
+        std::cerr << "Handover: too many ports" << std::endl;
+        TRACE_RETURN(false);
+    }
+    std::ostringstream os;
+    try
+    {
+        boost::archive::binary_oarchive oa(os, boost::archive::no_header);
+        oa << ports;
+    } catch(std::exception& e)
+    {
+        std::cerr << "Handover: " << e.what() << std::endl;
+        TRACE_RETURN(false);
+    }
+    const std::string payload = os.str();
+
+    HandoverHeader h;
+    h.magic = HANDOVER_MAGIC;
+    h.version = HANDOVER_VERSION;
+    h.fdCount = static_cast<uint32_t>(ports.size());
+    h.payloadSize = static_cast<uint32_t>(payload.size());
+
+    struct iovec iov;
+    iov.iov_base = &h;
+    iov.iov_len = sizeof(h);
+    char control[CMSG_SPACE(HANDOVER_MAX_FDS * sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (!ports.empty()) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(ports.size() * sizeof(int));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(ports.size() * sizeof(int));
+        int* fds = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+        for (size_t i = 0; i < ports.size(); ++i) {
+            fds[i] = ports[i].fd;
+        }
+    }
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n != static_cast<ssize_t>(sizeof(h)) || !writeAll(sock, payload.data(), payload.size())) {
+        std::cerr << "Handover: send failed: " << strerror(errno) << std::endl;
+        TRACE_RETURN(false);
+    }
+    TRACE_PRINT("handover", ("Sent %d ports, %d bytes", (int) ports.size(), (int) payload.size()));
+    TRACE_RETURN(true);
+}
+
+bool receiveHandover(int sock, std::vector<HandoverPort>& ports)
+{
+    TRACE();
+    HandoverHeader h;
+    struct iovec iov;
+    iov.iov_base = &h;
+    iov.iov_len = sizeof(h);
+    char control[CMSG_SPACE(HANDOVER_MAX_FDS * sizeof(int))];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != static_cast<ssize_t>(sizeof(h))) {
+        std::cerr << "Handover: no header received" << std::endl;
+        TRACE_RETURN(false);
+    }
+
+    std::vector<int> fds;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* data = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+            fds.insert(fds.end(), data, data + count);
+        }
+    }
+    if (h.magic != HANDOVER_MAGIC || h.version != HANDOVER_VERSION || fds.size() != h.fdCount
+            || (msg.msg_flags & MSG_CTRUNC)) {
+        std::cerr << "Handover: invalid header" << std::endl;
+        for (size_t i = 0; i < fds.size(); ++i) {
+            ::close(fds[i]);
+        }
+        TRACE_RETURN(false);
+    }
+
+    std::string payload(h.payloadSize, '\0');
+    bool ok = readAll(sock, &payload[0], payload.size());
+    if (ok) {
+        try
+        {
+            std::istringstream is(payload);
+            boost::archive::binary_iarchive ia(is, boost::archive::no_header);
+            ia >> ports;
+        } catch(std::exception& e)
+        {
+            std::cerr << "Handover: " << e.what() << std::endl;
+            ok = false;
+        }
+    }
+    if (!ok || ports.size() != fds.size()) {
+        std::cerr << "Handover: invalid payload" << std::endl;
+        ports.clear();
+        for (size_t i = 0; i < fds.size(); ++i) {
+            ::close(fds[i]);
+        }
+        TRACE_RETURN(false);
+    }
+    for (size_t i = 0; i < ports.size(); ++i) {
+        ports[i].fd = fds[i];
+    }
+    TRACE_PRINT("handover", ("Received %d ports", (int) ports.size()));
+    TRACE_RETURN(true);
+}
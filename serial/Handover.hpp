@@ -0,0 +1,56 @@
+/******************************************************************************/
+/**
+ * \file    Handover.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Handover of open ports from a running driver to a newly started one, used for upgrades without closing
+ * the serial ports. The running driver listens on a UNIX stream socket. The new driver connects, and the
+ * running one stops reading, sends the port fds (SCM_RIGHTS) followed by the undecoded bytes and device
+ * state of every port, and exits. Bytes arriving meanwhile stay in the tty buffers, so nothing is lost.
+ *
+ * Wire format: a HandoverHeader carrying the fds as ancillary data, then payloadSize bytes of
+ * boost::serialization binary archive holding the HandoverPorts in fd order.
+ **/
+
+#ifndef HANDOVER_HPP
+#define HANDOVER_HPP
+
+#include "DeviceState.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/serialization/vector.hpp>
+
+struct HandoverPort {
+    explicit HandoverPort(){configuredBaudRate=0;fd=-1;}
+
+    std::string path;
+    int configuredBaudRate; // As given on the command line, 0 means autodetect.
+    std::vector<uint8_t> pending;
+    DeviceState state;
+    int fd;                 // Not serialized, travels as SCM_RIGHTS.
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int /*version*/) {
+        ar & path & configuredBaudRate & pending & state;
+    }
+};
+
+// Returns a listening socket bound to path, or -1. An existing socket file is replaced.
+int listenHandover(const std::string& path);
+// Returns a socket connected to the driver listening on path, or -1.
+int connectHandover(const std::string& path);
+
+bool sendHandover(int sock, const std::vector<HandoverPort>& ports);
+// On success the caller owns the received fds, on failure they are closed.
+bool receiveHandover(int sock, std::vector<HandoverPort>& ports);
+
+#endif // HANDOVER_HPP
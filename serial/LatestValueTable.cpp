@@ -0,0 +1,221 @@
+/**
+ * \file    LatestValueTable.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "LatestValueTable.hpp"
+#include "CpuRelax.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(LatestValueSlot) == 64, "a slot must be one cache line");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory atomics must be lock free");
+
+// Time a writer gets to finish an update before its slot is taken for abandoned. An update takes nanoseconds.
+static const int ABANDONED_WRITE_MS = 10;
+
+static std::string shmName(const std::string& name)
+{
+    return name[0] == '/' ? name : "/" + name;
+}
+
+static size_t tableSize(int ports)
+{
+    return sizeof(LatestValueHeader) + static_cast<size_t>(ports) * LATEST_VALUE_CHANNELS * sizeof(LatestValueSlot);
+}
+
+LatestValueTable::LatestValueTable() :
+    base_(nullptr),
+    size_(0),
+    slots_(nullptr),
+    ports_(0)
+{
+}
+
+LatestValueTable::~LatestValueTable()
+{
+    if (base_ != nullptr) {
+        munmap(base_, size_);
+    }
+}
+
+bool LatestValueTable::create(const std::string& name, int ports)
+{
+    return map(name, true, ports);
+}
+
+bool LatestValueTable::attach(const std::string& name)
+{
+    return map(name, false, 0);
+}
+
+bool LatestValueTable::map(const std::string& name, bool writable, int ports)
+{
+    if (base_ != nullptr) {
+        munmap(base_, size_);
+        base_ = nullptr;
+        slots_ = nullptr;
+    }
+
+    int fd = -1;
+    if (!name.empty()) {
+        const std::string path = shmName(name);
+        fd = shm_open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+        if (fd < 0) {
+            std::cerr << path << ": shm_open: " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (!writable) {
+            // The size follows from the header.
+            LatestValueHeader h;
+            if (pread(fd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h))
+                    || h.magic.load() != LATEST_VALUE_MAGIC || h.version != LATEST_VALUE_VERSION
+                    || h.channels != static_cast<uint32_t>(LATEST_VALUE_CHANNELS) || h.slotSize != sizeof(LatestValueSlot)) {
+                std::cerr << path << ": not a latest value table" << std::endl;
+                ::close(fd);
+                return false;
+            }
+            ports = static_cast<int>(h.ports);
+        } else if (ftruncate(fd, static_cast<off_t>(tableSize(ports))) != 0) {
+            std::cerr << path << ": ftruncate: " << strerror(errno) << std::endl;
+            ::close(fd);
+            return false;
+        }
+    }
+
+    size_ = tableSize(ports);
+    const int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    base_ = fd < 0 ? mmap(nullptr, size_, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+                   : mmap(nullptr, size_, prot, MAP_SHARED, fd, 0);
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    if (base_ == MAP_FAILED) {
+        std::cerr << name << ": mmap: " << strerror(errno) << std::endl;
+        base_ = nullptr;
+        return false;
+    }
+
+    LatestValueHeader* h = static_cast<LatestValueHeader*>(base_);
+    if (writable && (h->magic.load() != LATEST_VALUE_MAGIC || h->version != LATEST_VALUE_VERSION
+                     || h->ports != static_cast<uint32_t>(ports) || h->slotSize != sizeof(LatestValueSlot))) {
+        // New table or a different layout: start empty. A table with the same layout keeps its values.
+        h->magic.store(0);
+        std::memset(static_cast<char*>(base_) + sizeof(LatestValueHeader), 0, size_ - sizeof(LatestValueHeader));
+        h->version = LATEST_VALUE_VERSION;
+        h->ports = static_cast<uint32_t>(ports);
+        h->channels = LATEST_VALUE_CHANNELS;
+        h->slotSize = sizeof(LatestValueSlot);
+        h->magic.store(LATEST_VALUE_MAGIC, std::memory_order_release);
+    }
+    slots_ = reinterpret_cast<LatestValueSlot*>(static_cast<char*>(base_) + sizeof(LatestValueHeader));
+    ports_ = ports;
+    if (writable) {
+        releaseAbandonedSlots();
+    }
+    return true;
+}
+
+void LatestValueTable::releaseAbandonedSlots()
+{
+    // A writer killed within update() leaves its slot odd, and writers and readers would spin on it forever.
+    // The previous driver may still be finishing its last updates around a handover, so a slot only counts
+    // as abandoned if it is still odd, with the same sequence, after a while.
+    const size_t count = static_cast<size_t>(ports_) * LATEST_VALUE_CHANNELS;
+    std::vector<std::pair<size_t, uint32_t> > odd;
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t seq = slots_[i].seq.load(std::memory_order_relaxed);
+        if (seq & 1) {
+            odd.push_back(std::make_pair(i, seq));
+        }
+    }
+    if (odd.empty()) {
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(ABANDONED_WRITE_MS));
+    size_t released = 0;
+    for (size_t i = 0; i < odd.size(); ++i) {
+        uint32_t seq = odd[i].second;
+        // The slot keeps what the killed writer left in it, possibly a mix of two updates, until it is written again.
+        if (slots_[odd[i].first].seq.compare_exchange_strong(seq, seq + 1, std::memory_order_release,
+                                                              std::memory_order_relaxed)) {
+            released++;
+        }
+    }
+    if (released > 0) {
+        std::cerr << "latest value table: released " << released << " slots left in an update" << std::endl;
+    }
+}
+
+LatestValueSlot* LatestValueTable::slot(int port, int channel) const
+{
+    if (slots_ == nullptr || port < 0 || port >= ports_ || channel < 0 || channel >= LATEST_VALUE_CHANNELS) {
+        return nullptr;
+    }
+    return slots_ + port * LATEST_VALUE_CHANNELS + channel;
+}
+
+void LatestValueTable::update(int port, int channel, float value, int64_t timestampUs, uint16_t frameSeq)
+{
+    LatestValueSlot* s = slot(port, channel);
+    if (s == nullptr) {
+        return;
+    }
+    // Taking the odd sequence with a CAS keeps the slot consistent even if two writers meet, e.g. the
+    // old and the new driver around a handover.
+    uint32_t seq = s->seq.load(std::memory_order_relaxed);
+    for (;;) {
+        if (seq & 1) {
+            cpuRelax();
+            seq = s->seq.load(std::memory_order_relaxed);
+        } else if (s->seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    s->value.store(bits, std::memory_order_relaxed);
+    s->timestampUs.store(timestampUs, std::memory_order_relaxed);
+    s->frameSeq.store(frameSeq, std::memory_order_relaxed);
+    s->updates.store(s->updates.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    s->seq.store(seq + 2, std::memory_order_release);
+}
+
+bool LatestValueTable::read(int port, int channel, LatestValue& v) const
+{
+    const LatestValueSlot* s = slot(port, channel);
+    if (s == nullptr) {
+        return false;
+    }
+    for (;;) {
+        const uint32_t seq = s->seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            cpuRelax();
+            continue;
+        }
+        const uint32_t bits = s->value.load(std::memory_order_relaxed);
+        v.timestampUs = s->timestampUs.load(std::memory_order_relaxed);
+        v.frameSeq = s->frameSeq.load(std::memory_order_relaxed);
+        v.updates = s->updates.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s->seq.load(std::memory_order_relaxed) == seq) {
+            std::memcpy(&v.value, &bits, sizeof(v.value));
+            return v.updates != 0;
+        }
+    }
+}
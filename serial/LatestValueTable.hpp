@@ -0,0 +1,92 @@
+/******************************************************************************/
+/**
+ * \file    LatestValueTable.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Latest value of every parameter channel, for components that only want the current numbers and not
+ * the streams. The table has a fixed layout: a header followed by ports * LATEST_VALUE_CHANNELS slots of
+ * one cache line each, slot = port * LATEST_VALUE_CHANNELS + channel. Each slot is protected by a seqlock,
+ * so readers never block the driver and never take a lock: they retry if the slot changed while it was
+ * copied.
+ *
+ * The driver creates the table in POSIX shared memory (/dev/shm/<name>) and other processes map it
+ * read-only with attach(). The table is not removed at exit, so readers keep their mapping across driver
+ * restarts and handovers; a new driver reuses a table with the same layout. A slot that a killed driver left
+ * in the middle of an update is released by the next driver that creates the table.
+ **/
+
+#ifndef LATEST_VALUE_TABLE_HPP
+#define LATEST_VALUE_TABLE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+static const uint32_t LATEST_VALUE_MAGIC = 0x564c6e67; // "gnLV"
+static const uint32_t LATEST_VALUE_VERSION = 1;
+static const int LATEST_VALUE_CHANNELS = 256;
+
+struct alignas(64) LatestValueHeader {
+    std::atomic<uint32_t> magic;  // Written last, when the table is initialized.
+    uint32_t version;
+    uint32_t ports;
+    uint32_t channels;
+    uint32_t slotSize;
+};
+
+// All fields are atomics so that a copy racing with the writer is well defined, the seqlock tells
+// whether the copy is consistent.
+struct alignas(64) LatestValueSlot {
+    std::atomic<uint32_t> seq;        // Odd while the slot is written.
+    std::atomic<uint32_t> value;      // float bits
+    std::atomic<int64_t> timestampUs;
+    std::atomic<uint64_t> updates;    // 0 if never written.
+    std::atomic<uint16_t> frameSeq;
+};
+
+struct LatestValue {
+    float value;
+    int64_t timestampUs;
+    uint64_t updates;
+    uint16_t frameSeq;
+};
+
+class LatestValueTable
+{
+public:
+    explicit LatestValueTable();
+    ~LatestValueTable();
+
+    // Creates (or reuses) the table in shared memory. An empty name gives a private table.
+    bool create(const std::string& name, int ports);
+    // Maps an existing table read-only.
+    bool attach(const std::string& name);
+
+    bool valid() const {return slots_ != nullptr;}
+    int ports() const {return ports_;}
+
+    // Safe from several writers, but meant for one writer per slot.
+    void update(int port, int channel, float value, int64_t timestampUs, uint16_t frameSeq);
+    // Returns false if the slot is out of range or was never written.
+    bool read(int port, int channel, LatestValue& v) const;
+
+private:
+    bool map(const std::string& name, bool writable, int ports);
+    // Makes slots even again that a killed writer left odd.
+    void releaseAbandonedSlots();
+    LatestValueSlot* slot(int port, int channel) const;
+
+    void* base_;
+    size_t size_;
+    LatestValueSlot* slots_;
+    int ports_;
+};
+
+#endif // LATEST_VALUE_TABLE_HPP
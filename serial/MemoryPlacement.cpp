@@ -0,0 +1,324 @@
+/**
+ * \file    MemoryPlacement.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "MemoryPlacement.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Pages looked up per buffer for the node report.
+static const size_t NODE_SAMPLES = 64;
+
+static std::mutex s_mutex;
+static std::vector<BufferPlacement> s_buffers;
+
+static size_t readHugePageSize()
+{
+    std::ifstream in("/proc/meminfo");
+    std::string line;
+    while (std::getline(in, line)) {
+        unsigned long kb;
+        if (sscanf(line.c_str(), "Hugepagesize: %lu kB", &kb) == 1 && kb > 0) {
+            return kb * 1024;
+        }
+    }
+    return 2 * 1024 * 1024;
+}
+
+size_t hugePageSize()
+{
+    static const size_t size = readHugePageSize();
+    return size;
+}
+
+int currentNode()
+{
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return static_cast<int>(node);
+}
+
+int cpuNode(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* dir = opendir(path);
+    if (dir == nullptr) {
+        return -1;
+    }
+    int node = -1;
+    while (struct dirent* e = readdir(dir)) {
+        if (std::strncmp(e->d_name, "node", 4) == 0 && isdigit(static_cast<unsigned char>(e->d_name[4]))) {
+            node = atoi(e->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+int numaNodes()
+{
+    // "0", "0-1" or "0,2-3".
+    std::ifstream in("/sys/devices/system/node/online");
+    std::string online;
+    if (!std::getline(in, online)) {
+        return 1;
+    }
+    int count = 0;
+    std::stringstream ss(online);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        int first;
+        int last;
+        const int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+        count += n == 2 ? last - first + 1 : n == 1 ? 1 : 0;
+    }
+    return std::max(1, count);
+}
+
+// Prefers node for the pages of [p, p + bytes). Fails on kernels without NUMA.
+static bool bindNode(void* p, size_t bytes, int node, unsigned flags)
+{
+    unsigned long mask = 0;
+    if (node < 0 || node >= static_cast<int>(sizeof(mask) * 8)) {
+        return false;
+    }
+    mask = 1ul << node;
+    // The kernel takes one bit more than it uses.
+    return syscall(SYS_mbind, p, bytes, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, flags) == 0;
+}
+
+static void registerBuffer(void* p, size_t bytes, const std::string& name, PageKind pages, int node, bool owned)
+{
+    BufferPlacement b;
+    b.name = name;
+    b.address = p;
+    b.bytes = bytes;
+    b.pages = pages;
+    b.node = node;
+    b.owned = owned;
+    b.hugeBytes = 0;
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_buffers.push_back(b);
+}
+
+// Removes p from the registry, returns its entry.
+static bool unregisterBuffer(void* p, BufferPlacement& found)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (size_t i = 0; i < s_buffers.size(); ++i) {
+        if (s_buffers[i].address == p) {
+            found = s_buffers[i];
+            s_buffers.erase(s_buffers.begin() + i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void* allocateBuffer(size_t bytes, const std::string& name, int node)
+{
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t huge = hugePageSize();
+    if (node < 0) {
+        node = currentNode();
+    }
+    PageKind pages = PAGES_NORMAL;
+    size_t size = 0;
+    void* p = MAP_FAILED;
+    if (bytes >= huge / 2) {
+        size = (bytes + huge - 1) / huge * huge;
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            pages = PAGES_HUGETLB;
+        } else {
+            // No reserved huge pages. Aligned to a huge page, so transparent huge pages can back all of it.
+            char* raw = static_cast<char*>(mmap(nullptr, size + huge, PROT_READ | PROT_WRITE,
+                                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (raw != MAP_FAILED) {
+                char* start = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(raw) + huge - 1) & ~(huge - 1));
+                if (start > raw) {
+                    munmap(raw, start - raw);
+                }
+                munmap(start + size, huge - (start - raw));
+                p = start;
+                if (madvise(p, size, MADV_HUGEPAGE) == 0) {
+                    pages = PAGES_TRANSPARENT_HUGE;
+                }
+            }
+        }
+    }
+    if (p == MAP_FAILED) {
+        size = (std::max<size_t>(bytes, 1) + page - 1) / page * page;
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            std::cerr << name << ": mmap: " << strerror(errno) << std::endl;
+            throw std::bad_alloc();
+        }
+    }
+    if (!bindNode(p, size, node, 0)) {
+        node = -1;
+    }
+    // Fault the pages in now, on the node and with the page size chosen, rather than on the data path.
+    std::memset(p, 0, size);
+    registerBuffer(p, size, name, pages, node, true);
+    return p;
+}
+
+void freeBuffer(void* p)
+{
+    BufferPlacement b;
+    if (p != nullptr && unregisterBuffer(p, b) && b.owned) {
+        munmap(b.address, b.bytes);
+    }
+}
+
+void placeBuffer(void* p, size_t bytes, const std::string& name, int node)
+{
+    if (node < 0) {
+        node = currentNode();
+    }
+    // Shared memory gets huge pages only if /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it.
+    const PageKind pages = bytes >= hugePageSize() && madvise(p, bytes, MADV_HUGEPAGE) == 0
+                           ? PAGES_TRANSPARENT_HUGE : PAGES_NORMAL;
+    // A segment kept from the previous driver already has its pages, move them.
+    if (!bindNode(p, bytes, node, MPOL_MF_MOVE)) {
+        node = -1;
+    }
+    registerBuffer(p, bytes, name, pages, node, false);
+}
+
+void forgetBuffer(void* p)
+{
+    BufferPlacement b;
+    (void) unregisterBuffer(p, b);
+}
+
+const char* pageKindName(PageKind pages)
+{
+    switch (pages) {
+    case PAGES_TRANSPARENT_HUGE: return "transparent huge";
+    case PAGES_HUGETLB: return "hugetlb";
+    default: return "normal";
+    }
+}
+
+// Bytes on huge pages per mapping of /proc/self/smaps.
+struct Mapping {
+    uintptr_t begin;
+    uintptr_t end;
+    size_t hugeBytes;
+};
+
+static std::vector<Mapping> readSmaps()
+{
+    std::vector<Mapping> mappings;
+    std::ifstream in("/proc/self/smaps");
+    std::string line;
+    while (std::getline(in, line)) {
+        unsigned long begin;
+        unsigned long end;
+        char colon;
+        unsigned long kb;
+        char field[64];
+        if (sscanf(line.c_str(), "%lx-%lx %*s", &begin, &end) == 2 && line.find(" kB") == std::string::npos) {
+            Mapping m;
+            m.begin = begin;
+            m.end = end;
+            m.hugeBytes = 0;
+            mappings.push_back(m);
+        } else if (!mappings.empty() && sscanf(line.c_str(), "%63[A-Za-z_]%c %lu kB", field, &colon, &kb) == 3
+                   && colon == ':' && (std::strcmp(field, "AnonHugePages") == 0
+                                       || std::strcmp(field, "ShmemPmdMapped") == 0
+                                       || std::strcmp(field, "Private_Hugetlb") == 0
+                                       || std::strcmp(field, "Shared_Hugetlb") == 0)) {
+            mappings.back().hugeBytes += kb * 1024;
+        }
+    }
+    return mappings;
+}
+
+// Nodes of a sample of the pages of b.
+static std::string sampleNodes(const BufferPlacement& b)
+{
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t pageCount = b.bytes / page;
+    const size_t n = std::min(NODE_SAMPLES, std::max<size_t>(1, pageCount));
+    void* pages[NODE_SAMPLES];
+    int status[NODE_SAMPLES];
+    for (size_t i = 0; i < n; ++i) {
+        pages[i] = static_cast<char*>(b.address) + i * pageCount / n * page;
+    }
+    // Without target nodes move_pages only reports where the pages are.
+    if (syscall(SYS_move_pages, 0, n, pages, nullptr, status, 0) != 0) {
+        return "?";
+    }
+    std::map<int, size_t> counts;
+    for (size_t i = 0; i < n; ++i) {
+        counts[status[i] >= 0 ? status[i] : -1]++;
+    }
+    std::string nodes;
+    char text[32];
+    for (std::map<int, size_t>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+        if (counts.size() == 1 && it->first >= 0) {
+            snprintf(text, sizeof(text), "%d", it->first);
+        } else if (it->first >= 0) {
+            snprintf(text, sizeof(text), "%s%d:%zu%%", nodes.empty() ? "" : " ", it->first, 100 * it->second / n);
+        } else {
+            snprintf(text, sizeof(text), "%snot touched:%zu%%", nodes.empty() ? "" : " ", 100 * it->second / n);
+        }
+        nodes += text;
+    }
+    return nodes;
+}
+
+std::vector<BufferPlacement> placements()
+{
+    std::vector<BufferPlacement> buffers;
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        buffers = s_buffers;
+    }
+    const std::vector<Mapping> mappings = readSmaps();
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        BufferPlacement& b = buffers[i];
+        const uintptr_t begin = reinterpret_cast<uintptr_t>(b.address);
+        const uintptr_t end = begin + b.bytes;
+        // madvise() and mbind() may have split the buffer into several mappings.
+        for (size_t m = 0; m < mappings.size(); ++m) {
+            if (mappings[m].begin < end && mappings[m].end > begin) {
+                b.hugeBytes += mappings[m].hugeBytes;
+            }
+        }
+        b.hugeBytes = std::min(b.hugeBytes, b.bytes);
+        b.nodes = sampleNodes(b);
+    }
+    return buffers;
+}
@@ -0,0 +1,75 @@
+/******************************************************************************/
+/**
+ * \file    MemoryPlacement.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Large buffers of the data path (frame pools, the stream ring, the waveform export) on huge pages and on
+ * the NUMA node of the thread that uses them.
+ *
+ * allocateBuffer() maps anonymous memory. Buffers of at least half a huge page are rounded up to whole huge
+ * pages and first tried with MAP_HUGETLB, which needs pages reserved in /proc/sys/vm/nr_hugepages. Without
+ * them the buffer is aligned to a huge page and advised for transparent huge pages, which the kernel gives
+ * if THP is enabled ("always" or "madvise"); otherwise normal pages remain. The buffer is bound to a node
+ * (MPOL_PREFERRED, so memory from another node is used rather than failing) before it is touched, and
+ * then zeroed, so the pages are in place before the data path starts. placeBuffer() does the same for a
+ * mapping made elsewhere, such as a shared memory segment, and moves pages already there.
+ *
+ * The NUMA calls are made as system calls, so no libnuma is needed; on a kernel without NUMA or a single
+ * node machine they fail or do nothing and the buffers are used as they are. Every buffer is registered
+ * by name, and placements() tells where its pages actually are, for the report at startup.
+ **/
+
+#ifndef MEMORY_PLACEMENT_HPP
+#define MEMORY_PLACEMENT_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+enum PageKind {
+    PAGES_NORMAL,
+    PAGES_TRANSPARENT_HUGE,   // Advised, the kernel may still use normal pages.
+    PAGES_HUGETLB
+};
+
+struct BufferPlacement {
+    std::string name;
+    void* address;
+    size_t bytes;              // Mapped, rounded up to whole pages.
+    PageKind pages;
+    int node;                  // Node asked for, -1 if not bound.
+    bool owned;                // Mapped by allocateBuffer().
+    // Filled in by placements():
+    size_t hugeBytes;          // Backed by huge pages, from /proc/self/smaps.
+    std::string nodes;         // Nodes of a sample of the pages, e.g. "0" or "0:75% 1:25%".
+};
+
+// Node of the calling thread's current core, 0 if unknown.
+int currentNode();
+// Node of a core, -1 if unknown.
+int cpuNode(int cpu);
+// Nodes online, 1 on kernels without NUMA.
+int numaNodes();
+// Huge page size in bytes.
+size_t hugePageSize();
+
+// Zeroed buffer of at least bytes on node (-1 for the calling thread's node). Throws std::bad_alloc, like
+// new, if not even normal pages can be mapped.
+void* allocateBuffer(size_t bytes, const std::string& name, int node=-1);
+void freeBuffer(void* p);
+// Binds and advises an existing mapping, which stays owned by the caller. Call forgetBuffer() before
+// unmapping it.
+void placeBuffer(void* p, size_t bytes, const std::string& name, int node=-1);
+void forgetBuffer(void* p);
+
+// Registered buffers and where their pages are.
+std::vector<BufferPlacement> placements();
+const char* pageKindName(PageKind pages);
+
+#endif // MEMORY_PLACEMENT_HPP
@@ -0,0 +1,323 @@
+/**
+ * \file    ModbusMaster.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "ModbusMaster.hpp"
+#include "SerialPort.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <sys/timerfd.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Longest number of cycles a timed out slave is skipped.
+static const int MAX_BACKOFF_CYCLES = 64;
+
+ModbusMaster::ModbusMaster(const std::string& path, int baudRate, char parity) :
+    path_(path),
+    baudRate_(baudRate),
+    parity_(parity),
+    fd_(-1),
+    timerFd_(-1),
+    ownsFd_(false),
+    gapUs_(0),
+    charUs_(0),
+    responseTimeoutUs_(100000),
+    maxGap_(8),
+    state_(Stopped),
+    current_(0),
+    rxLen_(0),
+    expectedLen_(0)
+{
+    // 11 bits per character: start, 8 data, parity (or a second stop bit) and stop.
+    charUs_ = (11 * 1000000L + baudRate - 1) / baudRate;
+    // The specification fixes the gap at 1750 us above 19200 baud, below it is 3.5 characters.
+    gapUs_ = baudRate > 19200 ? 1750 : (7 * charUs_ + 1) / 2;
+}
+
+ModbusMaster::~ModbusMaster()
+{
+    if (timerFd_ >= 0) {
+        ::close(timerFd_);
+    }
+    if (ownsFd_ && fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+uint16_t ModbusMaster::crc(const uint8_t* data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; ++b) {
+            crc = (crc & 1) ? static_cast<uint16_t>((crc >> 1) ^ 0xA001) : static_cast<uint16_t>(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+bool ModbusMaster::start()
+{
+    TRACE();
+    const int fd = SerialPort::openRaw(path_, baudRate_, parity_);
+    if (fd < 0) {
+        TRACE_RETURN(false);
+    }
+    if (!start(fd)) {
+        ::close(fd);
+        TRACE_RETURN(false);
+    }
+    ownsFd_ = true;
+    TRACE_RETURN(true);
+}
+
+bool ModbusMaster::start(int fd)
+{
+    TRACE();
+    fd_ = fd;
+    timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd_ < 0) {
+        std::cerr << path_ << ": timerfd: " << strerror(errno) << std::endl;
+        TRACE_RETURN(false);
+    }
+    coalesce();
+    if (requests_.empty()) {
+        std::cerr << path_ << ": no Modbus polls configured" << std::endl;
+        TRACE_RETURN(false);
+    }
+    TRACE_PRINT("modbus", ("%s: %d polls in %d requests, gap %ld us", path_.c_str(), (int) polls_.size(),
+                           (int) requests_.size(), gapUs_));
+    current_ = requests_.size() - 1;
+    state_ = Gap;
+    sendNext();
+    TRACE_RETURN(true);
+}
+
+void ModbusMaster::coalesce()
+{
+    std::vector<size_t> order(polls_.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        const ModbusPoll& pa = polls_[a];
+        const ModbusPoll& pb = polls_[b];
+        if (pa.slave != pb.slave) return pa.slave < pb.slave;
+        if (pa.function != pb.function) return pa.function < pb.function;
+        return pa.start < pb.start;
+    });
+
+    requests_.clear();
+    for (size_t i = 0; i < order.size(); ++i) {
+        const ModbusPoll& p = polls_[order[i]];
+        if (p.count == 0 || p.count > MODBUS_MAX_READ_REGISTERS) {
+            std::cerr << path_ << ": slave " << (int) p.slave << " register " << p.start
+                      << ": count must be 1.." << MODBUS_MAX_READ_REGISTERS << std::endl;
+            continue;
+        }
+        if (!requests_.empty()) {
+            Request& r = requests_.back();
+            const unsigned end = static_cast<unsigned>(r.start) + r.count;
+            const unsigned newEnd = std::max(end, static_cast<unsigned>(p.start) + p.count);
+            if (r.slave == p.slave && r.function == p.function && p.start <= end + maxGap_
+                    && newEnd - r.start <= MODBUS_MAX_READ_REGISTERS) {
+                r.count = static_cast<uint16_t>(newEnd - r.start);
+                r.polls.push_back(order[i]);
+                continue;
+            }
+        }
+        Request r;
+        r.slave = p.slave;
+        r.function = p.function;
+        r.start = p.start;
+        r.count = p.count;
+        r.polls.push_back(order[i]);
+        r.skipCycles = 0;
+        r.backoff = 0;
+        requests_.push_back(r);
+    }
+
+    for (size_t i = 0; i < requests_.size(); ++i) {
+        encodeRequest(requests_[i]);
+    }
+}
+
+void ModbusMaster::encodeRequest(Request& r)
+{
+    r.adu[0] = r.slave;
+    r.adu[1] = r.function;
+    r.adu[2] = r.start >> 8;
+    r.adu[3] = r.start & 0xFF;
+    r.adu[4] = r.count >> 8;
+    r.adu[5] = r.count & 0xFF;
+    const uint16_t c = crc(r.adu, 6);
+    r.adu[6] = c & 0xFF;
+    r.adu[7] = c >> 8;
+}
+
+void ModbusMaster::split(size_t index)
+{
+    TRACE();
+    const Request merged = requests_[index];
+    std::vector<Request> parts;
+    for (size_t i = 0; i < merged.polls.size(); ++i) {
+        const ModbusPoll& p = polls_[merged.polls[i]];
+        Request r;
+        r.slave = p.slave;
+        r.function = p.function;
+        r.start = p.start;
+        r.count = p.count;
+        r.polls.push_back(merged.polls[i]);
+        r.skipCycles = 0;
+        r.backoff = 0;
+        encodeRequest(r);
+        parts.push_back(r);
+    }
+    requests_.erase(requests_.begin() + index);
+    requests_.insert(requests_.begin() + index, parts.begin(), parts.end());
+    TRACE_PRINT("modbus", ("%s: slave %d registers %d..%d answered with an exception, split into %d requests",
+                           path_.c_str(), merged.slave, merged.start, merged.start + merged.count - 1,
+                           (int) parts.size()));
+}
+
+void ModbusMaster::armTimer(long us)
+{
+    struct itimerspec its;
+    std::memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = us / 1000000;
+    its.it_value.tv_nsec = (us % 1000000) * 1000;
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+        its.it_value.tv_nsec = 1; // Zero would disarm the timer.
+    }
+    timerfd_settime(timerFd_, 0, &its, nullptr);
+}
+
+void ModbusMaster::sendNext()
+{
+    // Next request not in backoff, a full pass over the list completes a cycle.
+    Request* r = nullptr;
+    for (size_t n = 0; n < requests_.size() && r == nullptr; ++n) {
+        current_ = (current_ + 1) % requests_.size();
+        if (current_ == 0) {
+            stats_.cycles++;
+        }
+        Request& candidate = requests_[current_];
+        if (candidate.skipCycles > 0) {
+            candidate.skipCycles--;
+        } else {
+            r = &candidate;
+        }
+    }
+    if (r == nullptr) {
+        // Every slave is backing off, try again after a gap.
+        state_ = Gap;
+        armTimer(gapUs_);
+        return;
+    }
+
+    // Drop anything left from a late response.
+    tcflush(fd_, TCIFLUSH);
+    rxLen_ = 0;
+    expectedLen_ = 5 + 2 * static_cast<size_t>(r->count);
+    const ssize_t n = write(fd_, r->adu, sizeof(r->adu));
+    if (n != static_cast<ssize_t>(sizeof(r->adu))) {
+        std::cerr << path_ << ": write: " << strerror(errno) << std::endl;
+    }
+    stats_.requests++;
+    state_ = WaitResponse;
+    // The response cannot start before the request has left the UART.
+    armTimer(static_cast<long>(sizeof(r->adu)) * charUs_ + responseTimeoutUs_);
+}
+
+void ModbusMaster::onReadable()
+{
+    for (;;) {
+        uint8_t discard[64];
+        uint8_t* dst = state_ == WaitResponse && rxLen_ < sizeof(rx_) ? rx_ + rxLen_ : discard;
+        const size_t room = dst == discard ? sizeof(discard) : sizeof(rx_) - rxLen_;
+        const ssize_t n = read(fd_, dst, room);
+        if (n <= 0) {
+            break;
+        }
+        if (dst == discard) {
+            continue;
+        }
+        rxLen_ += static_cast<size_t>(n);
+        if (rxLen_ >= 2 && (rx_[1] & 0x80)) {
+            expectedLen_ = 5; // Exception response
+        }
+        if (rxLen_ >= expectedLen_) {
+            completeResponse();
+        }
+    }
+}
+
+void ModbusMaster::completeResponse()
+{
+    Request& r = requests_[current_];
+    const uint16_t rxCrc = rx_[expectedLen_ - 2] | (rx_[expectedLen_ - 1] << 8);
+    if (rx_[0] != r.slave || rxCrc != crc(rx_, expectedLen_ - 2)) {
+        stats_.crcErrors++;
+    } else if (rx_[1] & 0x80) {
+        stats_.exceptions++;
+        r.backoff = 0;
+        // A register of a gap or of one poll may be illegal, which fails every poll of the request. The
+        // polls are read one by one from now on, so only the poll with the illegal register keeps failing.
+        if (r.polls.size() > 1 || r.count != polls_[r.polls[0]].count) {
+            split(current_);
+        }
+    } else if (rx_[1] == r.function && rx_[2] == 2 * r.count) {
+        stats_.responses++;
+        r.backoff = 0;
+        values_.resize(r.count);
+        for (uint16_t i = 0; i < r.count; ++i) {
+            values_[i] = static_cast<uint16_t>((rx_[3 + 2 * i] << 8) | rx_[4 + 2 * i]);
+        }
+        if (handler_) {
+            for (size_t i = 0; i < r.polls.size(); ++i) {
+                const ModbusPoll& p = polls_[r.polls[i]];
+                handler_(r.polls[i], p, &values_[p.start - r.start]);
+            }
+        }
+    } else {
+        stats_.crcErrors++;
+    }
+    state_ = Gap;
+    armTimer(gapUs_);
+}
+
+void ModbusMaster::handleTimeout()
+{
+    TRACE();
+    Request& r = requests_[current_];
+    stats_.timeouts++;
+    r.backoff = r.backoff == 0 ? 1 : std::min(2 * r.backoff, MAX_BACKOFF_CYCLES);
+    r.skipCycles = r.backoff;
+    TRACE_PRINT("modbus", ("%s: slave %d timed out, skipping %d cycles", path_.c_str(), r.slave, r.skipCycles));
+    state_ = Gap;
+    armTimer(gapUs_);
+}
+
+void ModbusMaster::onTimer()
+{
+    uint64_t expirations;
+    if (read(timerFd_, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+    if (state_ == Gap) {
+        sendNext();
+    } else if (state_ == WaitResponse) {
+        handleTimeout();
+    }
+}
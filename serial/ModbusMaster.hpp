@@ -0,0 +1,136 @@
+/******************************************************************************/
+/**
+ * \file    ModbusMaster.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Modbus RTU master for one shared RS-485 bus. The configured polls (read holding/input registers) are
+ * coalesced per slave and function into as few requests as possible, and the requests are sent back to
+ * back: a response is recognized as complete from its expected length, and the next request goes out as
+ * soon as the 3.5 character inter-frame gap has passed. Slaves that time out are skipped for a number of
+ * cycles, so a dead slave does not cost a timeout every cycle. A coalesced request that gets an exception
+ * response, e.g. because a register in a gap does not exist, is split into its polls for good.
+ *
+ * The master is driven from an event loop: watch fd() and timerFd() for EPOLLIN and call onReadable()
+ * and onTimer(). Modbus buses are not part of a handover, the new driver opens them again.
+ **/
+
+#ifndef MODBUS_MASTER_HPP
+#define MODBUS_MASTER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+static const uint8_t MODBUS_READ_HOLDING_REGISTERS = 3;
+static const uint8_t MODBUS_READ_INPUT_REGISTERS = 4;
+static const uint16_t MODBUS_MAX_READ_REGISTERS = 125;
+static const size_t MODBUS_MAX_ADU = 256;
+
+struct ModbusPoll {
+    uint8_t slave;
+    uint8_t function;
+    uint16_t start;
+    uint16_t count;
+};
+
+struct ModbusStats {
+    explicit ModbusStats(){requests=0;responses=0;timeouts=0;crcErrors=0;exceptions=0;cycles=0;}
+    unsigned long requests;
+    unsigned long responses;
+    unsigned long timeouts;
+    unsigned long crcErrors;
+    unsigned long exceptions;
+    unsigned long cycles;   // Completed passes over all requests.
+};
+
+class ModbusMaster
+{
+public:
+    // Called once per configured poll with its index in polls() and the values of its registers.
+    typedef std::function<void(size_t index, const ModbusPoll& poll, const uint16_t* values)> RegisterHandler;
+
+    explicit ModbusMaster(const std::string& path, int baudRate, char parity='E');
+    ~ModbusMaster();
+
+    void addPoll(const ModbusPoll& poll) {polls_.push_back(poll);}
+    const std::vector<ModbusPoll>& polls() const {return polls_;}
+    void setHandler(const RegisterHandler& handler) {handler_ = handler;}
+    void setResponseTimeoutUs(long us) {responseTimeoutUs_ = us;}
+    // Registers a merge may read without anybody asking for them, to save a request.
+    void setMaxGap(uint16_t registers) {maxGap_ = registers;}
+
+    // Opens the port, coalesces the polls and sends the first request.
+    bool start();
+    // Uses an already opened fd instead of opening the path, e.g. a PTY in tests.
+    bool start(int fd);
+
+    int fd() const {return fd_;}
+    int timerFd() const {return timerFd_;}
+    void onReadable();
+    void onTimer();
+
+    const std::string& path() const {return path_;}
+    const ModbusStats& stats() const {return stats_;}
+    size_t requestCount() const {return requests_.size();}
+    long gapUs() const {return gapUs_;}
+
+    static uint16_t crc(const uint8_t* data, size_t len);
+
+private:
+    // One request on the bus, covering one or more polls.
+    struct Request {
+        uint8_t slave;
+        uint8_t function;
+        uint16_t start;
+        uint16_t count;
+        std::vector<size_t> polls; // Indexes into polls_.
+        uint8_t adu[8];
+        int skipCycles;            // Remaining cycles to skip after a timeout.
+        int backoff;
+    };
+
+    enum State {
+        Stopped,
+        Gap,         // Waiting for the inter-frame gap before the next request.
+        WaitResponse
+    };
+
+    void coalesce();
+    static void encodeRequest(Request& r);
+    // Replaces a coalesced request by one request per poll.
+    void split(size_t index);
+    void sendNext();
+    void armTimer(long us);
+    void completeResponse();
+    void handleTimeout();
+
+    std::string path_;
+    int baudRate_;
+    char parity_;
+    int fd_;
+    int timerFd_;
+    bool ownsFd_;
+    long gapUs_;
+    long charUs_;
+    long responseTimeoutUs_;
+    uint16_t maxGap_;
+    State state_;
+    std::vector<ModbusPoll> polls_;
+    std::vector<Request> requests_;
+    size_t current_;
+    uint8_t rx_[MODBUS_MAX_ADU];
+    size_t rxLen_;
+    size_t expectedLen_;
+    std::vector<uint16_t> values_;
+    RegisterHandler handler_;
+    ModbusStats stats_;
+};
+
+#endif // MODBUS_MASTER_HPP
@@ -0,0 +1,204 @@
+/**
+ * \file    Resampler.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "Resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// Kaiser window shape, about 70 dB stop band attenuation.
+static const double KAISER_BETA = 7.0;
+// Fraction of the lower Nyquist frequency where the pass band ends.
+static const double CUTOFF = 0.9;
+static const int MAX_PHASES = 256;
+// Input gaps or jumps larger than this restart the resampler.
+static const int64_t RESYNC_US = 100000;
+
+static int gcd(int a, int b)
+{
+    while (b != 0) {
+        const int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Modified Bessel function of the first kind, order 0.
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; ++k) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+PolyphaseResampler::PolyphaseResampler(int inRate, int outRate, int tapsPerPhase) :
+    inRate_(inRate),
+    outRate_(outRate),
+    up_(1),
+    down_(1),
+    taps_((std::max(tapsPerPhase, 4) + 3) & ~3),
+    pos_(0),
+    phase_(0)
+{
+    if (inRate <= 0 || outRate <= 0) {
+        return;
+    }
+    const int g = gcd(inRate, outRate);
+    up_ = outRate / g;
+    down_ = inRate / g;
+    if (up_ > MAX_PHASES) {
+        return;
+    }
+
+    // Prototype low pass at the upsampled rate, cut off below the lower of the two Nyquist frequencies.
+    const int n = up_ * taps_;
+    const double center = (n - 1) / 2.0;
+    const double fc = CUTOFF * 0.5 / std::max(up_, down_);
+    const double i0Beta = besselI0(KAISER_BETA);
+    std::vector<double> h(static_cast<size_t>(n));
+    for (int k = 0; k < n; ++k) {
+        const double t = k - center;
+        const double sinc = t == 0.0 ? 2 * fc : std::sin(2 * M_PI * fc * t) / (M_PI * t);
+        const double r = t / (center + 1);
+        h[static_cast<size_t>(k)] = sinc * besselI0(KAISER_BETA * std::sqrt(std::max(0.0, 1 - r * r))) / i0Beta;
+    }
+
+    // Phase p uses taps p, p + L, p + 2L, ... Each phase is normalized to unity gain at DC, which also
+    // takes care of the gain L of the upsampling.
+    bank_.assign(static_cast<size_t>(up_ * taps_), 0.0f);
+    for (int p = 0; p < up_; ++p) {
+        double sum = 0.0;
+        for (int j = 0; j < taps_; ++j) {
+            sum += h[static_cast<size_t>(p + up_ * j)];
+        }
+        for (int j = 0; j < taps_; ++j) {
+            // Reversed, so the dot product runs over the window from the oldest sample to the newest.
+            bank_[static_cast<size_t>(p * taps_ + taps_ - 1 - j)] = static_cast<float>(h[static_cast<size_t>(p + up_ * j)] / sum);
+        }
+    }
+    history_.assign(static_cast<size_t>(2 * taps_), 0.0f);
+}
+
+double PolyphaseResampler::delayUs() const
+{
+    return (up_ * taps_ - 1) / 2.0 / up_ / inRate_ * 1e6;
+}
+
+void PolyphaseResampler::reset()
+{
+    history_.assign(history_.size(), 0.0f);
+    pos_ = 0;
+    phase_ = 0;
+}
+
+float PolyphaseResampler::dot(const float* taps, const float* window) const
+{
+#ifdef __SSE__
+    __m128 a = _mm_setzero_ps();
+    __m128 b = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= taps_; i += 8) {
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(taps + i), _mm_loadu_ps(window + i)));
+        b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(taps + i + 4), _mm_loadu_ps(window + i + 4)));
+    }
+    if (i < taps_) {
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(taps + i), _mm_loadu_ps(window + i)));
+    }
+    a = _mm_add_ps(a, b);
+    a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    a = _mm_add_ss(a, _mm_shuffle_ps(a, a, 1));
+    return _mm_cvtss_f32(a);
+#else
+    float sum = 0.0f;
+    for (int i = 0; i < taps_; ++i) {
+        sum += taps[i] * window[i];
+    }
+    return sum;
+#endif
+}
+
+size_t PolyphaseResampler::process(const int16_t* in, size_t n, float* out)
+{
+    if (!valid()) {
+        return 0;
+    }
+    size_t count = 0;
+    float* h = history_.data();
+    for (size_t i = 0; i < n; ++i) {
+        // Every sample is stored twice, so the newest taps_ samples always start at h + pos_.
+        const float x = in[i];
+        h[pos_] = x;
+        h[pos_ + taps_] = x;
+        if (++pos_ == taps_) {
+            pos_ = 0;
+        }
+        while (phase_ < up_) {
+            out[count++] = dot(&bank_[static_cast<size_t>(phase_ * taps_)], h + pos_);
+            phase_ += down_;
+        }
+        phase_ -= up_;
+    }
+    return count;
+}
+
+ResampleStage::ResampleStage(int inRate, int outRate, size_t maxBlock) :
+    resampler_(inRate, outRate),
+    maxBlock_(maxBlock),
+    startUs_(-1),
+    inputs_(0),
+    outputs_(0),
+    outputTimeUs_(0)
+{
+    out_.resize(resampler_.maxOutput(maxBlock));
+    out16_.resize(out_.size());
+}
+
+size_t ResampleStage::process(const int16_t* in, size_t n, int64_t timestampUs)
+{
+    if (!valid()) {
+        return 0;
+    }
+    if (n > maxBlock_) {
+        in += n - maxBlock_;
+        n = maxBlock_;
+    }
+    const double inPeriodUs = 1e6 / resampler_.inRate();
+    const int64_t expectedUs = startUs_ + static_cast<int64_t>(inputs_ * inPeriodUs);
+    if (startUs_ < 0 || std::llabs(timestampUs - expectedUs) > RESYNC_US) {
+        // First frame, or samples were lost: start over from this frame.
+        resampler_.reset();
+        startUs_ = timestampUs;
+        inputs_ = 0;
+        outputs_ = 0;
+    }
+    // Output k is at input position k * M / L, minus the filter delay.
+    outputTimeUs_ = startUs_ + static_cast<int64_t>(static_cast<double>(outputs_) * resampler_.downFactor()
+                                                   / resampler_.upFactor() * inPeriodUs - resampler_.delayUs());
+    const size_t count = resampler_.process(in, n, out_.data());
+    for (size_t i = 0; i < count; ++i) {
+        const long v = lrintf(out_[i]);
+        out16_[i] = static_cast<int16_t>(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+    }
+    inputs_ += n;
+    outputs_ += count;
+    return count;
+}
@@ -0,0 +1,91 @@
+/******************************************************************************/
+/**
+ * \file    Resampler.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Streaming polyphase resampler from one sample rate to another, e.g. 125, 250, 300 or 500 Hz device
+ * waveforms to a common rate for consumers that want aligned channels.
+ *
+ * The ratio out/in is reduced to L/M. A Kaiser windowed sinc low pass, cut off at the lower of the two
+ * Nyquist frequencies, is split into L phases of tapsPerPhase taps when the resampler is constructed.
+ * Each output is then one dot product of a phase with the newest input samples (SSE), and nothing is
+ * allocated while processing: the history is a mirrored delay line, so the newest samples are always
+ * contiguous.
+ *
+ * ResampleStage wraps a resampler for one channel of the driver: it converts to int16 and gives each
+ * block of output the host time of its first sample, compensated for the filter delay.
+ **/
+
+#ifndef RESAMPLER_HPP
+#define RESAMPLER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class PolyphaseResampler
+{
+public:
+    explicit PolyphaseResampler(int inRate, int outRate, int tapsPerPhase=24);
+
+    // False if the rates are not positive or the reduced ratio needs more than 256 phases.
+    bool valid() const {return !bank_.empty();}
+    int upFactor() const {return up_;}
+    int downFactor() const {return down_;}
+    int inRate() const {return inRate_;}
+    int outRate() const {return outRate_;}
+    // Delay of the filter, in microseconds.
+    double delayUs() const;
+
+    // Largest number of outputs process() can give for n inputs.
+    size_t maxOutput(size_t n) const {return (n * up_ + down_ - 1) / down_ + 1;}
+    // Filters n inputs into out, which must hold maxOutput(n) samples. Returns the number of outputs.
+    size_t process(const int16_t* in, size_t n, float* out);
+    void reset();
+
+private:
+    float dot(const float* taps, const float* window) const;
+
+    int inRate_;
+    int outRate_;
+    int up_;
+    int down_;
+    int taps_;
+    std::vector<float> bank_;     // up_ phases of taps_ coefficients, reversed for the dot product.
+    std::vector<float> history_;  // Mirrored delay line of 2 * taps_ samples.
+    int pos_;
+    int phase_;
+};
+
+class ResampleStage
+{
+public:
+    // Frames carry at most maxBlock samples.
+    explicit ResampleStage(int inRate, int outRate, size_t maxBlock=128);
+
+    bool valid() const {return resampler_.valid();}
+    const PolyphaseResampler& resampler() const {return resampler_;}
+
+    // Resamples one frame of samples. Returns the number of outputs, see output() and outputTimeUs().
+    size_t process(const int16_t* in, size_t n, int64_t timestampUs);
+    const int16_t* output() const {return out16_.data();}
+    int64_t outputTimeUs() const {return outputTimeUs_;}
+
+private:
+    PolyphaseResampler resampler_;
+    std::vector<float> out_;
+    std::vector<int16_t> out16_;
+    size_t maxBlock_;
+    int64_t startUs_;      // Host time of the first input sample, -1 before the first frame.
+    uint64_t inputs_;
+    uint64_t outputs_;
+    int64_t outputTimeUs_;
+};
+
+#endif // RESAMPLER_HPP
@@ -0,0 +1,707 @@
+/**
+ * \file    SerialDriver.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "SerialDriver.hpp"
+#include "DriverSnapshot.hpp"
+#include "Handover.hpp"
+#include "MemoryPlacement.hpp"
+#include "Trace.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// epoll user data for the fds that are not ports.
+static const uint64_t SIGNAL_ID = ~0ull;
+static const uint64_t TIMER_ID = ~0ull - 1;
+
+// Registers delivered per Modbus bus, the channel of a frame is one byte.
+static const int MODBUS_CHANNELS = 256;
+
+SerialDriver::SerialDriver() :
+    epollFd_(-1),
+    signalFd_(-1),
+    timerFd_(-1),
+    handoverFd_(-1),
+    running_(false),
+    handedOver_(false),
+    snapshotIntervalSec_(0),
+    busyPollCpu_(-1),
+    busyPollIdleUs_(1000),
+    modbusPortBase_(0),
+    waveformChannels_(0),
+    waveformRingSamples_(0),
+    spectrumIntervalUs_(1000000),
+    spectrumSeq_(0)
+{
+    for (int i = 0; i < FRAME_CLASS_COUNT; ++i) {
+        frameCounts_[i] = 0;
+    }
+}
+
+SerialDriver::~SerialDriver()
+{
+    stopThreads();
+    if (handoverFd_ >= 0) {
+        ::close(handoverFd_);
+    }
+    if (timerFd_ >= 0) {
+        ::close(timerFd_);
+    }
+    if (signalFd_ >= 0) {
+        ::close(signalFd_);
+    }
+    if (epollFd_ >= 0) {
+        ::close(epollFd_);
+    }
+}
+
+int64_t SerialDriver::nowUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void SerialDriver::setWaveformExport(const std::string& name, uint32_t maxChannels, uint32_t ringSamples)
+{
+    waveformName_ = name;
+    waveformChannels_ = maxChannels;
+    waveformRingSamples_ = ringSamples;
+}
+
+void SerialDriver::setStreamServer(const std::string& endpoint, SlowClientPolicy policy, size_t maxBacklog)
+{
+    streamEndpoint_ = endpoint;
+    stream_.setPolicy(policy);
+    stream_.setMaxBacklog(maxBacklog);
+}
+
+bool SerialDriver::addResampler(int port, int channel, int inRate, int outRate)
+{
+    TRACE();
+    std::unique_ptr<ResampleStage> stage(new ResampleStage(inRate, outRate, FRAME_MAX_PAYLOAD / sizeof(int16_t)));
+    if (!stage->valid()) {
+        std::cerr << "Cannot resample " << inRate << " Hz to " << outRate << " Hz" << std::endl;
+        TRACE_RETURN(false);
+    }
+    TRACE_PRINT("resample", ("port %d channel %d: %d -> %d Hz, L/M %d/%d, delay %.0f us", port, channel, inRate,
+                             outRate, stage->resampler().upFactor(), stage->resampler().downFactor(),
+                             stage->resampler().delayUs()));
+    resamplers_[static_cast<uint32_t>(port << 8 | channel)] = std::move(stage);
+    TRACE_RETURN(true);
+}
+
+bool SerialDriver::addBeatDetector(int port, int channel, double sampleRate)
+{
+    TRACE();
+    if (sampleRate < 100.0) {
+        std::cerr << "Beat detection needs at least 100 Hz, not " << sampleRate << std::endl;
+        TRACE_RETURN(false);
+    }
+    beatDetectors_[static_cast<uint32_t>(port << 8 | channel)].reset(new BeatDetector(sampleRate));
+    TRACE_RETURN(true);
+}
+
+void SerialDriver::setSnapshotFile(const std::string& path, int intervalSec)
+{
+    TRACE();
+    snapshotFile_ = path;
+    snapshotIntervalSec_ = intervalSec;
+    restoredStates_.clear();
+    if (readSnapshotFile(path, restoredStates_)) {
+        TRACE_PRINT("snapshot", ("Read %d device states from %s", (int) restoredStates_.size(), path.c_str()));
+    }
+}
+
+SerialPort* SerialDriver::findPort(const std::string& path)
+{
+    for (size_t i = 0; i < ports_.size(); ++i) {
+        if (ports_[i]->path() == path) {
+            return ports_[i].get();
+        }
+    }
+    return nullptr;
+}
+
+bool SerialDriver::addPort(const std::string& path, int baudRate, bool busyPoll)
+{
+    TRACE();
+    SerialPort* existing = findPort(path);
+    if (existing != nullptr) {
+        busyPoll_[existing->index()] = busyPoll;
+        TRACE_RETURN(true);
+    }
+    std::unique_ptr<SerialPort> port(new SerialPort(static_cast<int>(ports_.size()), path, baudRate));
+    for (size_t i = 0; i < restoredStates_.size(); ++i) {
+        const DeviceState& s = restoredStates_[i];
+        if (s.port == path) {
+            DeviceState& state = port->state();
+            // A configured baud rate overrides the snapshot, only a detected one is restored.
+            if (baudRate == 0) {
+                state.baudRate = s.baudRate;
+            }
+            state.seqValid = s.seqValid;
+            state.lastSeq = s.lastSeq;
+            state.lostFrames = s.lostFrames;
+            state.timestamps = s.timestamps;
+            TRACE_PRINT("snapshot", ("%s restored, %d baud, seq %u", path.c_str(), state.baudRate, (unsigned) state.lastSeq));
+        }
+    }
+    if (!port->open()) {
+        TRACE_RETURN(false);
+    }
+    ports_.push_back(std::move(port));
+    busyPoll_.push_back(busyPoll);
+    pools_.push_back(newFramePool(ports_.size() - 1, busyPoll));
+    TRACE_RETURN(true);
+}
+
+std::unique_ptr<FramePool> SerialDriver::newFramePool(size_t port, bool busyPoll) const
+{
+    // On the node of the thread reading the port: the pinned busy poll thread, or this one, which runs the loop.
+    const int node = busyPoll && busyPollCpu_ >= 0 ? cpuNode(busyPollCpu_) : -1;
+    char name[32];
+    snprintf(name, sizeof(name), "frame pool port %d", static_cast<int>(port));
+    // Enough for a port that fills the queue on its own, and the frame being delivered.
+    return std::unique_ptr<FramePool>(new FramePool(queue_.capacity() + 1, name, node));
+}
+
+void SerialDriver::addModbusBus(std::unique_ptr<ModbusMaster> bus)
+{
+    const size_t index = modbus_.size();
+    bus->setHandler([this, index](size_t poll, const ModbusPoll& p, const uint16_t* values) {
+        dispatchRegisters(index, poll, p, values);
+    });
+    modbus_.push_back(std::move(bus));
+}
+
+bool SerialDriver::takeOver(const std::string& path)
+{
+    TRACE();
+    const int sock = connectHandover(path);
+    if (sock < 0) {
+        TRACE_RETURN(false);
+    }
+    std::vector<HandoverPort> handed;
+    const bool ok = receiveHandover(sock, handed);
+    ::close(sock);
+    if (!ok) {
+        TRACE_RETURN(false);
+    }
+
+    const FrameDecoder::FrameHandler handler = [this](const Frame& f) { dispatch(f); };
+    const int64_t now = nowUs();
+    for (size_t i = 0; i < handed.size(); ++i) {
+        HandoverPort& hp = handed[i];
+        std::unique_ptr<SerialPort> port(new SerialPort(static_cast<int>(ports_.size()), hp.path, hp.configuredBaudRate));
+        port->state() = hp.state;
+        port->adopt(hp.fd);
+        pools_.push_back(newFramePool(ports_.size(), false));
+        // Bytes the previous driver had read but not decoded come first.
+        if (!hp.pending.empty()) {
+            port->decoder().feed(hp.pending.data(), hp.pending.size(), now, handler);
+        }
+        TRACE_PRINT("handover", ("%s taken over, %d pending bytes", hp.path.c_str(), (int) hp.pending.size()));
+        ports_.push_back(std::move(port));
+        busyPoll_.push_back(false);
+    }
+    TRACE_RETURN(true);
+}
+
+void SerialDriver::handleHandover()
+{
+    TRACE();
+    const int conn = accept4(handoverFd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn < 0) {
+        TRACE_VOID_RETURN;
+    }
+    // Nothing may read the ports while their state is sent.
+    if (poller_) {
+        poller_->stop();
+    }
+    std::vector<HandoverPort> handed;
+    for (size_t i = 0; i < ports_.size(); ++i) {
+        SerialPort& port = *ports_[i];
+        if (port.fd() < 0) {
+            continue;
+        }
+        HandoverPort hp;
+        hp.path = port.path();
+        hp.configuredBaudRate = port.configuredBaudRate();
+        hp.pending.assign(port.decoder().pending(), port.decoder().pending() + port.decoder().pendingSize());
+        hp.state = port.stateSnapshot();
+        hp.fd = port.fd();
+        handed.push_back(hp);
+    }
+    if (sendHandover(conn, handed)) {
+        // The new driver owns the ports and the snapshot from now on.
+        handedOver_ = true;
+        running_ = false;
+    } else if (poller_) {
+        poller_->start();
+    }
+    ::close(conn);
+    TRACE_VOID_RETURN;
+}
+
+bool SerialDriver::watch(int fd, uint32_t events)
+{
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        std::cerr << "epoll_ctl: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool SerialDriver::setupLoop()
+{
+    TRACE();
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+        std::cerr << "epoll_create1: " << strerror(errno) << std::endl;
+        TRACE_RETURN(false);
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    signalFd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd_ < 0 || !watch(signalFd_, EPOLLIN)) {
+        std::cerr << "signalfd: " << strerror(errno) << std::endl;
+        TRACE_RETURN(false);
+    }
+
+    if (!snapshotFile_.empty() && snapshotIntervalSec_ > 0) {
+        timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct itimerspec its;
+        std::memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = snapshotIntervalSec_;
+        its.it_interval.tv_sec = snapshotIntervalSec_;
+        if (timerFd_ < 0 || timerfd_settime(timerFd_, 0, &its, nullptr) != 0 || !watch(timerFd_, EPOLLIN)) {
+            std::cerr << "timerfd: " << strerror(errno) << std::endl;
+            TRACE_RETURN(false);
+        }
+    }
+
+    if (!handoverPath_.empty()) {
+        handoverFd_ = listenHandover(handoverPath_);
+        if (handoverFd_ < 0 || !watch(handoverFd_, EPOLLIN)) {
+            TRACE_RETURN(false);
+        }
+    }
+
+    for (size_t i = 0; i < ports_.size(); ++i) {
+        if (busyPoll_[i]) {
+            if (!poller_) {
+                poller_.reset(new BusyPoller(busyPollCpu_, busyPollIdleUs_, [this](const Frame& f) { dispatch(f); }));
+            }
+            poller_->addPort(ports_[i].get());
+        } else if (!watch(ports_[i]->fd(), EPOLLIN)) {
+            TRACE_RETURN(false);
+        }
+    }
+    if (poller_ && !poller_->start()) {
+        TRACE_RETURN(false);
+    }
+    // Modbus buses are numbered after the serial ports, and their registers as channels in the order they are
+    // polled. Their frames come from a pool of their own, taken from this thread.
+    modbusPortBase_ = static_cast<int>(ports_.size());
+    modbusChannels_.assign(modbus_.size(), std::vector<int>());
+    for (size_t i = 0; i < modbus_.size(); ++i) {
+        const std::vector<ModbusPoll>& polls = modbus_[i]->polls();
+        int channel = 0;
+        for (size_t p = 0; p < polls.size(); ++p) {
+            modbusChannels_[i].push_back(channel);
+            channel += polls[p].count;
+        }
+        if (channel > MODBUS_CHANNELS) {
+            std::cerr << modbus_[i]->path() << ": only the first " << MODBUS_CHANNELS << " of " << channel
+                      << " registers are delivered" << std::endl;
+        }
+        pools_.push_back(newFramePool(ports_.size() + i, false));
+    }
+    if (!latestValueName_.empty()
+        && !latestValues_.create(latestValueName_, static_cast<int>(ports_.size() + modbus_.size()))) {
+        TRACE_RETURN(false);
+    }
+    if (!waveformName_.empty() && !waveforms_.create(waveformName_, waveformChannels_, waveformRingSamples_)) {
+        TRACE_RETURN(false);
+    }
+    if (!streamEndpoint_.empty() && !stream_.start(streamEndpoint_, epollFd_)) {
+        TRACE_RETURN(false);
+    }
+    for (size_t i = 0; i < modbus_.size(); ++i) {
+        ModbusMaster& bus = *modbus_[i];
+        if (!bus.start() || !watch(bus.fd(), EPOLLIN) || !watch(bus.timerFd(), EPOLLIN)) {
+            TRACE_RETURN(false);
+        }
+    }
+    if (!spectrum_.empty() && !spectrum_.start()) {
+        TRACE_RETURN(false);
+    }
+    // Last, nothing can fail once the dispatcher runs.
+    dispatcher_ = std::thread(&SerialDriver::dispatchLoop, this);
+    reportMemory();
+    TRACE_RETURN(true);
+}
+
+void SerialDriver::stopThreads()
+{
+    if (poller_) {
+        poller_->stop();
+    }
+    // The dispatcher delivers the frames still queued before it exits.
+    queue_.close();
+    if (dispatcher_.joinable()) {
+        dispatcher_.join();
+    }
+    spectrum_.stop();
+}
+
+bool SerialDriver::run()
+{
+    TRACE();
+    if (!setupLoop()) {
+        stopThreads();
+        TRACE_RETURN(false);
+    }
+    const FrameDecoder::FrameHandler handler = [this](const Frame& f) { dispatch(f); };
+
+    running_ = true;
+    struct epoll_event events[32];
+    while (running_) {
+        const int n = epoll_wait(epollFd_, events, 32, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "epoll_wait: " << strerror(errno) << std::endl;
+            break;
+        }
+        const int64_t now = nowUs();
+        for (int i = 0; i < n && running_; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == signalFd_) {
+                handleSignal();
+            } else if (fd == timerFd_) {
+                handleTimer();
+            } else if (fd == handoverFd_) {
+                handleHandover();
+            } else if (handleModbus(fd) || stream_.handle(fd, events[i].events)) {
+                continue;
+            } else {
+                for (size_t p = 0; p < ports_.size(); ++p) {
+                    SerialPort& port = *ports_[p];
+                    if (port.fd() != fd) {
+                        continue;
+                    }
+                    const bool hangup = (events[i].events & (EPOLLHUP | EPOLLERR)) != 0;
+                    if (port.readAvailable(now, handler) < 0 || hangup) {
+                        // Hangup or error, stop watching. The state is kept for the snapshot.
+                        epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+                        port.close();
+                    }
+                }
+            }
+        }
+    }
+    // Frames already decoded are delivered before exit, also after a handover.
+    stopThreads();
+    printQueueStats();
+    // After a handover the socket path belongs to the new driver.
+    stream_.stop(!handedOver_);
+    if (handedOver_) {
+        TRACE_RETURN(true);
+    }
+    if (handoverFd_ >= 0) {
+        (void) unlink(handoverPath_.c_str());
+    }
+    if (!snapshotFile_.empty()) {
+        saveSnapshot();
+    }
+    TRACE_RETURN(true);
+}
+
+bool SerialDriver::handleModbus(int fd)
+{
+    for (size_t i = 0; i < modbus_.size(); ++i) {
+        ModbusMaster& bus = *modbus_[i];
+        if (fd == bus.fd()) {
+            bus.onReadable();
+            return true;
+        }
+        if (fd == bus.timerFd()) {
+            bus.onTimer();
+            return true;
+        }
+    }
+    return false;
+}
+
+void SerialDriver::handleSignal()
+{
+    TRACE();
+    struct signalfd_siginfo si;
+    while (read(signalFd_, &si, sizeof(si)) == sizeof(si)) {
+        TRACE_PRINT("signal", ("Signal %u, stopping", si.ssi_signo));
+        running_ = false;
+    }
+}
+
+void SerialDriver::handleTimer()
+{
+    uint64_t expirations;
+    if (read(timerFd_, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        saveSnapshot();
+    }
+}
+
+bool SerialDriver::saveSnapshot()
+{
+    std::vector<DeviceState> states;
+    states.reserve(ports_.size());
+    for (size_t i = 0; i < ports_.size(); ++i) {
+        states.push_back(ports_[i]->stateSnapshot());
+    }
+    return writeSnapshotFile(snapshotFile_, states);
+}
+
+void SerialDriver::dispatch(const Frame& f)
+{
+    Frame* pooled = pools_[f.port]->get();
+    std::memcpy(pooled, &f, offsetof(Frame, payload) + f.length);
+    queue_.push(pooled);
+}
+
+void SerialDriver::dispatchLoop()
+{
+    Frame* f;
+    int64_t nextTick = nowUs() + 1000000;
+    int64_t nextSpectrum = nowUs() + spectrumIntervalUs_;
+    for (;;) {
+        if (queue_.pop(f, 1000)) {
+            deliver(*f);
+            FramePool::put(f);
+        } else if (queue_.closed() && queue_.depth() == 0) {
+            break;
+        }
+        // Close trend buckets of channels that went silent.
+        const int64_t now = nowUs();
+        if (now >= nextTick) {
+            trends_.tick(now);
+            nextTick = now + 1000000;
+        }
+        if (spectrum_.running() && now >= nextSpectrum) {
+            publishSpectra();
+            nextSpectrum = now + spectrumIntervalUs_;
+        }
+    }
+}
+
+void SerialDriver::deliver(const Frame& f)
+{
+    if (f.frameClass < FRAME_CLASS_COUNT) {
+        frameCounts_[f.frameClass]++;
+    }
+    if (f.frameClass == FRAME_PARAMETER && f.length >= sizeof(float)) {
+        float value;
+        std::memcpy(&value, f.payload, sizeof(value));
+        if (latestValues_.valid()) {
+            latestValues_.update(f.port, f.channel, value, f.timestampUs, f.seq);
+        }
+        trends_.add(f.port, f.channel, value, f.timestampUs);
+    }
+    if (stream_.running()) {
+        stream_.publish(f);
+    }
+    if (f.frameClass == FRAME_WAVEFORM && (waveforms_.valid() || !spectrum_.empty() || !beatDetectors_.empty())) {
+        int16_t samples[FRAME_MAX_PAYLOAD / sizeof(int16_t)];
+        const size_t count = f.length / sizeof(int16_t);
+        std::memcpy(samples, f.payload, count * sizeof(int16_t));
+        spectrum_.push(f.port, f.channel, samples, count, f.timestampUs);
+        if (!beatDetectors_.empty()) {
+            detectBeats(f, samples, count);
+        }
+        if (!waveforms_.valid()) {
+            return;
+        }
+        const uint32_t key = static_cast<uint32_t>(f.port << 8 | f.channel);
+        SignalQualityEstimator& sq = quality_[key];
+        const uint8_t before = sq.flags();
+        const uint8_t quality = sq.process(samples, count);
+        if (quality != before) {
+            qualityChanged(f.port, f.channel, quality, sq.noiseRatio());
+        }
+        waveforms_.write(f.port, f.channel, samples, count, f.timestampUs, quality);
+        const std::unordered_map<uint32_t, std::unique_ptr<ResampleStage> >::iterator it = resamplers_.find(key);
+        if (it != resamplers_.end()) {
+            ResampleStage& stage = *it->second;
+            const size_t n = stage.process(samples, count, f.timestampUs);
+            if (n > 0) {
+                waveforms_.write(RESAMPLED_PORT_BASE + f.port, f.channel, stage.output(), n, stage.outputTimeUs(),
+                                 quality);
+            }
+        }
+    }
+}
+
+void SerialDriver::detectBeats(const Frame& f, const int16_t* samples, size_t count)
+{
+    const std::unordered_map<uint32_t, std::unique_ptr<BeatDetector> >::iterator it =
+        beatDetectors_.find(static_cast<uint32_t>(f.port << 8 | f.channel));
+    if (it == beatDetectors_.end()) {
+        return;
+    }
+    beats_.clear();
+    if (it->second->process(samples, count, f.timestampUs, beats_) == 0) {
+        return;
+    }
+    TRACE();
+    for (size_t i = 0; i < beats_.size(); ++i) {
+        const Beat& b = beats_[i];
+        TRACE_PRINT("beat", ("port %d channel %d: RR %.0f ms, %.0f bpm%s", f.port, f.channel, b.rrMs, b.heartRate,
+                             b.searchBack ? " (search back)" : ""));
+        if (b.heartRate <= 0.0f) {
+            continue;
+        }
+        trends_.add(BEAT_PORT_BASE + f.port, f.channel, b.heartRate, b.timestampUs);
+        if (stream_.running()) {
+            Frame hr;
+            hr.port = BEAT_PORT_BASE + f.port;
+            hr.frameClass = FRAME_PARAMETER;
+            hr.channel = f.channel;
+            hr.seq = static_cast<uint16_t>(b.sample);
+            hr.deviceTime = 0;
+            hr.timestampUs = b.timestampUs;
+            hr.length = sizeof(float);
+            std::memcpy(hr.payload, &b.heartRate, sizeof(float));
+            stream_.publish(hr);
+        }
+    }
+    TRACE_VOID_RETURN;
+}
+
+void SerialDriver::publishSpectra()
+{
+    TRACE();
+    spectra_.clear();
+    spectrum_.collect(spectra_);
+    const std::vector<SpectrumBand>& bands = spectrum_.bands();
+    for (size_t i = 0; i < spectra_.size(); ++i) {
+        const SpectrumResult& r = spectra_[i];
+        Frame f;
+        f.port = SPECTRUM_PORT_BASE + r.port;
+        f.frameClass = FRAME_DIAGNOSTIC;
+        f.channel = static_cast<uint8_t>(r.channel);
+        f.seq = spectrumSeq_++;
+        f.deviceTime = 0;
+        f.timestampUs = r.timestampUs;
+        f.length = static_cast<uint8_t>(r.bandPower.size() * sizeof(float));
+        std::memcpy(f.payload, r.bandPower.data(), f.length);
+        if (stream_.running()) {
+            stream_.publish(f);
+        }
+        char text[256];
+        int len = 0;
+        for (size_t b = 0; b < bands.size() && len < static_cast<int>(sizeof(text)); ++b) {
+            len += snprintf(text + len, sizeof(text) - len, " %s %.3g", bands[b].name.c_str(), r.bandPower[b]);
+        }
+        TRACE_PRINT("spectrum", ("port %d channel %d:%s", r.port, r.channel, text));
+    }
+}
+
+void SerialDriver::printQueueStats()
+{
+    TRACE();
+    for (int c = 0; c < FRAME_CLASS_COUNT; ++c) {
+        const FrameClassStats s = queue_.stats(c);
+        TRACE_PRINT("queue", ("%-10s enqueued %lu delivered %lu shed %lu dropped %lu max depth %lu",
+                              frameClassName(c), s.enqueued, s.delivered, s.shed, s.dropped, s.maxDepth));
+    }
+    for (size_t i = 0; i < pools_.size(); ++i) {
+        const FramePoolStats s = pools_[i]->stats();
+        TRACE_PRINT("queue", ("port %d frame pool %lu, %lu from the heap, %lu refills", (int) i, s.capacity, s.heap,
+                              s.refills));
+    }
+    if (!spectrum_.empty()) {
+        const SpectrumStats s = spectrum_.stats();
+        TRACE_PRINT("spectrum", ("%lu windows analyzed, %lu skipped", s.windows, s.skipped));
+    }
+    if (stream_.running()) {
+        const StreamStats s = stream_.stats();
+        TRACE_PRINT("stream", ("%lu clients, published %lu sent %lu dropped %lu disconnected %lu", s.clients,
+                               s.published, s.sent, s.dropped, s.disconnected));
+    }
+}
+
+void SerialDriver::reportMemory()
+{
+    TRACE();
+    TRACE_PRINT("memory", ("%d NUMA nodes, huge pages of %zu kB, loop on node %d", numaNodes(), hugePageSize() / 1024,
+                           currentNode()));
+    const std::vector<BufferPlacement> buffers = placements();
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        const BufferPlacement& b = buffers[i];
+        char bound[32] = "not bound";
+        if (b.node >= 0) {
+            snprintf(bound, sizeof(bound), "bound to node %d", b.node);
+        }
+        TRACE_PRINT("memory", ("%s: %zu kB, %s pages (%zu kB huge), %s, pages on node %s", b.name.c_str(),
+                               b.bytes / 1024, pageKindName(b.pages), b.hugeBytes / 1024, bound, b.nodes.c_str()));
+    }
+    TRACE_VOID_RETURN;
+}
+
+void SerialDriver::qualityChanged(int port, int channel, uint8_t flags, float noiseRatio)
+{
+    TRACE();
+    TRACE_PRINT("quality", ("port %d channel %d:%s%s%s%s%s (noise ratio %.2f)", port, channel,
+                            flags == 0 ? " good" : "", flags & SQ_FLATLINE ? " flatline" : "",
+                            flags & SQ_SATURATED ? " saturated" : "", flags & SQ_NOISY ? " noisy" : "",
+                            flags & SQ_LEAD_OFF ? " lead-off" : "", noiseRatio));
+}
+
+void SerialDriver::dispatchRegisters(size_t bus, size_t poll, const ModbusPoll& p, const uint16_t* values)
+{
+    TRACE();
+    const int first = modbusChannels_[bus][poll];
+    Frame f;
+    f.port = modbusPortBase_ + static_cast<int>(bus);
+    f.frameClass = FRAME_PARAMETER;
+    f.seq = static_cast<uint16_t>(modbus_[bus]->stats().cycles);
+    f.deviceTime = 0;
+    f.timestampUs = nowUs();
+    f.length = sizeof(float);
+    for (int i = 0; i < p.count && first + i < MODBUS_CHANNELS; ++i) {
+        const float value = values[i];
+        f.channel = static_cast<uint8_t>(first + i);
+        std::memcpy(f.payload, &value, sizeof(value));
+        dispatch(f);
+    }
+    TRACE_PRINT("modbus", ("%s slave %d fc %d reg %d = %d (%d registers) to port %d channel %d",
+                           modbus_[bus]->path().c_str(), p.slave, p.function, p.start, values[0], p.count, f.port,
+                           first));
+    TRACE_VOID_RETURN;
+}
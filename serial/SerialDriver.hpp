@@ -0,0 +1,191 @@
+/******************************************************************************/
+/**
+ * \file    SerialDriver.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * SerialDriver runs the epoll loop that reads all ports, decodes frames and dispatches them.
+ * SIGTERM and SIGINT are handled through a signalfd in the same loop. When a snapshot file is set, the
+ * device states are restored from it in addPort(), and written every snapshot interval and at shutdown.
+ *
+ * With a handover socket set, a newly started driver can take over the open ports (see Handover.hpp):
+ * the new driver calls takeOver() before addPort(), and this driver exits once the ports are sent.
+ *
+ * Ports added with busyPoll are read by a BusyPoller thread instead of the epoll loop.
+ * Modbus RTU buses (ModbusMaster) are driven by the epoll loop as well. Polled registers are delivered as
+ * parameter frames like those of a device: the buses are numbered as ports after the serial ports, and the
+ * registers of a bus as channels in the order they are polled, the first 256 of them. The value is the raw
+ * unsigned register value.
+ *
+ * Decoded frames are queued by class in a FrameQueue and delivered by priority from a dispatcher thread,
+ * so alarms never wait behind waveform data and low priority data is shed first under overload. Queued
+ * frames come from a FramePool per port, taken by the thread reading the port and returned by the dispatcher.
+ * Pools, the stream ring and the waveform export are placed on huge pages and on the node of the thread
+ * using them where possible (MemoryPlacement), and where they ended up is reported at startup.
+ * Parameter values are also kept in a LatestValueTable and waveforms exported to shared memory
+ * (WaveformExport) when these are set, and streamed to local clients by a StreamServer in the epoll loop.
+ * Parameter values are rolled up into 1s/1m/1h trends (TrendRollup). Waveform channels with a resampler
+ * are also exported at the target rate, as port RESAMPLED_PORT_BASE + port. Exported waveform samples carry
+ * the signal quality flags of their channel (SignalQuality). Band powers of channels with a spectrum
+ * (SpectrumAnalyzer) are published at an interval as diagnostic frames, port SPECTRUM_PORT_BASE + port.
+ * ECG channels with a BeatDetector give a heart rate parameter per beat, port BEAT_PORT_BASE + port, which
+ * is streamed and trended like a device parameter.
+ **/
+
+#ifndef SERIAL_DRIVER_HPP
+#define SERIAL_DRIVER_HPP
+
+#include "SerialPort.hpp"
+#include "BusyPoller.hpp"
+#include "BeatDetector.hpp"
+#include "Frame.hpp"
+#include "FramePool.hpp"
+#include "FrameQueue.hpp"
+#include "LatestValueTable.hpp"
+#include "StreamServer.hpp"
+#include "Resampler.hpp"
+#include "SignalQuality.hpp"
+#include "SpectrumAnalyzer.hpp"
+#include "TrendRollup.hpp"
+#include "WaveformExport.hpp"
+#include "ModbusMaster.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Port number of resampled channels in the waveform export.
+static const int RESAMPLED_PORT_BASE = 1000;
+// Port number of the band power frames of a waveform channel.
+static const int SPECTRUM_PORT_BASE = 2000;
+// Port number of the heart rate parameters of an ECG channel.
+static const int BEAT_PORT_BASE = 3000;
+
+class SerialDriver
+{
+public:
+    explicit SerialDriver();
+    ~SerialDriver();
+
+    // Must be called before addPort() for the ports to be restored.
+    void setSnapshotFile(const std::string& path, int intervalSec);
+    // Ports already taken over are not opened again.
+    bool addPort(const std::string& path, int baudRate, bool busyPoll=false);
+    // Core for the busy poll thread (-1 for any) and idle time before it falls back to epoll.
+    void setBusyPoll(int cpu, long idleUs) {busyPollCpu_ = cpu; busyPollIdleUs_ = idleUs;}
+
+    // Scheduling and shedding of decoded frames, configure before run().
+    FrameQueue& queue() {return queue_;}
+
+    // Publishes the latest parameter values in shared memory, sized for the ports and Modbus buses added before run().
+    void setLatestValueTable(const std::string& name) {latestValueName_ = name;}
+    const LatestValueTable& latestValues() const {return latestValues_;}
+    // Exports waveform samples in shared memory, see WaveformExport.hpp.
+    void setWaveformExport(const std::string& name, uint32_t maxChannels, uint32_t ringSamples);
+
+    // Streams frames to clients on a UNIX socket path or host:port.
+    void setStreamServer(const std::string& endpoint, SlowClientPolicy policy, size_t maxBacklog);
+    StreamStats streamStats() const {return stream_.stats();}
+
+    // Resamples a waveform channel from inRate to outRate into the waveform export.
+    bool addResampler(int port, int channel, int inRate, int outRate);
+
+    // Detects beats on an ECG waveform channel sampled at sampleRate.
+    bool addBeatDetector(int port, int channel, double sampleRate);
+
+    // Channels and configuration of the spectrum stage are set before run().
+    SpectrumAnalyzer& spectrum() {return spectrum_;}
+    void setSpectrumInterval(int ms) {spectrumIntervalUs_ = static_cast<int64_t>(ms) * 1000;}
+
+    // Trends of all parameters, queries are allowed from any thread.
+    TrendRollup& trends() {return trends_;}
+
+    // Polls must be added to the bus before run().
+    void addModbusBus(std::unique_ptr<ModbusMaster> bus);
+
+    // Listen for handover requests from a new driver on path.
+    void setHandoverSocket(const std::string& path) {handoverPath_ = path;}
+    // Takes over the ports of the driver listening on path.
+    bool takeOver(const std::string& path);
+
+    // Runs until SIGTERM/SIGINT or stop(). Returns false if the loop could not be set up.
+    bool run();
+    void stop() {running_ = false;}
+
+    bool saveSnapshot();
+
+    static int64_t nowUs();
+
+private:
+    bool setupLoop();
+    // Stops the busy poller, the dispatcher and the spectrum workers; also after a failed setupLoop().
+    void stopThreads();
+    bool watch(int fd, uint32_t events);
+    void handleSignal();
+    void handleTimer();
+    void handleHandover();
+    bool handleModbus(int fd);
+    SerialPort* findPort(const std::string& path);
+    std::unique_ptr<FramePool> newFramePool(size_t port, bool busyPoll) const;
+    void reportMemory();
+    void dispatch(const Frame& f);
+    void dispatchLoop();
+    void deliver(const Frame& f);
+    void printQueueStats();
+    void qualityChanged(int port, int channel, uint8_t flags, float noiseRatio);
+    void publishSpectra();
+    void detectBeats(const Frame& f, const int16_t* samples, size_t count);
+    // Queues the registers of a poll as parameter frames, like those of a device.
+    void dispatchRegisters(size_t bus, size_t poll, const ModbusPoll& p, const uint16_t* values);
+
+    int epollFd_;
+    int signalFd_;
+    int timerFd_;
+    int handoverFd_;
+    bool running_;
+    bool handedOver_;
+    std::string handoverPath_;
+    std::string snapshotFile_;
+    int snapshotIntervalSec_;
+    std::vector<DeviceState> restoredStates_;
+    std::vector<std::unique_ptr<SerialPort> > ports_;
+    std::vector<bool> busyPoll_; // Indexed like ports_.
+    int busyPollCpu_;
+    long busyPollIdleUs_;
+    std::unique_ptr<BusyPoller> poller_;
+    std::vector<std::unique_ptr<ModbusMaster> > modbus_;
+    int modbusPortBase_;                            // Port number of the first bus.
+    std::vector<std::vector<int> > modbusChannels_; // Per bus, the channel of the first register of each poll.
+    // Indexed like ports_. Before queue_, so the queue returns its frames before the pools go.
+    std::vector<std::unique_ptr<FramePool> > pools_;
+    FrameQueue queue_;
+    std::string latestValueName_;
+    LatestValueTable latestValues_;
+    std::string waveformName_;
+    uint32_t waveformChannels_;
+    uint32_t waveformRingSamples_;
+    WaveformExport waveforms_;
+    std::string streamEndpoint_;
+    StreamServer stream_;
+    TrendRollup trends_;
+    std::unordered_map<uint32_t, std::unique_ptr<ResampleStage> > resamplers_;
+    std::unordered_map<uint32_t, SignalQualityEstimator> quality_;
+    SpectrumAnalyzer spectrum_;
+    int64_t spectrumIntervalUs_;
+    std::vector<SpectrumResult> spectra_;
+    uint16_t spectrumSeq_;
+    std::unordered_map<uint32_t, std::unique_ptr<BeatDetector> > beatDetectors_;
+    std::vector<Beat> beats_;
+    std::thread dispatcher_;
+    std::atomic<unsigned long> frameCounts_[FRAME_CLASS_COUNT];
+};
+
+#endif // SERIAL_DRIVER_HPP
@@ -0,0 +1,215 @@
+/**
+ * \file    SerialPort.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "SerialPort.hpp"
+#include "Trace.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+static const int s_candidateBaudRates[] = {115200, 57600, 38400, 19200, 9600, 230400, 460800};
+static const size_t s_candidateCount = sizeof(s_candidateBaudRates) / sizeof(s_candidateBaudRates[0]);
+
+// Switch to the next candidate rate when this many bytes arrived without a valid frame.
+static const size_t AUTOBAUD_BYTES = 3 * FRAME_MAX_SIZE;
+
+static speed_t toSpeed(int baudRate)
+{
+    switch (baudRate) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return B0;
+    }
+}
+
+SerialPort::SerialPort(int index, const std::string& path, int baudRate) :
+    index_(index),
+    fd_(-1),
+    autoBaud_(baudRate == 0),
+    candidate_(0),
+    decoder_(index, state_)
+{
+    state_.port = path;
+    state_.baudRate = baudRate;
+}
+
+SerialPort::~SerialPort()
+{
+    close();
+}
+
+bool SerialPort::open()
+{
+    TRACE();
+    fd_ = ::open(state_.port.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd_ < 0) {
+        std::cerr << state_.port << ": " << strerror(errno) << std::endl;
+        TRACE_RETURN(false);
+    }
+    struct termios tio;
+    if (tcgetattr(fd_, &tio) == 0) {
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        tcsetattr(fd_, TCSANOW, &tio);
+    }
+    if (!autoBaud_) {
+        TRACE_RETURN(setBaudRate(state_.baudRate));
+    }
+    // A restored snapshot may already know the rate, then autodetection starts from it.
+    for (size_t i = 0; i < s_candidateCount; ++i) {
+        if (s_candidateBaudRates[i] == state_.baudRate) {
+            candidate_ = i;
+        }
+    }
+    TRACE_RETURN(setBaudRate(s_candidateBaudRates[candidate_]));
+}
+
+int SerialPort::openRaw(const std::string& path, int baudRate, char parity)
+{
+    TRACE();
+    const speed_t speed = toSpeed(baudRate);
+    if (speed == B0) {
+        std::cerr << path << ": unsupported baud rate " << baudRate << std::endl;
+        TRACE_RETURN(-1);
+    }
+    const int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        TRACE_RETURN(-1);
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        if (parity == 'E' || parity == 'O') {
+            tio.c_cflag |= PARENB;
+            if (parity == 'O') {
+                tio.c_cflag |= PARODD;
+            }
+        }
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+            std::cerr << path << ": tcsetattr: " << strerror(errno) << std::endl;
+            ::close(fd);
+            TRACE_RETURN(-1);
+        }
+        tcflush(fd, TCIOFLUSH);
+    }
+    TRACE_RETURN(fd);
+}
+
+void SerialPort::adopt(int fd)
+{
+    close();
+    fd_ = fd;
+    if (autoBaud_) {
+        for (size_t i = 0; i < s_candidateCount; ++i) {
+            if (s_candidateBaudRates[i] == state_.baudRate) {
+                candidate_ = i;
+            }
+        }
+    }
+}
+
+void SerialPort::close()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool SerialPort::setBaudRate(int baudRate)
+{
+    TRACE();
+    const speed_t speed = toSpeed(baudRate);
+    if (speed == B0) {
+        std::cerr << state_.port << ": unsupported baud rate " << baudRate << std::endl;
+        TRACE_RETURN(false);
+    }
+    struct termios tio;
+    if (tcgetattr(fd_, &tio) != 0) {
+        // Not a tty (e.g. a pipe in tests), nothing to configure.
+        TRACE_RETURN(true);
+    }
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd_, TCSANOW, &tio) != 0) {
+        std::cerr << state_.port << ": tcsetattr: " << strerror(errno) << std::endl;
+        TRACE_RETURN(false);
+    }
+    tcflush(fd_, TCIFLUSH);
+    TRACE_PRINT("baud", ("%s: %d baud", state_.port.c_str(), baudRate));
+    TRACE_RETURN(true);
+}
+
+void SerialPort::nextCandidateBaudRate()
+{
+    candidate_ = (candidate_ + 1) % s_candidateCount;
+    decoder_.reset();
+    setBaudRate(s_candidateBaudRates[candidate_]);
+}
+
+ssize_t SerialPort::readAvailable(int64_t nowUs, const FrameDecoder::FrameHandler& handler)
+{
+    uint8_t buf[4096];
+    ssize_t total = 0;
+    for (;;) {
+        const ssize_t n = ::read(fd_, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return total;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << state_.port << ": read: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        if (n == 0) {
+            // VMIN=0/VTIME=0 makes a tty return 0 instead of EAGAIN, hangups are seen as EPOLLHUP.
+            return total;
+        }
+        total += n;
+        std::lock_guard<std::mutex> lock(stateMutex_);
+        const size_t frames = decoder_.feed(buf, static_cast<size_t>(n), nowUs, handler);
+
+        if (autoBaud_) {
+            if (decoder_.bytesSinceSync() > AUTOBAUD_BYTES) {
+                state_.baudRate = 0;
+                nextCandidateBaudRate();
+            } else if (frames > 0 && state_.baudRate == 0) {
+                state_.baudRate = s_candidateBaudRates[candidate_];
+                std::cerr << state_.port << ": detected " << state_.baudRate << " baud" << std::endl;
+            }
+        }
+    }
+}
+
+DeviceState SerialPort::stateSnapshot() const
+{
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    return state_;
+}
@@ -0,0 +1,66 @@
+/******************************************************************************/
+/**
+ * \file    SerialPort.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * A serial port opened in raw, non-blocking mode, together with the frame decoder and device state for the
+ * device connected to it. A baud rate of 0 means autodetect: candidate rates are tried in turn until frames
+ * decode with valid CRCs, and the detected rate is stored in the device state.
+ **/
+
+#ifndef SERIAL_PORT_HPP
+#define SERIAL_PORT_HPP
+
+#include "DeviceState.hpp"
+#include "FrameDecoder.hpp"
+
+#include <mutex>
+#include <string>
+
+#include <sys/types.h>
+
+class SerialPort
+{
+public:
+    explicit SerialPort(int index, const std::string& path, int baudRate);
+    ~SerialPort();
+
+    bool open();
+    // Opens path raw and non-blocking at a fixed rate, parity 'N', 'E' or 'O'. Returns the fd or -1.
+    static int openRaw(const std::string& path, int baudRate, char parity='N');
+    // Takes over an fd that is already open and configured, e.g. received in a handover.
+    void adopt(int fd);
+    void close();
+    bool setBaudRate(int baudRate);
+
+    // Reads what is available and decodes it. Returns the number of bytes read, or -1 on a read error.
+    ssize_t readAvailable(int64_t nowUs, const FrameDecoder::FrameHandler& handler);
+    // Copy of the device state, safe while another thread is reading the port.
+    DeviceState stateSnapshot() const;
+
+    int index() const {return index_;}
+    int fd() const {return fd_;}
+    int configuredBaudRate() const {return autoBaud_ ? 0 : state_.baudRate;}
+    const std::string& path() const {return state_.port;}
+    DeviceState& state() {return state_;}
+    FrameDecoder& decoder() {return decoder_;}
+
+private:
+    void nextCandidateBaudRate();
+
+    int index_;
+    int fd_;
+    bool autoBaud_;
+    size_t candidate_;
+    mutable std::mutex stateMutex_; // Held while decoding, the port may be read by the busy poller.
+    DeviceState state_;
+    FrameDecoder decoder_;
+};
+
+#endif // SERIAL_PORT_HPP
@@ -0,0 +1,165 @@
+/**
+ * \file    SignalQuality.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "SignalQuality.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static_assert(SQ_SEGMENT_SAMPLES % 8 == 0, "segments are processed 8 samples at a time");
+
+SignalQualityEstimator::SignalQualityEstimator(const SignalQualityConfig& config) :
+    config_(config),
+    window_(std::max<size_t>(config.windowSegments, 1))
+{
+    reset();
+}
+
+void SignalQualityEstimator::reset()
+{
+    std::memset(buffer_, 0, sizeof(buffer_));
+    fill_ = 0;
+    next_ = 0;
+    segments_ = 0;
+    railed_ = 0;
+    d1Energy_ = 0;
+    d2Energy_ = 0;
+    flags_ = 0;
+}
+
+float SignalQualityEstimator::noiseRatio() const
+{
+    if (segments_ < window_.size() || d1Energy_ == 0) {
+        return 0.0f;
+    }
+    return static_cast<float>(d2Energy_) / d1Energy_;
+}
+
+uint8_t SignalQualityEstimator::process(const int16_t* samples, size_t n)
+{
+    while (n > 0) {
+        const size_t k = std::min(n, SQ_SEGMENT_SAMPLES - fill_);
+        std::memcpy(buffer_ + 2 + fill_, samples, k * sizeof(int16_t));
+        fill_ += k;
+        samples += k;
+        n -= k;
+        if (fill_ == SQ_SEGMENT_SAMPLES) {
+            closeSegment();
+        }
+    }
+    return flags_;
+}
+
+void SignalQualityEstimator::closeSegment()
+{
+    Segment s;
+    const int16_t* x = buffer_ + 2;
+#ifdef __SSE2__
+    // Differences are saturating, so they are only clipped for full scale steps, where the segment is
+    // flagged saturated anyway. madd of two clipped squares still fits an int32, the sums are 64 bit.
+    const __m128i low = _mm_set1_epi16(static_cast<int16_t>(config_.railLow + 1));
+    const __m128i high = _mm_set1_epi16(static_cast<int16_t>(config_.railHigh - 1));
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vmin = _mm_set1_epi16(INT16_MAX);
+    __m128i vmax = _mm_set1_epi16(INT16_MIN);
+    __m128i e1 = zero;
+    __m128i e2 = zero;
+    uint32_t railed = 0;
+    for (size_t i = 0; i < SQ_SEGMENT_SAMPLES; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i - 1));
+        const __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i - 2));
+        vmin = _mm_min_epi16(vmin, v);
+        vmax = _mm_max_epi16(vmax, v);
+        const __m128i rail = _mm_or_si128(_mm_cmplt_epi16(v, low), _mm_cmpgt_epi16(v, high));
+        railed += static_cast<uint32_t>(__builtin_popcount(_mm_movemask_epi8(rail))) / 2;
+        const __m128i d1 = _mm_subs_epi16(v, v1);
+        const __m128i d2 = _mm_subs_epi16(d1, _mm_subs_epi16(v1, v2));
+        const __m128i s1 = _mm_madd_epi16(d1, d1);
+        const __m128i s2 = _mm_madd_epi16(d2, d2);
+        e1 = _mm_add_epi64(e1, _mm_add_epi64(_mm_unpacklo_epi32(s1, zero), _mm_unpackhi_epi32(s1, zero)));
+        e2 = _mm_add_epi64(e2, _mm_add_epi64(_mm_unpacklo_epi32(s2, zero), _mm_unpackhi_epi32(s2, zero)));
+    }
+    int16_t lanes[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vmin);
+    s.min = *std::min_element(lanes, lanes + 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vmax);
+    s.max = *std::max_element(lanes, lanes + 8);
+    uint64_t sums[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), e1);
+    s.d1Energy = sums[0] + sums[1];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), e2);
+    s.d2Energy = sums[0] + sums[1];
+    s.railed = railed;
+#else
+    s.min = INT16_MAX;
+    s.max = INT16_MIN;
+    s.railed = 0;
+    s.d1Energy = 0;
+    s.d2Energy = 0;
+    for (size_t i = 0; i < SQ_SEGMENT_SAMPLES; ++i) {
+        s.min = std::min(s.min, x[i]);
+        s.max = std::max(s.max, x[i]);
+        s.railed += x[i] <= config_.railLow || x[i] >= config_.railHigh ? 1 : 0;
+        const int d1 = std::max(-32768, std::min(32767, x[i] - x[i - 1]));
+        const int d1p = std::max(-32768, std::min(32767, x[i - 1] - x[i - 2]));
+        const int d2 = std::max(-32768, std::min(32767, d1 - d1p));
+        s.d1Energy += static_cast<uint64_t>(d1 * d1);
+        s.d2Energy += static_cast<uint64_t>(d2 * d2);
+    }
+#endif
+    buffer_[0] = x[SQ_SEGMENT_SAMPLES - 2];
+    buffer_[1] = x[SQ_SEGMENT_SAMPLES - 1];
+    fill_ = 0;
+
+    Segment& old = window_[next_];
+    if (segments_ == window_.size()) {
+        railed_ -= old.railed;
+        d1Energy_ -= old.d1Energy;
+        d2Energy_ -= old.d2Energy;
+    } else {
+        segments_++;
+    }
+    old = s;
+    next_ = (next_ + 1) % window_.size();
+    railed_ += s.railed;
+    d1Energy_ += s.d1Energy;
+    d2Energy_ += s.d2Energy;
+    if (segments_ < window_.size()) {
+        return;
+    }
+
+    int16_t mn = INT16_MAX;
+    int16_t mx = INT16_MIN;
+    for (size_t i = 0; i < window_.size(); ++i) {
+        mn = std::min(mn, window_[i].min);
+        mx = std::max(mx, window_[i].max);
+    }
+    const double samples = static_cast<double>(window_.size() * SQ_SEGMENT_SAMPLES);
+    const bool flat = mx - mn < config_.flatPeakToPeak;
+    uint8_t flags = 0;
+    if (flat) {
+        flags |= SQ_FLATLINE;
+    }
+    if (railed_ > config_.saturatedFraction * samples) {
+        flags |= SQ_SATURATED;
+    }
+    if (railed_ >= config_.leadOffFraction * samples) {
+        flags |= SQ_LEAD_OFF;
+    }
+    // Quantization noise of a flat signal is not noise worth flagging.
+    if (!flat && d2Energy_ > config_.noiseRatio * d1Energy_) {
+        flags |= SQ_NOISY;
+    }
+    flags_ = flags;
+}
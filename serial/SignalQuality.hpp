@@ -0,0 +1,95 @@
+/******************************************************************************/
+/**
+ * \file    SignalQuality.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Signal quality index of a waveform channel, so that alarm logic and other expensive consumers can skip
+ * segments that are artifact rather than signal.
+ *
+ * Samples are taken in segments of SQ_SEGMENT_SAMPLES. Each full segment is reduced by one vectorized
+ * pass (SSE2) to min, max, samples at the rails and the energy of the first and second difference. The
+ * window is the newest windowSegments segments: the energies are kept as running sums, so a new segment
+ * costs one add and one subtract, and the flags are evaluated over the window:
+ *
+ *   flatline   peak to peak below flatPeakToPeak.
+ *   saturated  more than saturatedFraction of the samples at a rail.
+ *   noisy      second difference energy above noiseRatio times the first difference energy. Physiological
+ *              signals are oversampled and their second difference is small (a 10 Hz sine at 250 Hz gives
+ *              0.06), white noise gives 3.
+ *   lead off   the input pinned at a rail, leadOffFraction of the window or more. This is what an open
+ *              electrode looks like through an amplifier.
+ *
+ * The flags of a sample are those of the window when the sample's segment completed, and are 0 until the
+ * first window is full.
+ **/
+
+#ifndef SIGNAL_QUALITY_HPP
+#define SIGNAL_QUALITY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum SignalQualityFlag {
+    SQ_FLATLINE = 0x01,
+    SQ_SATURATED = 0x02,
+    SQ_NOISY = 0x04,
+    SQ_LEAD_OFF = 0x08
+};
+
+static const size_t SQ_SEGMENT_SAMPLES = 32;
+
+struct SignalQualityConfig {
+    explicit SignalQualityConfig(){windowSegments=8;railLow=-32767;railHigh=32767;flatPeakToPeak=8;saturatedFraction=0.02f;noiseRatio=1.0f;leadOffFraction=0.9f;}
+    size_t windowSegments;
+    int16_t railLow;           // Samples at or beyond the rails count as saturated.
+    int16_t railHigh;
+    int flatPeakToPeak;
+    float saturatedFraction;
+    float noiseRatio;
+    float leadOffFraction;
+};
+
+class SignalQualityEstimator
+{
+public:
+    explicit SignalQualityEstimator(const SignalQualityConfig& config=SignalQualityConfig());
+
+    // Adds n samples and returns the flags after them.
+    uint8_t process(const int16_t* samples, size_t n);
+    uint8_t flags() const {return flags_;}
+    // Second to first difference energy of the window, 0 before it is full.
+    float noiseRatio() const;
+    void reset();
+
+private:
+    struct Segment {
+        int16_t min;
+        int16_t max;
+        uint32_t railed;
+        uint64_t d1Energy;
+        uint64_t d2Energy;
+    };
+
+    void closeSegment();
+
+    SignalQualityConfig config_;
+    // Two samples of the previous segment, then the segment being filled.
+    int16_t buffer_[2 + SQ_SEGMENT_SAMPLES];
+    size_t fill_;
+    std::vector<Segment> window_;
+    size_t next_;
+    size_t segments_;
+    uint64_t railed_;
+    uint64_t d1Energy_;
+    uint64_t d2Energy_;
+    uint8_t flags_;
+};
+
+#endif // SIGNAL_QUALITY_HPP
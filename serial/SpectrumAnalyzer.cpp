@@ -0,0 +1,220 @@
+/**
+ * \file    SpectrumAnalyzer.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "SpectrumAnalyzer.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// Jobs per worker; more than that waiting means the workers cannot keep up.
+static const size_t JOBS_PER_WORKER = 4;
+
+SpectrumAnalyzer::SpectrumAnalyzer() :
+    scale_(0.0)
+{
+    // The physiological band, mains at 50 and 60 Hz with the leakage of the Hann window, and what is above.
+    const SpectrumBand bands[] = {
+        {"signal", 0.5, 40.0},
+        {"mains50", 48.0, 52.0},
+        {"mains60", 58.0, 62.0},
+        {"hf", 65.0, 1e9},
+    };
+    bands_.assign(bands, bands + sizeof(bands) / sizeof(bands[0]));
+    setConfig(config_);
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer()
+{
+    stop();
+}
+
+bool SpectrumAnalyzer::setConfig(const SpectrumConfig& config)
+{
+    std::unique_ptr<Fft> fft(new Fft(config.fftSize));
+    if (!fft->valid() || config.fftSize < 16 || config.hop == 0 || config.hop > config.fftSize || config.workers <= 0) {
+        std::cerr << "Spectrum: fft size must be a power of two of at least 16, hop 1.." << config.fftSize
+                  << ", at least one worker" << std::endl;
+        return false;
+    }
+    config_ = config;
+    fft_ = std::move(fft);
+    window_.resize(config.fftSize);
+    double power = 0.0;
+    for (size_t i = 0; i < config.fftSize; ++i) {
+        window_[i] = static_cast<float>(0.5 - 0.5 * std::cos(2 * M_PI * i / config.fftSize));
+        power += static_cast<double>(window_[i]) * window_[i];
+    }
+    // Parseval with the window's power, doubled for the negative frequencies.
+    scale_ = 2.0 / (static_cast<double>(config.fftSize) * power);
+    return true;
+}
+
+bool SpectrumAnalyzer::addChannel(int port, int channel, double sampleRate)
+{
+    if (sampleRate <= 0.0 || bands_.size() * sizeof(float) > 255) {
+        return false;
+    }
+    std::unique_ptr<Channel> c(new Channel);
+    c->port = port;
+    c->channel = channel;
+    c->sampleRate = sampleRate;
+    c->history.assign(config_.fftSize, 0.0f);
+    c->pos = 0;
+    c->samples = 0;
+    c->sinceWindow = 0;
+    const size_t nyquist = config_.fftSize / 2;
+    for (size_t b = 0; b < bands_.size(); ++b) {
+        const double hzPerBin = sampleRate / config_.fftSize;
+        const size_t first = std::min(nyquist + 1, static_cast<size_t>(std::ceil(bands_[b].lowHz / hzPerBin)));
+        const size_t last = std::min(nyquist + 1, static_cast<size_t>(std::floor(std::min(bands_[b].highHz, sampleRate) / hzPerBin)) + 1);
+        c->bins.push_back(std::make_pair(first, std::max(first, last)));
+    }
+    c->result.port = port;
+    c->result.channel = channel;
+    c->result.timestampUs = 0;
+    c->result.bandPower.assign(bands_.size(), 0.0f);
+    c->fresh = false;
+    channels_[static_cast<uint32_t>(port << 8 | channel)] = std::move(c);
+    return true;
+}
+
+bool SpectrumAnalyzer::start()
+{
+    TRACE();
+    if (channels_.empty() || running()) {
+        TRACE_RETURN(false);
+    }
+    const size_t jobs = JOBS_PER_WORKER * static_cast<size_t>(config_.workers);
+    jobs_.clear();
+    free_.clear();
+    for (size_t i = 0; i < jobs; ++i) {
+        std::unique_ptr<Job> job(new Job);
+        job->re.resize(config_.fftSize);
+        job->im.resize(config_.fftSize);
+        job->power.resize(bands_.size());
+        free_.push_back(job.get());
+        jobs_.push_back(std::move(job));
+    }
+    // Every job fits in the pool's queue, the free list is what limits the backlog.
+    pool_.setMaxPending(jobs);
+    TRACE_PRINT("spectrum", ("%d channels, fft %d hop %d, %d workers", (int) channels_.size(),
+                             (int) config_.fftSize, (int) config_.hop, config_.workers));
+    TRACE_RETURN(pool_.start(config_.workers));
+}
+
+void SpectrumAnalyzer::stop()
+{
+    pool_.stop();
+}
+
+void SpectrumAnalyzer::push(int port, int channel, const int16_t* samples, size_t n, int64_t timestampUs)
+{
+    const std::unordered_map<uint32_t, std::unique_ptr<Channel> >::iterator it =
+        channels_.find(static_cast<uint32_t>(port << 8 | channel));
+    if (it == channels_.end() || !running()) {
+        return;
+    }
+    Channel& c = *it->second;
+    const size_t size = config_.fftSize;
+    for (size_t i = 0; i < n; ++i) {
+        c.history[c.pos] = samples[i];
+        c.pos = c.pos + 1 == size ? 0 : c.pos + 1;
+        c.samples++;
+        if (++c.sinceWindow < config_.hop || c.samples < size) {
+            continue;
+        }
+        c.sinceWindow = 0;
+        Job* job = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (free_.empty()) {
+                stats_.skipped++;
+                continue;
+            }
+            job = free_.back();
+            free_.pop_back();
+        }
+        // Oldest sample first; the window is applied by the worker.
+        std::memcpy(job->re.data(), &c.history[c.pos], (size - c.pos) * sizeof(float));
+        std::memcpy(job->re.data() + size - c.pos, c.history.data(), c.pos * sizeof(float));
+        job->channel = &c;
+        job->timestampUs = timestampUs + static_cast<int64_t>(i * 1e6 / c.sampleRate);
+        pool_.submit([this, job] { analyze(job); });
+    }
+}
+
+void SpectrumAnalyzer::analyze(Job* job)
+{
+    const size_t size = config_.fftSize;
+    float* re = job->re.data();
+    float* im = job->im.data();
+    size_t i = 0;
+#ifdef __SSE__
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= size; i += 4) {
+        _mm_storeu_ps(re + i, _mm_mul_ps(_mm_loadu_ps(re + i), _mm_loadu_ps(&window_[i])));
+        _mm_storeu_ps(im + i, zero);
+    }
+#endif
+    for (; i < size; ++i) {
+        re[i] *= window_[i];
+        im[i] = 0.0f;
+    }
+    fft_->forward(re, im);
+
+    Channel& c = *job->channel;
+    std::vector<float>& power = job->power;
+    for (size_t b = 0; b < c.bins.size(); ++b) {
+        double sum = 0.0;
+        for (size_t k = c.bins[b].first; k < c.bins[b].second; ++k) {
+            // DC and Nyquist have no mirror image.
+            const double w = k == 0 || k == size / 2 ? 0.5 : 1.0;
+            sum += w * (static_cast<double>(re[k]) * re[k] + static_cast<double>(im[k]) * im[k]);
+        }
+        power[b] = static_cast<float>(sum * scale_);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // With several workers a newer window can finish first.
+    if (job->timestampUs >= c.result.timestampUs) {
+        c.result.timestampUs = job->timestampUs;
+        c.result.bandPower.swap(power);
+        c.fresh = true;
+    }
+    stats_.windows++;
+    free_.push_back(job);
+}
+
+size_t SpectrumAnalyzer::collect(std::vector<SpectrumResult>& out)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t n = 0;
+    for (std::unordered_map<uint32_t, std::unique_ptr<Channel> >::iterator it = channels_.begin(); it != channels_.end(); ++it) {
+        Channel& c = *it->second;
+        if (c.fresh) {
+            out.push_back(c.result);
+            c.fresh = false;
+            n++;
+        }
+    }
+    return n;
+}
+
+SpectrumStats SpectrumAnalyzer::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
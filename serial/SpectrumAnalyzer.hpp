@@ -0,0 +1,123 @@
+/******************************************************************************/
+/**
+ * \file    SpectrumAnalyzer.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Band powers of waveform channels from overlapping windowed FFTs, for noise diagnostics and mains
+ * interference detection.
+ *
+ * push() is called by the dispatcher with the samples of each frame. It keeps the newest fftSize samples of
+ * the channel, and every hop samples it copies them into a job for the worker pool: a Hann window, the FFT
+ * (Fft) and the sum of the power spectrum over each band. Job buffers are reused, so nothing is allocated
+ * per window. If the workers fall behind, windows are skipped and counted rather than queued.
+ *
+ * Band powers are one-sided mean square values in squared sample units, so a sine of amplitude A within a
+ * band gives A^2 / 2. collect() returns the newest powers of every channel that has a new spectrum since
+ * the previous call; the driver calls it at the publish interval.
+ **/
+
+#ifndef SPECTRUM_ANALYZER_HPP
+#define SPECTRUM_ANALYZER_HPP
+
+#include "Fft.hpp"
+#include "WorkerPool.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SpectrumBand {
+    std::string name;
+    double lowHz;
+    double highHz;
+};
+
+struct SpectrumConfig {
+    explicit SpectrumConfig(){fftSize=512;hop=128;workers=1;}
+    size_t fftSize;
+    size_t hop;       // Samples between windows, fftSize / 4 is 75% overlap.
+    int workers;
+};
+
+struct SpectrumResult {
+    int port;
+    int channel;
+    int64_t timestampUs;          // Host time of the newest sample in the window.
+    std::vector<float> bandPower;
+};
+
+struct SpectrumStats {
+    explicit SpectrumStats(){windows=0;skipped=0;}
+    unsigned long windows;
+    unsigned long skipped;
+};
+
+class SpectrumAnalyzer
+{
+public:
+    explicit SpectrumAnalyzer();
+    ~SpectrumAnalyzer();
+
+    // Configuration, bands and channels are set before start().
+    bool setConfig(const SpectrumConfig& config);
+    void setBands(const std::vector<SpectrumBand>& bands) {bands_ = bands;}
+    const std::vector<SpectrumBand>& bands() const {return bands_;}
+    bool addChannel(int port, int channel, double sampleRate);
+    bool empty() const {return channels_.empty();}
+
+    bool start();
+    void stop();
+    bool running() const {return pool_.running();}
+
+    // Adds the samples of a frame. Channels that were not added are ignored.
+    void push(int port, int channel, const int16_t* samples, size_t n, int64_t timestampUs);
+    // Appends the newest band powers of the channels with a new spectrum, returns how many.
+    size_t collect(std::vector<SpectrumResult>& out);
+    SpectrumStats stats() const;
+
+private:
+    struct Channel {
+        int port;
+        int channel;
+        double sampleRate;
+        std::vector<float> history;       // The newest fftSize samples, circular.
+        size_t pos;
+        uint64_t samples;
+        size_t sinceWindow;
+        std::vector<std::pair<size_t, size_t> > bins;  // [first, last) bin of each band.
+        SpectrumResult result;            // Guarded by the analyzer's mutex.
+        bool fresh;
+    };
+    struct Job {
+        Channel* channel;
+        int64_t timestampUs;
+        std::vector<float> re;
+        std::vector<float> im;
+        std::vector<float> power;         // Swapped with the channel's result, both are one per band.
+    };
+
+    void analyze(Job* job);
+
+    SpectrumConfig config_;
+    std::vector<SpectrumBand> bands_;
+    std::unique_ptr<Fft> fft_;
+    std::vector<float> window_;
+    double scale_;                        // From |X|^2 to one-sided mean square.
+    std::unordered_map<uint32_t, std::unique_ptr<Channel> > channels_;
+    std::vector<std::unique_ptr<Job> > jobs_;
+    mutable std::mutex mutex_;
+    std::vector<Job*> free_;
+    SpectrumStats stats_;
+    WorkerPool pool_;
+};
+
+#endif // SPECTRUM_ANALYZER_HPP
@@ -0,0 +1,488 @@
+/**
+ * \file    StreamServer.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "StreamServer.hpp"
+#include "MemoryPlacement.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Messages gathered by one writev.
+static const int MAX_IOV = 64;
+
+static bool isUnixEndpoint(const std::string& endpoint)
+{
+    return endpoint.find('/') != std::string::npos;
+}
+
+// Fills addr from a path or host:port. Returns the address length, 0 on error.
+static socklen_t makeAddress(const std::string& endpoint, struct sockaddr_storage& addr)
+{
+    std::memset(&addr, 0, sizeof(addr));
+    if (isUnixEndpoint(endpoint)) {
+        struct sockaddr_un* un = reinterpret_cast<struct sockaddr_un*>(&addr);
+        if (endpoint.size() >= sizeof(un->sun_path)) {
+            std::cerr << endpoint << ": socket path too long" << std::endl;
+            return 0;
+        }
+        un->sun_family = AF_UNIX;
+        std::strcpy(un->sun_path, endpoint.c_str());
+        return sizeof(struct sockaddr_un);
+    }
+    const size_t colon = endpoint.rfind(':');
+    struct sockaddr_in* in = reinterpret_cast<struct sockaddr_in*>(&addr);
+    in->sin_family = AF_INET;
+    const std::string host = colon == std::string::npos ? "127.0.0.1" : endpoint.substr(0, colon);
+    in->sin_port = htons(static_cast<uint16_t>(atoi(endpoint.c_str() + (colon == std::string::npos ? 0 : colon + 1))));
+    if (inet_pton(AF_INET, host.c_str(), &in->sin_addr) != 1) {
+        std::cerr << endpoint << ": bad address, use a socket path or host:port" << std::endl;
+        return 0;
+    }
+    return sizeof(struct sockaddr_in);
+}
+
+StreamServer::StreamServer(size_t ringMessages) :
+    ringMessages_(64),
+    maxBacklog_(0),
+    policy_(SLOW_CLIENT_DROP_OLDEST),
+    ring_(nullptr),
+    head_(0),
+    wakePending_(false),
+    epollFd_(-1),
+    listenFd_(-1),
+    wakeFd_(-1),
+    sent_(0),
+    dropped_(0),
+    disconnected_(0)
+{
+    while (ringMessages_ < ringMessages) {
+        ringMessages_ <<= 1;
+    }
+    ring_ = static_cast<uint8_t*>(allocateBuffer(ringMessages_ * STREAM_SLOT_SIZE, "stream ring"));
+    maxBacklog_ = ringMessages_ / 4;
+}
+
+StreamServer::~StreamServer()
+{
+    stop(false);
+    freeBuffer(ring_);
+}
+
+void StreamServer::setMaxBacklog(size_t messages)
+{
+    maxBacklog_ = std::max<size_t>(1, std::min(messages, ringMessages_ / 2));
+}
+
+bool StreamServer::start(const std::string& endpoint, int epollFd)
+{
+    TRACE();
+    struct sockaddr_storage addr;
+    const socklen_t len = makeAddress(endpoint, addr);
+    if (len == 0) {
+        TRACE_RETURN(false);
+    }
+    const bool unixSocket = isUnixEndpoint(endpoint);
+    listenFd_ = socket(unixSocket ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0) {
+        std::cerr << "socket: " << strerror(errno) << std::endl;
+        TRACE_RETURN(false);
+    }
+    if (unixSocket) {
+        // A driver we took over from may still listen on the old inode, its clients stay there until it exits.
+        (void) unlink(endpoint.c_str());
+        unixPath_ = endpoint;
+    } else {
+        const int one = 1;
+        setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (bind(listenFd_, reinterpret_cast<struct sockaddr*>(&addr), len) != 0 || listen(listenFd_, 16) != 0) {
+        std::cerr << endpoint << ": " << strerror(errno) << std::endl;
+        stop(false);
+        TRACE_RETURN(false);
+    }
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epollFd_ = epollFd;
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd_;
+    const bool ok = wakeFd_ >= 0 && epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &ev) == 0;
+    ev.data.fd = wakeFd_;
+    if (!ok || epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev) != 0) {
+        std::cerr << endpoint << ": " << strerror(errno) << std::endl;
+        stop(false);
+        TRACE_RETURN(false);
+    }
+    TRACE_PRINT("stream", ("Streaming on %s, ring %d messages, backlog %d", endpoint.c_str(), (int) ringMessages_,
+                           (int) maxBacklog_));
+    TRACE_RETURN(true);
+}
+
+void StreamServer::stop(bool unlinkPath)
+{
+    while (!clients_.empty()) {
+        closeClient(clients_.begin()->first);
+    }
+    if (listenFd_ >= 0) {
+        ::close(listenFd_);
+        listenFd_ = -1;
+        if (unlinkPath && !unixPath_.empty()) {
+            (void) unlink(unixPath_.c_str());
+        }
+    }
+    if (wakeFd_ >= 0) {
+        ::close(wakeFd_);
+        wakeFd_ = -1;
+    }
+}
+
+void StreamServer::publish(const Frame& f)
+{
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    uint8_t* m = &ring_[(head & (ringMessages_ - 1)) * STREAM_SLOT_SIZE];
+    const uint16_t port = static_cast<uint16_t>(f.port);
+    const uint16_t len = static_cast<uint16_t>(STREAM_HEADER_SIZE + encodeFrame(f, m + STREAM_HEADER_SIZE));
+    std::memcpy(m, &len, sizeof(len));
+    std::memcpy(m + 2, &port, sizeof(port));
+    std::memcpy(m + 4, &f.timestampUs, sizeof(f.timestampUs));
+    head_.store(head + 1, std::memory_order_release);
+    // One wake-up per batch: the loop clears the flag before it looks at the ring.
+    if (wakeFd_ >= 0 && !wakePending_.exchange(true)) {
+        const uint64_t one = 1;
+        if (write(wakeFd_, &one, sizeof(one)) != sizeof(one)) {
+            wakePending_ = false;
+        }
+    }
+}
+
+bool StreamServer::handle(int fd, uint32_t events)
+{
+    if (fd < 0) {
+        return false;
+    }
+    if (fd == listenFd_) {
+        accept();
+        return true;
+    }
+    if (fd == wakeFd_) {
+        uint64_t n;
+        if (read(wakeFd_, &n, sizeof(n)) == sizeof(n)) {
+            wakePending_ = false;
+            flushAll();
+        }
+        return true;
+    }
+    const std::unordered_map<int, Client>::iterator it = clients_.find(fd);
+    if (it == clients_.end()) {
+        return false;
+    }
+    Client& c = it->second;
+    if ((events & (EPOLLHUP | EPOLLERR)) || ((events & EPOLLIN) && !readInput(c))) {
+        closeClient(fd);
+    } else if ((events & EPOLLOUT) && !flush(c)) {
+        closeClient(fd);
+    }
+    return true;
+}
+
+void StreamServer::accept()
+{
+    TRACE();
+    for (;;) {
+        const int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            break;
+        }
+        const int one = 1;
+        (void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        struct epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            ::close(fd);
+            continue;
+        }
+        Client& c = clients_[fd];
+        c.fd = fd;
+        // New clients start with the next frame, not with the history in the ring.
+        c.cursor = head_.load(std::memory_order_acquire);
+        c.wantOut = false;
+        c.filtered = false;
+        c.sent = 0;
+        c.dropped = 0;
+        TRACE_PRINT("stream", ("Client %d connected, %d clients", fd, (int) clients_.size()));
+    }
+}
+
+void StreamServer::closeClient(int fd)
+{
+    TRACE();
+    const std::unordered_map<int, Client>::iterator it = clients_.find(fd);
+    if (it == clients_.end()) {
+        TRACE_VOID_RETURN;
+    }
+    TRACE_PRINT("stream", ("Client %d closed, sent %lu dropped %lu", fd, it->second.sent, it->second.dropped));
+    if (epollFd_ >= 0) {
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    ::close(fd);
+    clients_.erase(it);
+    TRACE_VOID_RETURN;
+}
+
+void StreamServer::setWantOut(Client& c, bool want)
+{
+    if (c.wantOut == want) {
+        return;
+    }
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = want ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.fd = c.fd;
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, c.fd, &ev);
+    c.wantOut = want;
+}
+
+void StreamServer::flushAll()
+{
+    std::vector<int> slow;
+    for (std::unordered_map<int, Client>::iterator it = clients_.begin(); it != clients_.end(); ++it) {
+        // Clients waiting for EPOLLOUT are flushed when the socket has room, but held to their backlog now.
+        Client& c = it->second;
+        if (!(c.wantOut ? trimBacklog(c) : flush(c))) {
+            slow.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < slow.size(); ++i) {
+        closeClient(slow[i]);
+    }
+}
+
+bool StreamServer::matches(const Client& c, const uint8_t* message) const
+{
+    if (!c.filtered) {
+        return true;
+    }
+    uint16_t port;
+    std::memcpy(&port, message + 2, sizeof(port));
+    const uint8_t channel = message[STREAM_HEADER_SIZE + 2];
+    return c.filters[0][channel] || (port + 1u < c.filters.size() && c.filters[port + 1][channel]);
+}
+
+bool StreamServer::trimBacklog(Client& c)
+{
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    if (head - c.cursor <= maxBacklog_) {
+        return true;
+    }
+    if (policy_ == SLOW_CLIENT_DISCONNECT) {
+        disconnected_++;
+        return false;
+    }
+    const uint64_t lost = head - maxBacklog_ - c.cursor;
+    c.dropped += lost;
+    dropped_ += lost;
+    c.cursor = head - maxBacklog_;
+    return true;
+}
+
+bool StreamServer::flush(Client& c)
+{
+    for (;;) {
+        if (!trimBacklog(c)) {
+            return false;
+        }
+        const uint64_t head = head_.load(std::memory_order_acquire);
+
+        struct iovec iov[MAX_IOV];
+        uint64_t index[MAX_IOV];
+        int n = 0;
+        if (!c.partial.empty()) {
+            iov[n].iov_base = &c.partial[0];
+            iov[n].iov_len = c.partial.size();
+            index[n++] = ~0ull;
+        }
+        uint64_t i = c.cursor;
+        for (; i < head && n < MAX_IOV; ++i) {
+            const uint8_t* m = message(i);
+            if (matches(c, m)) {
+                uint16_t len;
+                std::memcpy(&len, m, sizeof(len));
+                iov[n].iov_base = const_cast<uint8_t*>(m);
+                iov[n].iov_len = len;
+                index[n++] = i;
+            }
+        }
+        if (n == 0) {
+            c.cursor = i;
+            setWantOut(c, false);
+            return true;
+        }
+
+        const ssize_t written = writev(c.fd, iov, n);
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                setWantOut(c, true);
+                return true;
+            }
+            return false;
+        }
+        if (head_.load(std::memory_order_acquire) - c.cursor >= ringMessages_) {
+            // The ring lapped the messages while they were sent, what went out may be garbled.
+            disconnected_++;
+            return false;
+        }
+
+        size_t left = static_cast<size_t>(written);
+        uint64_t next = c.cursor;
+        for (int k = 0; k < n; ++k) {
+            if (left >= iov[k].iov_len) {
+                left -= iov[k].iov_len;
+                if (index[k] == ~0ull) {
+                    c.partial.clear();
+                } else {
+                    c.sent++;
+                    sent_++;
+                    next = index[k] + 1;
+                }
+                continue;
+            }
+            // Keep the rest of a partially sent message, the ring slot may be reused before it is sent.
+            const char* base = static_cast<const char*>(iov[k].iov_base);
+            if (index[k] == ~0ull) {
+                c.partial.erase(0, left);
+            } else {
+                c.partial.assign(base + left, iov[k].iov_len - left);
+                c.sent++;
+                sent_++;
+                next = index[k] + 1;
+            }
+            c.cursor = next;
+            setWantOut(c, true);
+            return true;
+        }
+        // Everything went out, messages skipped by the filter are passed too.
+        c.cursor = i;
+    }
+}
+
+bool StreamServer::readInput(Client& c)
+{
+    char buf[256];
+    for (;;) {
+        const ssize_t n = read(c.fd, buf, sizeof(buf));
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c.input.append(buf, static_cast<size_t>(n));
+        size_t eol;
+        while ((eol = c.input.find('\n')) != std::string::npos) {
+            command(c, c.input.substr(0, eol));
+            c.input.erase(0, eol + 1);
+        }
+        if (c.input.size() > 1024) {
+            return false;
+        }
+    }
+}
+
+// Parses "*" as -1 or a number in 0..max. Returns false for anything else.
+static bool parseFilterField(const std::string& s, long max, long& value)
+{
+    if (s == "*") {
+        value = -1;
+        return true;
+    }
+    if (s.empty() || !isdigit(static_cast<unsigned char>(s[0]))) {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    value = strtol(s.c_str(), &end, 10);
+    return errno == 0 && *end == '\0' && value <= max;
+}
+
+void StreamServer::command(Client& c, const std::string& line)
+{
+    TRACE();
+    std::istringstream is(line);
+    std::string cmd, port, channel;
+    is >> cmd >> port >> channel;
+    long p;
+    long ch;
+    if (cmd == "clear") {
+        c.filters.clear();
+        c.filtered = false;
+    } else if (cmd == "sub" && parseFilterField(port, 0xFFFF, p) && parseFilterField(channel, 0xFF, ch)) {
+        // The port of a message is 16 bits, so the filters are bounded.
+        const size_t slot = static_cast<size_t>(p + 1);
+        if (c.filters.size() <= slot) {
+            c.filters.resize(slot + 1);
+        }
+        if (ch < 0) {
+            c.filters[slot].set();
+        } else {
+            c.filters[slot].set(static_cast<size_t>(ch));
+        }
+        c.filtered = true;
+    } else {
+        TRACE_PRINT("stream", ("Client %d: ignored \"%s\"", c.fd, line.c_str()));
+        TRACE_VOID_RETURN;
+    }
+    TRACE_PRINT("stream", ("Client %d: %s", c.fd, line.c_str()));
+}
+
+StreamStats StreamServer::stats() const
+{
+    StreamStats s;
+    s.clients = clients_.size();
+    s.published = head_.load();
+    s.sent = sent_;
+    s.dropped = dropped_;
+    s.disconnected = disconnected_;
+    return s;
+}
+
+int StreamServer::connectClient(const std::string& endpoint)
+{
+    struct sockaddr_storage addr;
+    const socklen_t len = makeAddress(endpoint, addr);
+    if (len == 0) {
+        return -1;
+    }
+    const int fd = socket(isUnixEndpoint(endpoint) ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), len) != 0) {
+        std::cerr << endpoint << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,129 @@
+/******************************************************************************/
+/**
+ * \file    StreamServer.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Streams decoded frames to local clients (recorders, gateways) over a UNIX socket or loopback TCP.
+ *
+ * Every frame is encoded once into a shared ring of messages:
+ *
+ *   length(2) | port(2) | timestampUs(8) | frame as sent by the device (see Frame.hpp)
+ *
+ * little endian, length counting the whole message. Each client has a cursor into the ring, and the
+ * messages between its cursor and the head are its output buffer, bounded by maxBacklog. The server is
+ * driven by the driver's epoll loop: published frames wake it through an eventfd, and it sends each
+ * client's backlog with writev straight from the ring, so a message is never copied per client. Only the
+ * rest of a partially sent message is copied, to keep the stream intact if the ring moves on.
+ *
+ * A client that falls more than maxBacklog messages behind either loses its oldest messages (the loss is
+ * counted) or is disconnected, depending on the policy.
+ *
+ * Clients get every frame until they send a subscription, one command per line:
+ *   sub <port|*> <channel|*>   add a filter
+ *   clear                      remove all filters, i.e. get everything again
+ **/
+
+#ifndef STREAM_SERVER_HPP
+#define STREAM_SERVER_HPP
+
+#include "Frame.hpp"
+
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static const size_t STREAM_HEADER_SIZE = 12;
+static const size_t STREAM_SLOT_SIZE = 288;
+
+enum SlowClientPolicy {
+    SLOW_CLIENT_DROP_OLDEST,
+    SLOW_CLIENT_DISCONNECT
+};
+
+struct StreamStats {
+    explicit StreamStats(){clients=0;published=0;sent=0;dropped=0;disconnected=0;}
+    unsigned long clients;       // Connected now.
+    unsigned long published;
+    unsigned long sent;          // Messages, summed over clients.
+    unsigned long dropped;       // Messages lost by slow clients.
+    unsigned long disconnected;  // Slow clients disconnected.
+};
+
+class StreamServer
+{
+public:
+    explicit StreamServer(size_t ringMessages=16384);
+    ~StreamServer();
+
+    void setPolicy(SlowClientPolicy policy) {policy_ = policy;}
+    // At most half the ring, so the ring never overwrites a message that is being sent.
+    void setMaxBacklog(size_t messages);
+
+    // endpoint is a path for a UNIX socket or host:port for TCP. The fds are added to epollFd.
+    bool start(const std::string& endpoint, int epollFd);
+    // The UNIX socket path is kept when a new driver has taken it over.
+    void stop(bool unlinkPath=true);
+    bool running() const {return listenFd_ >= 0;}
+
+    // Returns true if fd belongs to the server.
+    bool handle(int fd, uint32_t events);
+
+    // Called from one thread only, the dispatcher.
+    void publish(const Frame& f);
+
+    StreamStats stats() const;
+
+    // Connects to a server, for clients and the benchmark. Returns a blocking socket or -1.
+    static int connectClient(const std::string& endpoint);
+
+private:
+    struct Client {
+        int fd;
+        uint64_t cursor;         // Next ring message to look at.
+        std::string partial;     // Rest of a partially sent message, sent first.
+        std::string input;       // Incomplete command line.
+        bool wantOut;
+        bool filtered;
+        std::vector<std::bitset<256> > filters; // [0] any port, [port + 1] that port.
+        unsigned long sent;
+        unsigned long dropped;
+    };
+
+    void accept();
+    void flushAll();
+    bool flush(Client& c);
+    // Applies the slow client policy. Returns false if the client is to be disconnected.
+    bool trimBacklog(Client& c);
+    bool readInput(Client& c);
+    void command(Client& c, const std::string& line);
+    bool matches(const Client& c, const uint8_t* message) const;
+    void setWantOut(Client& c, bool want);
+    void closeClient(int fd);
+    const uint8_t* message(uint64_t index) const {return &ring_[(index & (ringMessages_ - 1)) * STREAM_SLOT_SIZE];}
+
+    size_t ringMessages_;
+    size_t maxBacklog_;
+    SlowClientPolicy policy_;
+    uint8_t* ring_;                        // From allocateBuffer().
+    std::atomic<uint64_t> head_;
+    std::atomic<bool> wakePending_;
+    int epollFd_;
+    int listenFd_;
+    int wakeFd_;
+    std::string unixPath_;
+    std::unordered_map<int, Client> clients_;
+    unsigned long sent_;
+    unsigned long dropped_;
+    unsigned long disconnected_;
+};
+
+#endif // STREAM_SERVER_HPP
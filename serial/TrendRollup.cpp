@@ -0,0 +1,306 @@
+/**
+ * \file    TrendRollup.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "TrendRollup.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint32_t TREND_FILE_VERSION = 1;
+// Closed buckets kept in memory per resolution: 15 minutes, 12 hours and a week.
+static const size_t RING_BUCKETS[TREND_RESOLUTIONS] = {900, 720, 168};
+// A bucket is closed by tick() this long after its end, samples arriving later than that are dropped.
+static const int64_t CLOSE_GRACE_US = 1000000;
+
+TrendRollup::TrendRollup()
+{
+}
+
+TrendRollup::~TrendRollup()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::unordered_map<uint32_t, Channel>::iterator it = channels_.begin(); it != channels_.end(); ++it) {
+        for (int r = 0; r < TREND_RESOLUTIONS; ++r) {
+            Series& s = it->second.series[r];
+            // Open buckets are persisted too, a restart merges them with their continuation.
+            close(s);
+            if (s.fd >= 0) {
+                ::close(s.fd);
+            }
+        }
+    }
+}
+
+int64_t TrendRollup::widthUs(TrendResolution resolution)
+{
+    switch (resolution) {
+    case TREND_1S: return 1000000LL;
+    case TREND_1M: return 60000000LL;
+    default: return 3600000000LL;
+    }
+}
+
+const char* TrendRollup::name(TrendResolution resolution)
+{
+    switch (resolution) {
+    case TREND_1S: return "1s";
+    case TREND_1M: return "1m";
+    default: return "1h";
+    }
+}
+
+bool TrendRollup::setDirectory(const std::string& dir)
+{
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << dir << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    dir_ = dir;
+    return true;
+}
+
+TrendRollup::Channel& TrendRollup::channel(int port, int channel)
+{
+    const uint32_t key = static_cast<uint32_t>(port << 8 | (channel & 0xFF));
+    const std::unordered_map<uint32_t, Channel>::iterator it = channels_.find(key);
+    if (it != channels_.end()) {
+        return it->second;
+    }
+    Channel& ch = channels_[key];
+    for (int r = 0; r < TREND_RESOLUTIONS; ++r) {
+        Series& s = ch.series[r];
+        s.open.startUs = -1;
+        s.open.count = 0;
+        s.ring.resize(RING_BUCKETS[r]);
+        s.next = 0;
+        s.size = 0;
+        s.fd = -1;
+        s.lastPersistedUs = -1;
+        if (!dir_.empty()) {
+            openFile(port, channel, static_cast<TrendResolution>(r), s);
+        }
+    }
+    return ch;
+}
+
+void TrendRollup::openFile(int port, int channel, TrendResolution resolution, Series& s)
+{
+    TRACE();
+    char file[64];
+    snprintf(file, sizeof(file), "/p%dc%d.%s", port, channel, name(resolution));
+    const std::string path = dir_ + file;
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        TRACE_VOID_RETURN;
+    }
+    TrendFileHeader h;
+    const off_t size = lseek(fd, 0, SEEK_END);
+    if (size == 0) {
+        std::memcpy(h.magic, "gnTR", 4);
+        h.version = TREND_FILE_VERSION;
+        h.resolution = resolution;
+        h.recordSize = sizeof(TrendBucket);
+        if (write(fd, &h, sizeof(h)) != static_cast<ssize_t>(sizeof(h))) {
+            std::cerr << path << ": " << strerror(errno) << std::endl;
+            ::close(fd);
+            TRACE_VOID_RETURN;
+        }
+    } else if (pread(fd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h)) || std::memcmp(h.magic, "gnTR", 4) != 0
+               || h.version != TREND_FILE_VERSION || h.recordSize != sizeof(TrendBucket)) {
+        std::cerr << path << ": not a trend file, not persisting this channel" << std::endl;
+        ::close(fd);
+        TRACE_VOID_RETURN;
+    } else {
+        // Continue where the previous driver stopped: the newest buckets go into the ring, and the last
+        // one becomes the open bucket again if the next sample belongs to it.
+        const size_t records = static_cast<size_t>(size - sizeof(h)) / sizeof(TrendBucket);
+        const size_t n = std::min(records, s.ring.size());
+        if (n > 0 && pread(fd, s.ring.data(), n * sizeof(TrendBucket),
+                           static_cast<off_t>(sizeof(h) + (records - n) * sizeof(TrendBucket)))
+                     == static_cast<ssize_t>(n * sizeof(TrendBucket))) {
+            s.size = n;
+            s.next = n % s.ring.size();
+            s.lastPersistedUs = s.ring[n - 1].startUs;
+        }
+        TRACE_PRINT("trend", ("%s: %d buckets", path.c_str(), (int) records));
+    }
+    s.fd = fd;
+    TRACE_VOID_RETURN;
+}
+
+void TrendRollup::close(Series& s)
+{
+    if (s.open.count == 0) {
+        s.open.startUs = -1;
+        return;
+    }
+    TrendBucket b;
+    b.startUs = s.open.startUs;
+    b.min = s.open.min;
+    b.max = s.open.max;
+    b.mean = static_cast<float>(s.open.sum / s.open.count);
+    b.count = s.open.count;
+    s.ring[s.next] = b;
+    s.next = (s.next + 1) % s.ring.size();
+    s.size = std::min(s.size + 1, s.ring.size());
+    if (s.fd >= 0 && b.startUs > s.lastPersistedUs) {
+        if (write(s.fd, &b, sizeof(b)) != static_cast<ssize_t>(sizeof(b))) {
+            std::cerr << "trend: " << strerror(errno) << std::endl;
+        }
+    }
+    s.lastPersistedUs = std::max(s.lastPersistedUs, b.startUs);
+    s.open.startUs = -1;
+    s.open.count = 0;
+}
+
+void TrendRollup::add(int port, int ch, float value, int64_t timestampUs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Channel& c = channel(port, ch);
+    for (int r = 0; r < TREND_RESOLUTIONS; ++r) {
+        Series& s = c.series[r];
+        const int64_t width = widthUs(static_cast<TrendResolution>(r));
+        const int64_t start = timestampUs - timestampUs % width;
+        if (s.open.startUs >= 0 && start > s.open.startUs) {
+            close(s);
+        }
+        if (s.open.startUs < 0) {
+            if (start < s.lastPersistedUs) {
+                continue; // Late for a bucket that is already closed.
+            }
+            if (start == s.lastPersistedUs && s.size > 0) {
+                // The bucket was closed at shutdown or by tick(), open it again and take it out of the file.
+                const size_t last = (s.next + s.ring.size() - 1) % s.ring.size();
+                const TrendBucket& b = s.ring[last];
+                s.open.startUs = b.startUs;
+                s.open.min = b.min;
+                s.open.max = b.max;
+                s.open.sum = static_cast<double>(b.mean) * b.count;
+                s.open.count = b.count;
+                s.next = last;
+                s.size--;
+                if (s.fd >= 0) {
+                    const off_t end = lseek(s.fd, 0, SEEK_END);
+                    if (end >= static_cast<off_t>(sizeof(TrendFileHeader) + sizeof(TrendBucket))) {
+                        (void) ftruncate(s.fd, end - static_cast<off_t>(sizeof(TrendBucket)));
+                    }
+                }
+                s.lastPersistedUs = start - 1;
+            } else {
+                s.open.startUs = start;
+                s.open.min = value;
+                s.open.max = value;
+                s.open.sum = 0.0;
+                s.open.count = 0;
+            }
+        }
+        s.open.min = std::min(s.open.min, value);
+        s.open.max = std::max(s.open.max, value);
+        s.open.sum += value;
+        s.open.count++;
+    }
+}
+
+void TrendRollup::tick(int64_t nowUs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::unordered_map<uint32_t, Channel>::iterator it = channels_.begin(); it != channels_.end(); ++it) {
+        for (int r = 0; r < TREND_RESOLUTIONS; ++r) {
+            Series& s = it->second.series[r];
+            if (s.open.startUs >= 0 && s.open.startUs + widthUs(static_cast<TrendResolution>(r)) + CLOSE_GRACE_US <= nowUs) {
+                close(s);
+            }
+        }
+    }
+}
+
+bool TrendRollup::queryFile(const Series& s, int64_t fromUs, int64_t toUs, std::vector<TrendBucket>& out) const
+{
+    const off_t size = lseek(s.fd, 0, SEEK_END);
+    if (size < static_cast<off_t>(sizeof(TrendFileHeader))) {
+        return false;
+    }
+    const size_t records = static_cast<size_t>(size - sizeof(TrendFileHeader)) / sizeof(TrendBucket);
+    const auto offset = [](size_t i) { return static_cast<off_t>(sizeof(TrendFileHeader) + i * sizeof(TrendBucket)); };
+    // First record starting at or after fromUs.
+    size_t lo = 0;
+    size_t hi = records;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        TrendBucket b;
+        if (pread(s.fd, &b, sizeof(b), offset(mid)) != static_cast<ssize_t>(sizeof(b))) {
+            return false;
+        }
+        if (b.startUs < fromUs) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    TrendBucket chunk[256];
+    for (size_t i = lo; i < records;) {
+        const size_t n = std::min(records - i, sizeof(chunk) / sizeof(chunk[0]));
+        if (pread(s.fd, chunk, n * sizeof(TrendBucket), offset(i)) != static_cast<ssize_t>(n * sizeof(TrendBucket))) {
+            return false;
+        }
+        for (size_t k = 0; k < n; ++k) {
+            if (chunk[k].startUs >= toUs) {
+                return true;
+            }
+            out.push_back(chunk[k]);
+        }
+        i += n;
+    }
+    return true;
+}
+
+bool TrendRollup::query(int port, int ch, TrendResolution resolution, int64_t fromUs, int64_t toUs,
+                        std::vector<TrendBucket>& out)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::unordered_map<uint32_t, Channel>::const_iterator it = channels_.find(static_cast<uint32_t>(port << 8 | (ch & 0xFF)));
+    if (it == channels_.end()) {
+        return false;
+    }
+    const Series& s = it->second.series[resolution];
+    const size_t oldest = (s.next + s.ring.size() - s.size) % s.ring.size();
+    const bool ringCovers = s.size > 0 && s.ring[oldest].startUs <= fromUs;
+    if (!ringCovers && s.fd >= 0) {
+        if (!queryFile(s, fromUs, toUs, out)) {
+            return false;
+        }
+    } else {
+        for (size_t i = 0; i < s.size; ++i) {
+            const TrendBucket& b = s.ring[(oldest + i) % s.ring.size()];
+            if (b.startUs >= fromUs && b.startUs < toUs) {
+                out.push_back(b);
+            }
+        }
+    }
+    if (s.open.startUs >= fromUs && s.open.startUs < toUs && s.open.count > 0) {
+        TrendBucket b;
+        b.startUs = s.open.startUs;
+        b.min = s.open.min;
+        b.max = s.open.max;
+        b.mean = static_cast<float>(s.open.sum / s.open.count);
+        b.count = s.open.count;
+        out.push_back(b);
+    }
+    return true;
+}
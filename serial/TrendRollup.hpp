@@ -0,0 +1,107 @@
+/******************************************************************************/
+/**
+ * \file    TrendRollup.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Incremental 1 second, 1 minute and 1 hour min/max/mean trends per parameter channel.
+ *
+ * Each sample updates the open bucket of every resolution, O(1) per sample. When a sample falls into a
+ * new bucket the open one is closed: it goes into a fixed size ring of recent buckets per resolution, and
+ * with a directory set it is appended to a trend file. Buckets still open when their time has passed are
+ * closed by tick(), so a silent channel does not keep a bucket open.
+ *
+ * Trend files hold fixed size records sorted by bucket start, one file per channel and resolution:
+ *   <dir>/p<port>c<channel>.<1s|1m|1h>, a TrendFileHeader followed by TrendBucket records.
+ * Range queries use the ring when it covers the range and otherwise binary search the file, so raw
+ * samples are never scanned. A restarted driver appends to the existing files; a bucket that was closed
+ * at shutdown and continues after the restart is merged.
+ **/
+
+#ifndef TREND_ROLLUP_HPP
+#define TREND_ROLLUP_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum TrendResolution {
+    TREND_1S = 0,
+    TREND_1M = 1,
+    TREND_1H = 2,
+    TREND_RESOLUTIONS
+};
+
+struct TrendBucket {
+    int64_t startUs;
+    float min;
+    float max;
+    float mean;
+    uint32_t count;
+};
+
+struct TrendFileHeader {
+    char magic[4];      // "gnTR"
+    uint32_t version;
+    uint32_t resolution;
+    uint32_t recordSize;
+};
+
+class TrendRollup
+{
+public:
+    explicit TrendRollup();
+    ~TrendRollup();
+
+    // Persists closed buckets in dir, which is created if needed.
+    bool setDirectory(const std::string& dir);
+
+    void add(int port, int channel, float value, int64_t timestampUs);
+    // Closes buckets whose time is over, call about once a second.
+    void tick(int64_t nowUs);
+
+    // Buckets of port/channel starting in [fromUs, toUs), the open bucket included. From any thread.
+    bool query(int port, int channel, TrendResolution resolution, int64_t fromUs, int64_t toUs,
+               std::vector<TrendBucket>& out);
+
+    static int64_t widthUs(TrendResolution resolution);
+    static const char* name(TrendResolution resolution);
+
+private:
+    struct Open {
+        int64_t startUs;   // -1 if empty.
+        float min;
+        float max;
+        double sum;
+        uint32_t count;
+    };
+    struct Series {
+        Open open;
+        std::vector<TrendBucket> ring;  // Recent closed buckets, fixed capacity.
+        size_t next;                    // Ring position of the next closed bucket.
+        size_t size;
+        int fd;
+        int64_t lastPersistedUs;
+    };
+    struct Channel {
+        Series series[TREND_RESOLUTIONS];
+    };
+
+    Channel& channel(int port, int channel);
+    void openFile(int port, int channel, TrendResolution resolution, Series& s);
+    void close(Series& s);
+    bool queryFile(const Series& s, int64_t fromUs, int64_t toUs, std::vector<TrendBucket>& out) const;
+
+    std::mutex mutex_;
+    std::string dir_;
+    std::unordered_map<uint32_t, Channel> channels_;
+};
+
+#endif // TREND_ROLLUP_HPP
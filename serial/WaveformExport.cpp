@@ -0,0 +1,329 @@
+/**
+ * \file    WaveformExport.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "WaveformExport.hpp"
+#include "MemoryPlacement.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(WaveformChannel) == 128, "descriptor and counters must be on separate cache lines");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory atomics must be lock free");
+
+// Bytes per sample in a ring: an int64 timestamp, an int16 sample and the quality flags.
+static const size_t SAMPLE_BYTES = sizeof(int64_t) + sizeof(int16_t) + sizeof(uint8_t);
+
+static size_t segmentSize(uint32_t maxChannels, uint32_t ringSamples)
+{
+    return sizeof(WaveformHeader) + maxChannels * (sizeof(WaveformChannel) + static_cast<size_t>(ringSamples) * SAMPLE_BYTES);
+}
+
+WaveformSegment::WaveformSegment() :
+    base_(nullptr),
+    size_(0),
+    header_(nullptr),
+    maxChannels_(0),
+    ringSamples_(0)
+{
+}
+
+WaveformSegment::~WaveformSegment()
+{
+    if (base_ != nullptr) {
+        forgetBuffer(base_);
+        munmap(base_, size_);
+    }
+}
+
+bool WaveformSegment::map(const std::string& name, bool writable, uint32_t maxChannels, uint32_t ringSamples)
+{
+    if (base_ != nullptr) {
+        forgetBuffer(base_);
+        munmap(base_, size_);
+        base_ = nullptr;
+        header_ = nullptr;
+        maxChannels_ = 0;
+        ringSamples_ = 0;
+    }
+    const std::string path = name[0] == '/' ? name : "/" + name;
+    const int fd = shm_open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0) {
+        std::cerr << path << ": shm_open: " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        std::cerr << path << ": fstat: " << strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+    if (!writable) {
+        WaveformHeader h;
+        if (pread(fd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h)) || h.magic.load() != WAVEFORM_MAGIC
+                || h.version != WAVEFORM_VERSION
+                || segmentSize(h.maxChannels, h.ringSamples) > static_cast<size_t>(st.st_size)) {
+            std::cerr << path << ": not a waveform segment" << std::endl;
+            ::close(fd);
+            return false;
+        }
+        maxChannels = h.maxChannels;
+        ringSamples = h.ringSamples;
+    } else if (static_cast<size_t>(st.st_size) < segmentSize(maxChannels, ringSamples)
+               && ftruncate(fd, static_cast<off_t>(segmentSize(maxChannels, ringSamples))) != 0) {
+        // Only grown: readers may still have the segment mapped with the size of an earlier layout.
+        std::cerr << path << ": ftruncate: " << strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    size_ = segmentSize(maxChannels, ringSamples);
+    base_ = mmap(nullptr, size_, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base_ == MAP_FAILED) {
+        std::cerr << path << ": mmap: " << strerror(errno) << std::endl;
+        base_ = nullptr;
+        return false;
+    }
+    header_ = static_cast<WaveformHeader*>(base_);
+    maxChannels_ = maxChannels;
+    ringSamples_ = ringSamples;
+    if (writable) {
+        // On the node of the driver, readers may be anywhere.
+        placeBuffer(base_, size_, "waveform export " + path);
+    }
+    if (writable && (header_->magic.load() != WAVEFORM_MAGIC || header_->version != WAVEFORM_VERSION
+                     || header_->maxChannels != maxChannels || header_->ringSamples != ringSamples)) {
+        // New segment or a different layout: start empty.
+        header_->magic.store(0);
+        std::memset(static_cast<char*>(base_) + sizeof(WaveformHeader), 0, size_ - sizeof(WaveformHeader));
+        header_->version = WAVEFORM_VERSION;
+        header_->maxChannels = maxChannels;
+        header_->ringSamples = ringSamples;
+        header_->channels.store(0);
+        header_->magic.store(WAVEFORM_MAGIC, std::memory_order_release);
+    }
+    return true;
+}
+
+bool WaveformSegment::sameLayout() const
+{
+    return header_ != nullptr && header_->magic.load(std::memory_order_acquire) == WAVEFORM_MAGIC
+        && header_->version == WAVEFORM_VERSION && header_->maxChannels == maxChannels_
+        && header_->ringSamples == ringSamples_;
+}
+
+WaveformChannel* WaveformSegment::channel(uint32_t index) const
+{
+    char* dir = static_cast<char*>(base_) + sizeof(WaveformHeader);
+    return reinterpret_cast<WaveformChannel*>(dir) + index;
+}
+
+int64_t* WaveformSegment::timestamps(uint32_t index) const
+{
+    char* rings = static_cast<char*>(base_) + sizeof(WaveformHeader) + maxChannels_ * sizeof(WaveformChannel);
+    return reinterpret_cast<int64_t*>(rings + static_cast<size_t>(index) * ringSamples_ * SAMPLE_BYTES);
+}
+
+int16_t* WaveformSegment::samples(uint32_t index) const
+{
+    return reinterpret_cast<int16_t*>(timestamps(index) + ringSamples_);
+}
+
+uint8_t* WaveformSegment::quality(uint32_t index) const
+{
+    return reinterpret_cast<uint8_t*>(samples(index) + ringSamples_);
+}
+
+bool WaveformExport::create(const std::string& name, uint32_t maxChannels, uint32_t ringSamples)
+{
+    uint32_t ring = 64;
+    while (ring < ringSamples) {
+        ring <<= 1;
+    }
+    writers_.clear();
+    if (!map(name, true, maxChannels, ring)) {
+        return false;
+    }
+    // Channels of a reused segment continue where the previous driver stopped.
+    for (uint32_t i = 0; i < header_->channels.load(); ++i) {
+        const WaveformChannel* c = channel(i);
+        Writer w = {i, 0, 0, 0.0};
+        writers_[static_cast<uint32_t>(c->port << 8 | c->channel)] = w;
+    }
+    return true;
+}
+
+WaveformExport::Writer* WaveformExport::writer(int port, int channel)
+{
+    const uint32_t key = static_cast<uint32_t>(port << 8 | channel);
+    const std::unordered_map<uint32_t, Writer>::iterator it = writers_.find(key);
+    if (it != writers_.end()) {
+        return &it->second;
+    }
+    const uint32_t index = header_->channels.load(std::memory_order_relaxed);
+    if (index >= maxChannels_) {
+        return nullptr;
+    }
+    WaveformChannel* c = this->channel(index);
+    c->port = port;
+    c->channel = channel;
+    c->samplePeriodNs.store(0, std::memory_order_relaxed);
+    c->reserved.store(0, std::memory_order_relaxed);
+    c->committed.store(0, std::memory_order_relaxed);
+    header_->channels.store(index + 1, std::memory_order_release);
+    Writer w = {index, 0, 0, 0.0};
+    return &(writers_[key] = w);
+}
+
+bool WaveformExport::write(int port, int channel, const int16_t* data, size_t count, int64_t timestampUs,
+                           uint8_t quality)
+{
+    Writer* w = writer(port, channel);
+    if (w == nullptr) {
+        return false;
+    }
+    // Sample period from the time between frames, averaged to smooth out transport jitter.
+    if (w->lastCount > 0 && timestampUs > w->lastTimestampUs) {
+        const double period = static_cast<double>(timestampUs - w->lastTimestampUs) / w->lastCount;
+        w->periodUs = w->periodUs == 0.0 ? period : w->periodUs + (period - w->periodUs) / 16;
+    }
+    w->lastTimestampUs = timestampUs;
+    w->lastCount = count;
+
+    WaveformChannel* c = this->channel(w->index);
+    const uint32_t ring = ringSamples_;
+    if (count > ring) {
+        data += count - ring;
+        count = ring;
+    }
+    int16_t* s = samples(w->index);
+    int64_t* t = timestamps(w->index);
+    uint8_t* q = this->quality(w->index);
+    const uint64_t start = c->committed.load(std::memory_order_relaxed);
+    // Readers must see the reservation before any sample it overwrites changes.
+    c->reserved.store(start + count, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < count; ++i) {
+        const size_t pos = (start + i) & (ring - 1);
+        s[pos] = data[i];
+        t[pos] = timestampUs + static_cast<int64_t>(i * w->periodUs);
+        q[pos] = quality;
+    }
+    c->samplePeriodNs.store(static_cast<uint32_t>(w->periodUs * 1000), std::memory_order_relaxed);
+    c->committed.store(start + count, std::memory_order_release);
+    return true;
+}
+
+bool WaveformReader::attach(const std::string& name)
+{
+    name_ = name;
+    return map(name, false, 0, 0);
+}
+
+bool WaveformReader::current()
+{
+    if (sameLayout()) {
+        return true;
+    }
+    // A new driver is laying the segment out, or has done so. Until it has, there is nothing to map.
+    if (name_.empty() || (header_ != nullptr && header_->magic.load(std::memory_order_acquire) != WAVEFORM_MAGIC)) {
+        return false;
+    }
+    return map(name_, false, 0, 0) && sameLayout();
+}
+
+uint32_t WaveformReader::channels()
+{
+    if (!current()) {
+        return 0;
+    }
+    return std::min(header_->channels.load(std::memory_order_acquire), maxChannels_);
+}
+
+bool WaveformReader::channelInfo(uint32_t index, int& port, int& channel)
+{
+    if (index >= channels()) {
+        return false;
+    }
+    port = this->channel(index)->port;
+    channel = this->channel(index)->channel;
+    return true;
+}
+
+int WaveformReader::find(int port, int channel)
+{
+    const uint32_t n = channels();
+    for (uint32_t i = 0; i < n; ++i) {
+        const WaveformChannel* c = this->channel(i);
+        if (c->port == port && c->channel == channel) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+uint64_t WaveformReader::head(uint32_t index)
+{
+    if (!current() || index >= maxChannels_) {
+        return 0;
+    }
+    return channel(index)->committed.load(std::memory_order_acquire);
+}
+
+size_t WaveformReader::peek(uint32_t index, uint64_t& cursor, WaveformSpan spans[2], uint64_t* lost)
+{
+    if (!current() || index >= maxChannels_) {
+        spans[0].count = 0;
+        spans[1].count = 0;
+        return 0;
+    }
+    const WaveformChannel* c = channel(index);
+    const uint32_t ring = ringSamples_;
+    const uint64_t committed = c->committed.load(std::memory_order_acquire);
+    const uint64_t reserved = c->reserved.load(std::memory_order_relaxed);
+    if (cursor > committed) {
+        // The segment was reset by a new driver.
+        cursor = committed;
+    }
+    const uint64_t oldest = reserved > ring ? reserved - ring : 0;
+    if (cursor < oldest) {
+        if (lost != nullptr) {
+            *lost += oldest - cursor;
+        }
+        cursor = oldest;
+    }
+    const size_t n = static_cast<size_t>(committed - cursor);
+    const size_t pos = static_cast<size_t>(cursor & (ring - 1));
+    const size_t first = std::min(n, static_cast<size_t>(ring) - pos);
+    spans[0].samples = samples(index) + pos;
+    spans[0].timestampsUs = timestamps(index) + pos;
+    spans[0].quality = quality(index) + pos;
+    spans[0].count = first;
+    spans[1].samples = samples(index);
+    spans[1].timestampsUs = timestamps(index);
+    spans[1].quality = quality(index);
+    spans[1].count = n - first;
+    return n;
+}
+
+bool WaveformReader::valid(uint32_t index, uint64_t cursor) const
+{
+    // The samples were read before the reservation is looked at.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // Samples of a segment laid out anew meanwhile are not to be trusted either.
+    return sameLayout() && index < maxChannels_
+        && channel(index)->reserved.load(std::memory_order_relaxed) - cursor <= ringSamples_;
+}
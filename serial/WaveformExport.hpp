@@ -0,0 +1,151 @@
+/******************************************************************************/
+/**
+ * \file    WaveformExport.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * Waveform samples in a named shared memory segment (/dev/shm/<name>), for local consumers that want the
+ * waveforms without a copy through a socket.
+ *
+ * The segment holds a header, a directory of up to maxChannels channels and one ring per channel. A ring
+ * is ringSamples int16 samples plus parallel rings of int64 timestamps (host microseconds) and uint8
+ * signal quality flags (SignalQualityFlag). Frames carry one timestamp, the samples in between are spaced
+ * by the sample period measured between frames.
+ *
+ * Each ring has a single writer (WaveformExport in the driver) and any number of readers
+ * (WaveformReader), which map the segment read-only and keep their own cursor. The writer publishes two
+ * counters per ring: 'reserved' before it writes samples and 'committed' after. Readers look at the
+ * samples in place and then check with valid() that the writer has not lapped them in the meantime. No
+ * locks and no system calls on the data path, and a slow reader never slows the writer.
+ *
+ * Like the latest value table, the segment is kept at exit and reused by the next driver if the layout
+ * matches, so readers keep their cursors over a restart. A driver with another layout starts the segment
+ * anew; it only ever grows the file, so the mappings of readers stay valid. Offsets are computed from the
+ * layout seen when the segment was mapped, never from the header, and a reader checks the header before
+ * each read and maps the segment again when the layout has changed.
+ **/
+
+#ifndef WAVEFORM_EXPORT_HPP
+#define WAVEFORM_EXPORT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static const uint32_t WAVEFORM_MAGIC = 0x46576e67; // "gnWF"
+static const uint32_t WAVEFORM_VERSION = 2;
+
+struct alignas(64) WaveformHeader {
+    std::atomic<uint32_t> magic;     // Written last, when the segment is initialized.
+    uint32_t version;
+    uint32_t maxChannels;
+    uint32_t ringSamples;            // Power of two.
+    std::atomic<uint32_t> channels;  // Channels in use, the directory only grows.
+};
+
+struct alignas(64) WaveformChannel {
+    int32_t port;
+    int32_t channel;
+    std::atomic<uint32_t> samplePeriodNs;
+    // Total samples written; the ring holds [committed - ringSamples, committed).
+    alignas(64) std::atomic<uint64_t> reserved;
+    std::atomic<uint64_t> committed;
+};
+
+// Samples of a ring without copying them. A ring read gives at most two spans, because of the wrap.
+struct WaveformSpan {
+    const int16_t* samples;
+    const int64_t* timestampsUs;
+    const uint8_t* quality;
+    size_t count;
+};
+
+class WaveformSegment
+{
+public:
+    explicit WaveformSegment();
+    ~WaveformSegment();
+
+    uint32_t ringSamples() const {return ringSamples_;}
+
+protected:
+    bool map(const std::string& name, bool writable, uint32_t maxChannels, uint32_t ringSamples);
+    // Whether the header still describes the layout the segment was mapped with.
+    bool sameLayout() const;
+    WaveformChannel* channel(uint32_t index) const;
+    int16_t* samples(uint32_t index) const;
+    int64_t* timestamps(uint32_t index) const;
+    uint8_t* quality(uint32_t index) const;
+
+    void* base_;
+    size_t size_;
+    WaveformHeader* header_;
+    // Layout at map(), the size of the mapping follows from it.
+    uint32_t maxChannels_;
+    uint32_t ringSamples_;
+};
+
+class WaveformExport : public WaveformSegment
+{
+public:
+    // Creates (or reuses) the segment. ringSamples is rounded up to a power of two.
+    bool create(const std::string& name, uint32_t maxChannels, uint32_t ringSamples);
+    bool valid() const {return header_ != nullptr;}
+
+    // Appends the samples of one frame, all with the same quality flags. Returns false if the directory
+    // is full.
+    bool write(int port, int channel, const int16_t* samples, size_t count, int64_t timestampUs,
+               uint8_t quality=0);
+
+private:
+    // Writer side bookkeeping, not in the segment.
+    struct Writer {
+        uint32_t index;
+        int64_t lastTimestampUs;
+        size_t lastCount;
+        double periodUs;
+    };
+
+    Writer* writer(int port, int channel);
+
+    std::unordered_map<uint32_t, Writer> writers_;
+};
+
+class WaveformReader : public WaveformSegment
+{
+public:
+    // Maps an existing segment read-only.
+    bool attach(const std::string& name);
+
+    // Channels can be added by the driver at any time. After a new driver changed the layout the segment is
+    // mapped again and the channels are those of the new driver; until it has set up the segment there are none.
+    uint32_t channels();
+    bool channelInfo(uint32_t index, int& port, int& channel);
+    // Returns the index of port/channel, or -1 if the driver has not seen it yet.
+    int find(int port, int channel);
+
+    // Index of the next sample to be written. Start a cursor here to get new samples only.
+    uint64_t head(uint32_t index);
+    // Spans of the samples from cursor up to the head, returns the sample count. If the writer has
+    // overwritten samples at the cursor, cursor is moved to the oldest sample still there and the
+    // number of skipped samples is added to lost.
+    size_t peek(uint32_t index, uint64_t& cursor, WaveformSpan spans[2], uint64_t* lost=nullptr);
+    // Call after using the spans: true if the samples from cursor on were not overwritten meanwhile.
+    bool valid(uint32_t index, uint64_t cursor) const;
+
+private:
+    // Maps the segment again if its layout changed. False while it has no usable layout.
+    bool current();
+
+    std::string name_;
+};
+
+#endif // WAVEFORM_EXPORT_HPP
@@ -0,0 +1,85 @@
+/**
+ * \file    WorkerPool.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "WorkerPool.hpp"
+
+WorkerPool::WorkerPool(size_t maxPending) :
+    maxPending_(maxPending),
+    stopping_(true)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+bool WorkerPool::start(int threads)
+{
+    if (running() || threads <= 0) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = false;
+    }
+    for (int i = 0; i < threads; ++i) {
+        threads_.push_back(std::thread(&WorkerPool::run, this));
+    }
+    return true;
+}
+
+void WorkerPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        threads_[i].join();
+    }
+    threads_.clear();
+}
+
+bool WorkerPool::submit(const Job& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_ || jobs_.size() >= maxPending_) {
+            return false;
+        }
+        jobs_.push_back(job);
+    }
+    ready_.notify_one();
+    return true;
+}
+
+size_t WorkerPool::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jobs_.size();
+}
+
+void WorkerPool::run()
+{
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this] { return !jobs_.empty() || stopping_; });
+            if (jobs_.empty()) {
+                return;
+            }
+            job.swap(jobs_.front());
+            jobs_.pop_front();
+        }
+        job();
+    }
+}
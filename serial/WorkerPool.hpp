@@ -0,0 +1,57 @@
+/******************************************************************************/
+/**
+ * \file    WorkerPool.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * A fixed set of worker threads taking jobs from one queue, for analysis that is too heavy for the
+ * dispatcher thread. The queue is bounded: submit() refuses a job rather than letting the backlog grow,
+ * so the caller decides what to skip when the workers cannot keep up.
+ **/
+
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool
+{
+public:
+    typedef std::function<void()> Job;
+
+    explicit WorkerPool(size_t maxPending=256);
+    ~WorkerPool();
+
+    void setMaxPending(size_t maxPending) {maxPending_ = maxPending;}
+    bool start(int threads);
+    // Runs the jobs already queued, then joins the workers.
+    void stop();
+    bool running() const {return !threads_.empty();}
+    int threads() const {return static_cast<int>(threads_.size());}
+
+    // Returns false if the pool is not running or maxPending jobs are waiting.
+    bool submit(const Job& job);
+    size_t pending() const;
+
+private:
+    void run();
+
+    size_t maxPending_;
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<Job> jobs_;
+    bool stopping_;
+    std::vector<std::thread> threads_;
+};
+
+#endif // WORKER_POOL_HPP
@@ -0,0 +1,1750 @@
+/**
+ * \file    gnostic_serial_bench.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ * Benchmarks for the serial driver. Run without arguments for a list of benchmarks.
+ *
+ ******************************************************************************/
+
+#include "GetOpt.hpp"
+#include "BusyPoller.hpp"
+#include "BeatDetector.hpp"
+#include "Frame.hpp"
+#include "FramePool.hpp"
+#include "FrameQueue.hpp"
+#include "LatestValueTable.hpp"
+#include "MemoryPlacement.hpp"
+#include "StreamServer.hpp"
+#include "Resampler.hpp"
+#include "SignalQuality.hpp"
+#include "SpectrumAnalyzer.hpp"
+#include "TrendRollup.hpp"
+#include "WaveformExport.hpp"
+#include "ModbusMaster.hpp"
+#include "SerialPort.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <unistd.h>
+
+static int64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Log-linear histogram of microsecond values: 16 linear sub-buckets per power of two.
+class LatencyHistogram
+{
+public:
+    explicit LatencyHistogram() : counts_(64 * 16, 0), total_(0), max_(0) {}
+
+    void add(double us) {
+        const uint64_t v = us < 0 ? 0 : static_cast<uint64_t>(us * 16);
+        counts_[bucket(v)]++;
+        total_++;
+        max_ = std::max(max_, us);
+    }
+
+    double percentile(double p) const {
+        const uint64_t target = static_cast<uint64_t>(std::ceil(p / 100.0 * total_));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < counts_.size(); ++b) {
+            seen += counts_[b];
+            if (seen >= target && counts_[b] > 0) {
+                return lowerBound(b) / 16.0;
+            }
+        }
+        return max_;
+    }
+
+    void print(const std::string& name) const {
+        printf("%-10s n=%-8llu p50=%8.1f p90=%8.1f p99=%8.1f p99.9=%8.1f max=%8.1f us\n", name.c_str(),
+               static_cast<unsigned long long>(total_), percentile(50), percentile(90), percentile(99),
+               percentile(99.9), max_);
+        // Coarse power-of-two view for eyeballing the shape.
+        for (int p2 = 0; p2 < 64; ++p2) {
+            uint64_t n = 0;
+            for (int s = 0; s < 16; ++s) {
+                n += counts_[p2 * 16 + s];
+            }
+            if (n > 0) {
+                const double lo = p2 == 0 ? 0.0 : lowerBound(p2 * 16) / 16.0;
+                printf("    >= %9.1f us %8llu %s\n", lo, static_cast<unsigned long long>(n),
+                       std::string(static_cast<size_t>(std::ceil(50.0 * n / total_)), '#').c_str());
+            }
+        }
+    }
+
+private:
+    static size_t bucket(uint64_t v) {
+        if (v < 16) {
+            return static_cast<size_t>(v);
+        }
+        const int msb = 63 - __builtin_clzll(v);
+        const int shift = msb - 4;
+        return static_cast<size_t>((shift + 1) * 16 + ((v >> shift) & 15));
+    }
+    static uint64_t lowerBound(size_t b) {
+        if (b < 16) {
+            return b;
+        }
+        const int shift = static_cast<int>(b / 16) - 1;
+        return (16 + (b % 16)) << shift;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    double max_;
+};
+
+static bool openPty(int& master, std::string& slavePath)
+{
+    int slave = -1;
+    char name[128];
+    if (openpty(&master, &slave, name, nullptr, nullptr) != 0) {
+        perror("openpty");
+        return false;
+    }
+    struct termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    ::close(slave);
+    slavePath = name;
+    return true;
+}
+
+/*
+ * latency: a writer thread sends frames to a PTY at a fixed interval, each carrying its send time, and a
+ * BusyPoller reads them in one of three modes. Latency is send to frame handler.
+ */
+static int benchLatency(int argc, char* argv[])
+{
+    int frames = 5000;
+    int intervalUs = 500;
+    int cpu = -1;
+    long adaptiveIdleUs = 1000;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "n:i:b:w:")) != -1) {
+        switch (c) {
+        case 'n': frames = atoi(g.optarg); break;
+        case 'i': intervalUs = atoi(g.optarg); break;
+        case 'b': cpu = atoi(g.optarg); break;
+        case 'w': adaptiveIdleUs = atol(g.optarg); break;
+        default:
+            std::cerr << "latency [-n frames] [-i intervalus] [-b cpu] [-w idleus]" << std::endl;
+            return 1;
+        }
+    }
+
+    struct Mode {
+        const char* name;
+        long idleUs;
+    };
+    const Mode modes[] = {{"epoll", 0}, {"busy", -1}, {"adaptive", adaptiveIdleUs}};
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        int master = -1;
+        std::string slavePath;
+        if (!openPty(master, slavePath)) {
+            return 1;
+        }
+        SerialPort port(0, slavePath, 115200);
+        if (!port.open()) {
+            return 1;
+        }
+        LatencyHistogram hist;
+        std::atomic<int> received(0);
+        BusyPoller poller(cpu, modes[m].idleUs, [&](const Frame& f) {
+            int64_t sent;
+            std::memcpy(&sent, f.payload, sizeof(sent));
+            hist.add((monotonicNs() - sent) / 1000.0);
+            received++;
+        });
+        poller.addPort(&port);
+        if (!poller.start()) {
+            return 1;
+        }
+
+        Frame f;
+        std::memset(&f, 0, sizeof(f));
+        f.frameClass = FRAME_WAVEFORM;
+        f.length = sizeof(int64_t);
+        uint8_t buf[FRAME_MAX_SIZE];
+        for (int i = 0; i < frames; ++i) {
+            f.seq = static_cast<uint16_t>(i);
+            const int64_t now = monotonicNs();
+            f.deviceTime = static_cast<uint32_t>(now / 1000000);
+            std::memcpy(f.payload, &now, sizeof(now));
+            const size_t len = encodeFrame(f, buf);
+            if (write(master, buf, len) != static_cast<ssize_t>(len)) {
+                perror("write");
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(intervalUs));
+        }
+        const int64_t deadline = monotonicNs() + 1000000000;
+        while (received < frames && monotonicNs() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        poller.stop();
+        hist.print(modes[m].name);
+        printf("    fallbacks to epoll: %lu\n", poller.fallbacks());
+        port.close();
+        ::close(master);
+    }
+    return 0;
+}
+
+/*
+ * Simulated Modbus RTU slaves on the master side of a PTY. Answers read holding/input register requests
+ * for slaves [firstSlave, firstSlave + slaves), register value = slave * 1000 + address. With a baud rate,
+ * each answer is delayed by the time request and response take on the wire, so the PTY behaves like a bus.
+ */
+class ModbusSlaveSim
+{
+public:
+    explicit ModbusSlaveSim(int masterFd, int firstSlave, int slaves, int baudRate) :
+        fd_(masterFd), firstSlave_(firstSlave), slaves_(slaves), baudRate_(baudRate), running_(false) {}
+    ~ModbusSlaveSim() {stop();}
+
+    void start() {
+        running_ = true;
+        thread_ = std::thread(&ModbusSlaveSim::run, this);
+    }
+    void stop() {
+        running_ = false;
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+private:
+    void run() {
+        uint8_t req[8];
+        size_t len = 0;
+        while (running_) {
+            struct pollfd pfd = {fd_, POLLIN, 0};
+            if (poll(&pfd, 1, 50) <= 0) {
+                len = 0; // Silence ends a frame.
+                continue;
+            }
+            const ssize_t n = read(fd_, req + len, sizeof(req) - len);
+            if (n <= 0) {
+                continue;
+            }
+            len += static_cast<size_t>(n);
+            if (len < sizeof(req)) {
+                continue;
+            }
+            len = 0;
+            const uint16_t crc = req[6] | (req[7] << 8);
+            if (crc != ModbusMaster::crc(req, 6) || req[0] < firstSlave_ || req[0] >= firstSlave_ + slaves_) {
+                continue; // Not for us, a real slave stays silent too.
+            }
+            const uint16_t start = static_cast<uint16_t>((req[2] << 8) | req[3]);
+            const uint16_t count = static_cast<uint16_t>((req[4] << 8) | req[5]);
+            uint8_t rsp[MODBUS_MAX_ADU];
+            size_t rlen = 0;
+            rsp[rlen++] = req[0];
+            if ((req[1] != MODBUS_READ_HOLDING_REGISTERS && req[1] != MODBUS_READ_INPUT_REGISTERS)
+                    || count == 0 || count > MODBUS_MAX_READ_REGISTERS) {
+                rsp[rlen++] = req[1] | 0x80;
+                rsp[rlen++] = 1; // Illegal function
+            } else {
+                rsp[rlen++] = req[1];
+                rsp[rlen++] = static_cast<uint8_t>(2 * count);
+                for (uint16_t i = 0; i < count; ++i) {
+                    const uint16_t v = static_cast<uint16_t>(req[0] * 1000 + start + i);
+                    rsp[rlen++] = v >> 8;
+                    rsp[rlen++] = v & 0xFF;
+                }
+            }
+            const uint16_t rcrc = ModbusMaster::crc(rsp, rlen);
+            rsp[rlen++] = rcrc & 0xFF;
+            rsp[rlen++] = rcrc >> 8;
+            if (baudRate_ > 0) {
+                const long wireUs = static_cast<long>((sizeof(req) + rlen) * 11 * 1000000L / baudRate_);
+                std::this_thread::sleep_for(std::chrono::microseconds(wireUs));
+            }
+            if (write(fd_, rsp, rlen) != static_cast<ssize_t>(rlen)) {
+                perror("write");
+            }
+        }
+    }
+
+    int fd_;
+    int firstSlave_;
+    int slaves_;
+    int baudRate_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+};
+
+/*
+ * modbus: polls registers of simulated slaves over a PTY and reports polls per second on the bus,
+ * with and without coalescing of adjacent register ranges. Slave address 'slaves + 1' is polled too but
+ * never answers, to show the cost of a dead slave.
+ */
+static int benchModbus(int argc, char* argv[])
+{
+    int slaves = 16;
+    int pollsPerSlave = 4;
+    int registersPerPoll = 4;
+    int baudRate = 115200;
+    double seconds = 3.0;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "s:p:r:b:t:")) != -1) {
+        switch (c) {
+        case 's': slaves = atoi(g.optarg); break;
+        case 'p': pollsPerSlave = atoi(g.optarg); break;
+        case 'r': registersPerPoll = atoi(g.optarg); break;
+        case 'b': baudRate = atoi(g.optarg); break;
+        case 't': seconds = atof(g.optarg); break;
+        default:
+            std::cerr << "modbus [-s slaves] [-p pollsperslave] [-r registersperpoll] [-b baud] [-t seconds]" << std::endl;
+            return 1;
+        }
+    }
+
+    const int maxGaps[] = {0, 8};
+    const char* names[] = {"separate", "coalesced"};
+    for (int m = 0; m < 2; ++m) {
+        int master = -1;
+        std::string slavePath;
+        if (!openPty(master, slavePath)) {
+            return 1;
+        }
+        ModbusSlaveSim sim(master, 1, slaves, baudRate);
+        sim.start();
+
+        ModbusMaster bus(slavePath, baudRate, 'N');
+        bus.setMaxGap(static_cast<uint16_t>(maxGaps[m]));
+        bus.setResponseTimeoutUs(20000);
+        unsigned long polled = 0;
+        unsigned long badValues = 0;
+        bus.setHandler([&](size_t, const ModbusPoll& p, const uint16_t* v) {
+            polled++;
+            if (v[0] != static_cast<uint16_t>(p.slave * 1000 + p.start)) {
+                badValues++;
+            }
+        });
+        for (int s = 1; s <= slaves + 1; ++s) {
+            for (int p = 0; p < pollsPerSlave; ++p) {
+                // Every other poll leaves a hole of two registers, as real register maps do.
+                ModbusPoll poll = {static_cast<uint8_t>(s), MODBUS_READ_HOLDING_REGISTERS,
+                                   static_cast<uint16_t>(100 + p * (registersPerPoll + (p % 2) * 2)),
+                                   static_cast<uint16_t>(registersPerPoll)};
+                bus.addPoll(poll);
+            }
+        }
+        const int fd = SerialPort::openRaw(slavePath, baudRate, 'N');
+        if (fd < 0 || !bus.start(fd)) {
+            return 1;
+        }
+        const int ep = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = bus.fd();
+        epoll_ctl(ep, EPOLL_CTL_ADD, bus.fd(), &ev);
+        ev.data.fd = bus.timerFd();
+        epoll_ctl(ep, EPOLL_CTL_ADD, bus.timerFd(), &ev);
+
+        const int64_t start = monotonicNs();
+        const int64_t end = start + static_cast<int64_t>(seconds * 1e9);
+        struct epoll_event events[4];
+        while (monotonicNs() < end) {
+            const int n = epoll_wait(ep, events, 4, 100);
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data.fd == bus.fd()) {
+                    bus.onReadable();
+                } else {
+                    bus.onTimer();
+                }
+            }
+        }
+        const double elapsed = (monotonicNs() - start) / 1e9;
+        const ModbusStats& st = bus.stats();
+        printf("%-10s %3d slaves, %3d requests/cycle: %8.0f polls/s %7.0f requests/s %6.1f cycles/s timeouts %lu bad %lu\n",
+               names[m], slaves, (int) bus.requestCount(), polled / elapsed, st.responses / elapsed,
+               st.cycles / elapsed, st.timeouts, badValues);
+        ::close(ep);
+        sim.stop();
+        ::close(fd);
+        ::close(master);
+    }
+    return 0;
+}
+
+/*
+ * modbus-sim: runs simulated slaves on a PTY until interrupted, for trying the driver's -M option.
+ */
+static int benchModbusSim(int argc, char* argv[])
+{
+    int slaves = 8;
+    int baudRate = 115200;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "s:b:")) != -1) {
+        switch (c) {
+        case 's': slaves = atoi(g.optarg); break;
+        case 'b': baudRate = atoi(g.optarg); break;
+        default:
+            std::cerr << "modbus-sim [-s slaves] [-b baud]" << std::endl;
+            return 1;
+        }
+    }
+    int master = -1;
+    std::string slavePath;
+    if (!openPty(master, slavePath)) {
+        return 1;
+    }
+    // Keep the slave side open so the PTY does not hang up between driver runs.
+    const int keep = ::open(slavePath.c_str(), O_RDWR | O_NOCTTY);
+    printf("%s\n", slavePath.c_str());
+    fflush(stdout);
+    ModbusSlaveSim sim(master, 1, slaves, baudRate);
+    sim.start();
+    pause();
+    ::close(keep);
+    return 0;
+}
+
+/*
+ * priority: a producer offers frames in 1 ms bursts faster than a slow consumer takes them (1 alarm per 1000 frames,
+ * 10% parameters, 10% diagnostics, the rest waveforms) and the alarm latency from push to delivery is
+ * measured. 'fifo' queues everything in one class for comparison. Fails if the counters of a class do not add up
+ * to the frames pushed.
+ */
+static int benchPriority(int argc, char* argv[])
+{
+    long rate = 1000000;
+    double workUs = 2.0;
+    double seconds = 2.0;
+    size_t capacity = 4096;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "r:w:t:c:")) != -1) {
+        switch (c) {
+        case 'r': rate = atol(g.optarg); break;
+        case 'w': workUs = atof(g.optarg); break;
+        case 't': seconds = atof(g.optarg); break;
+        case 'c': capacity = static_cast<size_t>(atol(g.optarg)); break;
+        default:
+            std::cerr << "priority [-r frames/s] [-w consumerus] [-t seconds] [-c capacity]" << std::endl;
+            return 1;
+        }
+    }
+
+    const char* names[] = {"fifo", "strict", "weighted"};
+    bool ok = true;
+    for (int m = 0; m < 3; ++m) {
+        unsigned long pushed[FRAME_CLASS_COUNT] = {0, 0, 0, 0};
+        FramePool pool(capacity + 1);
+        FrameQueue queue(capacity);
+        queue.setPolicy(m == 2 ? SCHEDULE_WEIGHTED : SCHEDULE_STRICT);
+        LatencyHistogram alarms;
+        unsigned long alarmsSent = 0;
+        std::thread consumer([&] {
+            Frame* f;
+            while (queue.pop(f)) {
+                int64_t sent;
+                std::memcpy(&sent, f->payload, sizeof(sent));
+                if (f->payload[sizeof(sent)]) {
+                    alarms.add((monotonicNs() - sent) / 1000.0);
+                }
+                FramePool::put(f);
+                const int64_t until = monotonicNs() + static_cast<int64_t>(workUs * 1000);
+                while (monotonicNs() < until) {
+                }
+            }
+        });
+
+        Frame f;
+        std::memset(&f, 0, sizeof(f));
+        f.length = sizeof(int64_t) + 1;
+        const int64_t start = monotonicNs();
+        const long total = static_cast<long>(rate * seconds);
+        for (long i = 0; i < total; ++i) {
+            // Frames arrive in bursts every millisecond, like reads from a port.
+            const int64_t due = start + static_cast<int64_t>(i * 1e9 / rate) / 1000000 * 1000000;
+            int64_t now = monotonicNs();
+            if (now < due) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+                now = monotonicNs();
+            }
+            const int pick = static_cast<int>(i % 1000);
+            const bool alarm = pick == 0;
+            f.frameClass = alarm ? FRAME_ALARM : pick % 10 == 1 ? FRAME_PARAMETER
+                         : pick % 10 == 2 ? FRAME_DIAGNOSTIC : FRAME_WAVEFORM;
+            if (m == 0) {
+                f.frameClass = FRAME_PARAMETER;
+            }
+            alarmsSent += alarm ? 1 : 0;
+            std::memcpy(f.payload, &now, sizeof(now));
+            f.payload[sizeof(now)] = alarm ? 1 : 0;
+            Frame* pooled = pool.get();
+            *pooled = f;
+            pushed[f.frameClass]++;
+            queue.push(pooled);
+        }
+        queue.close();
+        consumer.join();
+
+        printf("%s: %lu alarms sent\n", names[m], alarmsSent);
+        alarms.print("alarm");
+        for (int k = 0; k < FRAME_CLASS_COUNT; ++k) {
+            const FrameClassStats st = queue.stats(k);
+            // Every frame pushed is delivered, shed, dropped or still queued, and only the dropped ones were
+            // never enqueued.
+            const bool balanced = st.enqueued == st.delivered + st.shed + st.depth;
+            ok = ok && balanced;
+            pushed[k] -= st.enqueued + st.dropped;
+            ok = ok && pushed[k] == 0;
+            if (st.enqueued > 0 || st.dropped > 0) {
+                printf("    %-10s enqueued %9lu delivered %9lu shed %9lu dropped %9lu max depth %6lu%s\n",
+                       frameClassName(k), st.enqueued, st.delivered, st.shed, st.dropped, st.maxDepth,
+                       balanced && pushed[k] == 0 ? "" : " WRONG");
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+/*
+ * latest: a writer updates every slot of a shared memory latest value table as fast as it can while
+ * readers, each with their own read-only mapping as another process would have, read random slots.
+ * Every value encodes its update so a torn read would be detected.
+ */
+static int benchLatest(int argc, char* argv[])
+{
+    int readers = 2;
+    int ports = 16;
+    long writeRate = 1000000;
+    double seconds = 2.0;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "r:p:w:t:")) != -1) {
+        switch (c) {
+        case 'r': readers = atoi(g.optarg); break;
+        case 'p': ports = atoi(g.optarg); break;
+        case 'w': writeRate = atol(g.optarg); break;
+        case 't': seconds = atof(g.optarg); break;
+        default:
+            std::cerr << "latest [-r readers] [-p ports] [-w writes/s] [-t seconds]" << std::endl;
+            return 1;
+        }
+    }
+    const std::string name = "/gnostic_bench_latest";
+    LatestValueTable table;
+    if (!table.create(name, ports)) {
+        return 1;
+    }
+    const int slots = ports * LATEST_VALUE_CHANNELS;
+    std::atomic<bool> running(true);
+    std::atomic<unsigned long> reads(0);
+    std::atomic<unsigned long> torn(0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; ++r) {
+        threads.push_back(std::thread([&, r] {
+            LatestValueTable view;
+            if (!view.attach(name)) {
+                return;
+            }
+            uint32_t x = 2463534242u + r;
+            unsigned long n = 0;
+            unsigned long bad = 0;
+            LatestValue v;
+            while (running) {
+                for (int i = 0; i < 1024; ++i) {
+                    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+                    const int s = static_cast<int>(x % slots);
+                    if (view.read(s / LATEST_VALUE_CHANNELS, s % LATEST_VALUE_CHANNELS, v)
+                            && (v.frameSeq != static_cast<uint16_t>(v.timestampUs)
+                                || v.value != static_cast<float>(v.timestampUs & 0xFFFFF))) {
+                        bad++;
+                    }
+                }
+                n += 1024;
+            }
+            reads += n;
+            torn += bad;
+        }));
+    }
+
+    const int64_t start = monotonicNs();
+    const int64_t end = start + static_cast<int64_t>(seconds * 1e9);
+    unsigned long writes = 0;
+    for (int64_t k = 1; monotonicNs() < end; ++k) {
+        // Paced in 1 ms bursts so the readers get the CPU on small machines too.
+        const int64_t due = start + static_cast<int64_t>(k * 1e9 / writeRate) / 1000000 * 1000000;
+        const int64_t now = monotonicNs();
+        if (now < due) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+        }
+        const int s = static_cast<int>(k % slots);
+        table.update(s / LATEST_VALUE_CHANNELS, s % LATEST_VALUE_CHANNELS, static_cast<float>(k & 0xFFFFF), k,
+                     static_cast<uint16_t>(k));
+        writes++;
+    }
+    running = false;
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    const double elapsed = (monotonicNs() - start) / 1e9;
+    printf("%d slots, %d readers: %.0f writes/s, %.0f reads/s, %lu torn reads\n", slots, readers,
+           writes / elapsed, reads / elapsed, torn.load());
+    shm_unlink(name.c_str());
+    return 0;
+}
+
+/*
+ * waveform: a writer exports frames of samples for a number of channels while a reader with its own
+ * read-only mapping follows all channels through the zero copy spans. Samples count up per channel, so
+ * the reader checks that it sees every sample it did not report as lost.
+ */
+static int benchWaveform(int argc, char* argv[])
+{
+    int channels = 16;
+    int frameSamples = 32;
+    long frameRate = 50000;
+    uint32_t ringSamples = 16384;
+    double seconds = 2.0;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "c:s:f:r:t:")) != -1) {
+        switch (c) {
+        case 'c': channels = atoi(g.optarg); break;
+        case 's': frameSamples = atoi(g.optarg); break;
+        case 'f': frameRate = atol(g.optarg); break;
+        case 'r': ringSamples = static_cast<uint32_t>(atol(g.optarg)); break;
+        case 't': seconds = atof(g.optarg); break;
+        default:
+            std::cerr << "waveform [-c channels] [-s samplesperframe] [-f frames/s] [-r ringsamples] [-t seconds]" << std::endl;
+            return 1;
+        }
+    }
+    const std::string name = "/gnostic_bench_waveform";
+    shm_unlink(name.c_str());
+    WaveformExport out;
+    if (!out.create(name, static_cast<uint32_t>(channels), ringSamples)) {
+        return 1;
+    }
+    std::vector<int16_t> frame(static_cast<size_t>(frameSamples));
+    // Create the channels before the reader attaches.
+    for (int ch = 0; ch < channels; ++ch) {
+        out.write(0, ch, frame.data(), 0, 0);
+    }
+
+    std::atomic<bool> running(true);
+    uint64_t read = 0;
+    uint64_t lost = 0;
+    uint64_t wrong = 0;
+    uint64_t retries = 0;
+    std::thread reader([&] {
+        WaveformReader in;
+        if (!in.attach(name)) {
+            return;
+        }
+        std::vector<uint64_t> cursors(in.channels());
+        for (uint32_t i = 0; i < cursors.size(); ++i) {
+            cursors[i] = in.head(i);
+        }
+        bool last = false;
+        while (!last) {
+            last = !running;
+            for (uint32_t i = 0; i < cursors.size(); ++i) {
+                WaveformSpan spans[2];
+                const size_t n = in.peek(i, cursors[i], spans, &lost);
+                uint64_t expect = cursors[i];
+                uint64_t bad = 0;
+                for (int s = 0; s < 2; ++s) {
+                    for (size_t k = 0; k < spans[s].count; ++k) {
+                        bad += spans[s].samples[k] != static_cast<int16_t>(expect++) ? 1 : 0;
+                    }
+                }
+                if (in.valid(i, cursors[i])) {
+                    cursors[i] += n;
+                    read += n;
+                    wrong += bad;
+                } else {
+                    retries++;
+                }
+            }
+            std::this_thread::yield();
+        }
+    });
+
+    const int64_t start = monotonicNs();
+    const int64_t end = start + static_cast<int64_t>(seconds * 1e9);
+    uint64_t written = 0;
+    std::vector<uint64_t> next(static_cast<size_t>(channels), 0);
+    for (int64_t k = 0; monotonicNs() < end; ++k) {
+        const int64_t due = start + static_cast<int64_t>(k * 1e9 / frameRate) / 1000000 * 1000000;
+        const int64_t now = monotonicNs();
+        if (now < due) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+        }
+        const int ch = static_cast<int>(k % channels);
+        for (int s = 0; s < frameSamples; ++s) {
+            frame[static_cast<size_t>(s)] = static_cast<int16_t>(next[static_cast<size_t>(ch)]++);
+        }
+        out.write(0, ch, frame.data(), frame.size(), now / 1000);
+        written += static_cast<uint64_t>(frameSamples);
+    }
+    running = false;
+    reader.join();
+    const double elapsed = (monotonicNs() - start) / 1e9;
+    printf("%d channels, ring %u: written %.0f samples/s, read %.0f samples/s, lost %llu, wrong %llu, retries %llu\n",
+           channels, out.ringSamples(), written / elapsed, read / elapsed, (unsigned long long) lost,
+           (unsigned long long) wrong, (unsigned long long) retries);
+    shm_unlink(name.c_str());
+    return 0;
+}
+
+/*
+ * stream: publishes frames to a StreamServer driven by its own epoll loop, with clients reading as fast as
+ * they can and optionally one client that never reads. Reports the aggregate throughput to the clients.
+ */
+static int benchStream(int argc, char* argv[])
+{
+    std::string endpoint = "/tmp/gnostic_bench_stream.sock";
+    int clients = 8;
+    long rate = 200000;
+    double seconds = 2.0;
+    bool stalled = false;
+    SlowClientPolicy policy = SLOW_CLIENT_DROP_OLDEST;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "e:c:r:t:zd")) != -1) {
+        switch (c) {
+        case 'e': endpoint = g.optarg; break;
+        case 'c': clients = atoi(g.optarg); break;
+        case 'r': rate = atol(g.optarg); break;
+        case 't': seconds = atof(g.optarg); break;
+        case 'z': stalled = true; break;
+        case 'd': policy = SLOW_CLIENT_DISCONNECT; break;
+        default:
+            std::cerr << "stream [-e socket|host:port] [-c clients] [-r frames/s] [-t seconds] [-z (stalled client)] [-d (disconnect policy)]" << std::endl;
+            return 1;
+        }
+    }
+
+    const int ep = epoll_create1(EPOLL_CLOEXEC);
+    StreamServer server;
+    server.setPolicy(policy);
+    server.setMaxBacklog(4096);
+    if (!server.start(endpoint, ep)) {
+        return 1;
+    }
+    std::atomic<bool> serving(true);
+    std::thread loop([&] {
+        struct epoll_event events[64];
+        while (serving) {
+            const int n = epoll_wait(ep, events, 64, 50);
+            for (int i = 0; i < n; ++i) {
+                server.handle(events[i].data.fd, events[i].events);
+            }
+        }
+    });
+
+    std::vector<int> fds;
+    for (int i = 0; i < clients + (stalled ? 1 : 0); ++i) {
+        const int fd = StreamServer::connectClient(endpoint);
+        if (fd < 0) {
+            return 1;
+        }
+        fds.push_back(fd);
+    }
+    // Let the server accept everybody before the first frame.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::atomic<bool> reading(true);
+    std::atomic<uint64_t> received(0);
+    std::thread readers([&] {
+        const int rep = epoll_create1(EPOLL_CLOEXEC);
+        for (int i = 0; i < clients; ++i) {
+            fcntl(fds[i], F_SETFL, O_NONBLOCK);
+            struct epoll_event ev;
+            std::memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.fd = fds[i];
+            epoll_ctl(rep, EPOLL_CTL_ADD, fds[i], &ev);
+        }
+        std::vector<char> buf(1 << 16);
+        struct epoll_event events[64];
+        while (reading) {
+            const int n = epoll_wait(rep, events, 64, 50);
+            for (int i = 0; i < n; ++i) {
+                ssize_t r;
+                while ((r = read(events[i].data.fd, buf.data(), buf.size())) > 0) {
+                    received += static_cast<uint64_t>(r);
+                }
+            }
+        }
+        ::close(rep);
+    });
+
+    Frame f;
+    std::memset(&f, 0, sizeof(f));
+    f.frameClass = FRAME_WAVEFORM;
+    f.length = 20;
+    const size_t messageSize = STREAM_HEADER_SIZE + FRAME_HEADER_SIZE + f.length + FRAME_CRC_SIZE;
+    const int64_t start = monotonicNs();
+    const long total = static_cast<long>(rate * seconds);
+    for (long i = 0; i < total; ++i) {
+        const int64_t due = start + static_cast<int64_t>(i * 1e9 / rate) / 1000000 * 1000000;
+        const int64_t now = monotonicNs();
+        if (now < due) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+        }
+        f.seq = static_cast<uint16_t>(i);
+        f.channel = static_cast<uint8_t>(i % 16);
+        f.timestampUs = now / 1000;
+        server.publish(f);
+    }
+    const uint64_t expected = static_cast<uint64_t>(total) * clients * messageSize;
+    const int64_t deadline = monotonicNs() + 2000000000;
+    while (received < expected && monotonicNs() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const double elapsed = (monotonicNs() - start) / 1e9;
+    reading = false;
+    readers.join();
+    serving = false;
+    loop.join();
+    const StreamStats st = server.stats();
+    printf("%s, %d clients%s: %.0f messages/s, %.1f MB/s to clients, received %.1f%%, dropped %lu, disconnected %lu\n",
+           endpoint.c_str(), clients, stalled ? " + 1 stalled" : "", received / messageSize / elapsed,
+           received / elapsed / 1e6, 100.0 * received / expected, st.dropped, st.disconnected);
+    server.stop();
+    for (size_t i = 0; i < fds.size(); ++i) {
+        ::close(fds[i]);
+    }
+    ::close(ep);
+    return 0;
+}
+
+// Deterministic test signal for the trend bench, so raw samples can be recomputed instead of stored.
+static float trendSample(int channel, int64_t t)
+{
+    const uint32_t h = static_cast<uint32_t>(t / 10000) * 2654435761u ^ static_cast<uint32_t>(channel) * 40503u;
+    return 50.0f + 20.0f * std::sin(t / 6e7 + channel) + (h % 1000) / 100.0f;
+}
+
+/*
+ * trend: rolls up hours of simulated 100 Hz parameters, then compares range queries against recomputing
+ * the same buckets from the raw samples, and restarts the engine in the middle of an hour bucket to check
+ * that the bucket is merged.
+ */
+static int benchTrend(int argc, char* argv[])
+{
+    int channels = 16;
+    double hours = 6.0;
+    std::string dir = "/tmp/gnostic_bench_trend";
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "c:h:d:")) != -1) {
+        switch (c) {
+        case 'c': channels = atoi(g.optarg); break;
+        case 'h': hours = atof(g.optarg); break;
+        case 'd': dir = g.optarg; break;
+        default:
+            std::cerr << "trend [-c channels] [-h hours] [-d dir]" << std::endl;
+            return 1;
+        }
+    }
+    if (system(("rm -rf " + dir).c_str()) != 0) {
+        return 1;
+    }
+    const int64_t periodUs = 10000;
+    const int64_t t0 = 1700000000000000LL;
+    const int64_t t1 = t0 + static_cast<int64_t>(hours * 3600e6);
+    const int64_t restart = t1 + 1800000000LL; // Half an hour more after a restart.
+
+    std::unique_ptr<TrendRollup> trends(new TrendRollup);
+    trends->setDirectory(dir);
+    int64_t start = monotonicNs();
+    unsigned long adds = 0;
+    for (int64_t t = t0; t < t1; t += periodUs) {
+        for (int ch = 0; ch < channels; ++ch) {
+            trends->add(0, ch, trendSample(ch, t), t);
+            adds++;
+        }
+    }
+    double elapsed = (monotonicNs() - start) / 1e9;
+    printf("%lu samples in %.2f s: %.1f M samples/s, %.0f ns per sample for all three resolutions\n", adds,
+           elapsed, adds / elapsed / 1e6, elapsed * 1e9 / adds);
+
+    // Restart in the middle of an hour bucket.
+    trends.reset(new TrendRollup);
+    trends->setDirectory(dir);
+    for (int64_t t = t1; t < restart; t += periodUs) {
+        for (int ch = 0; ch < channels; ++ch) {
+            trends->add(0, ch, trendSample(ch, t), t);
+        }
+    }
+
+    struct Query {
+        TrendResolution resolution;
+        int64_t fromUs;
+        int64_t toUs;
+    };
+    const Query queries[] = {
+        {TREND_1S, restart - 600000000LL, restart},        // last 10 minutes, from the ring
+        {TREND_1S, t0 + 3600000000LL, t0 + 7200000000LL},  // an hour of seconds, from the file
+        {TREND_1M, t0, restart},                           // everything by minute
+        {TREND_1H, t0, restart},                           // everything by hour, across the restart
+    };
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); ++q) {
+        const Query& qu = queries[q];
+        std::vector<TrendBucket> out;
+        const int ch = static_cast<int>(q) % channels;
+        start = monotonicNs();
+        trends->query(0, ch, qu.resolution, qu.fromUs, qu.toUs, out);
+        const double queryUs = (monotonicNs() - start) / 1e3;
+
+        // Recompute from raw samples.
+        start = monotonicNs();
+        const int64_t width = TrendRollup::widthUs(qu.resolution);
+        size_t mismatches = 0;
+        size_t buckets = 0;
+        for (int64_t b = qu.fromUs - qu.fromUs % width; b < qu.toUs; b += width) {
+            float mn = 1e30f, mx = -1e30f;
+            double sum = 0;
+            uint32_t n = 0;
+            for (int64_t t = std::max(b, t0); t < b + width && t < restart; t += periodUs) {
+                const float v = trendSample(ch, t);
+                mn = std::min(mn, v);
+                mx = std::max(mx, v);
+                sum += v;
+                n++;
+            }
+            if (n == 0 || b < qu.fromUs) {
+                continue;
+            }
+            const TrendBucket* found = nullptr;
+            for (size_t i = 0; i < out.size() && found == nullptr; ++i) {
+                found = out[i].startUs == b ? &out[i] : nullptr;
+            }
+            buckets++;
+            if (found == nullptr || found->count != n || found->min != mn || found->max != mx
+                    || std::fabs(found->mean - sum / n) > 1e-3) {
+                mismatches++;
+            }
+        }
+        const double scanUs = (monotonicNs() - start) / 1e3;
+        printf("%s query: %5zu buckets in %8.1f us (raw scan %10.1f us), %zu of %zu buckets wrong\n",
+               TrendRollup::name(qu.resolution), out.size(), queryUs, scanUs, mismatches, buckets);
+    }
+    trends.reset();
+    return system(("rm -rf " + dir).c_str()) == 0 ? 0 : 1;
+}
+
+/*
+ * resample: resampling throughput for common device rate pairs, as channels one core can keep up with,
+ * and the error of a 10 Hz sine against the ideal sine at the output timestamps, which shows that the
+ * timestamps are compensated for the filter delay.
+ */
+static int benchResample(int argc, char* argv[])
+{
+    double seconds = 2.0;
+    size_t block = 32;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "t:b:")) != -1) {
+        switch (c) {
+        case 't': seconds = atof(g.optarg); break;
+        case 'b': block = static_cast<size_t>(atoi(g.optarg)); break;
+        default:
+            std::cerr << "resample [-t seconds] [-b block]" << std::endl;
+            return 1;
+        }
+    }
+    const int pairs[][2] = {{125, 500}, {250, 500}, {300, 250}, {500, 250}};
+    for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); ++p) {
+        const int inRate = pairs[p][0];
+        const int outRate = pairs[p][1];
+        ResampleStage stage(inRate, outRate, block);
+        if (!stage.valid()) {
+            std::cerr << inRate << " -> " << outRate << ": invalid" << std::endl;
+            return 1;
+        }
+        const double amplitude = 10000.0;
+        const double hz = 10.0;
+        const int64_t t0 = 1000000;
+        std::vector<int16_t> in(block);
+        double err2 = 0.0;
+        double peak = 0.0;
+        unsigned long checked = 0;
+        unsigned long inputs = 0;
+        const int64_t start = monotonicNs();
+        int64_t now = start;
+        while (now - start < static_cast<int64_t>(seconds * 1e9)) {
+            for (int k = 0; k < 64; ++k) {
+                const int64_t tsUs = t0 + static_cast<int64_t>(inputs * 1e6 / inRate);
+                for (size_t i = 0; i < block; ++i) {
+                    const double t = (inputs + i) / static_cast<double>(inRate);
+                    in[i] = static_cast<int16_t>(lrint(amplitude * std::sin(2 * M_PI * hz * t)));
+                }
+                const size_t n = stage.process(in.data(), block, tsUs);
+                // Compare after the filter has settled, and only for the first seconds of signal.
+                if (inputs > static_cast<unsigned long>(inRate) && inputs < static_cast<unsigned long>(inRate) * 10) {
+                    for (size_t i = 0; i < n; ++i) {
+                        const double t = (stage.outputTimeUs() - t0) / 1e6 + static_cast<double>(i) / outRate;
+                        const double e = stage.output()[i] - amplitude * std::sin(2 * M_PI * hz * t);
+                        err2 += e * e;
+                        peak = std::max(peak, std::fabs(e));
+                        checked++;
+                    }
+                }
+                inputs += block;
+            }
+            now = monotonicNs();
+        }
+        const double elapsed = (now - start) / 1e9;
+        const double rate = inputs / elapsed;
+        printf("%3d -> %3d Hz (L/M %d/%d, delay %5.1f ms): %6.2f M samples/s in, %6.0f channels per core, "
+               "sine error rms %.2f%% peak %.2f%%\n", inRate, outRate, stage.resampler().upFactor(),
+               stage.resampler().downFactor(), stage.resampler().delayUs() / 1e3, rate / 1e6, rate / inRate,
+               100.0 * std::sqrt(err2 / std::max(checked, 1UL)) / amplitude, 100.0 * peak / amplitude);
+    }
+    return 0;
+}
+
+static const char* qualityName(uint8_t flags)
+{
+    static char text[64];
+    snprintf(text, sizeof(text), "%s%s%s%s%s", flags == 0 ? "good " : "", flags & SQ_FLATLINE ? "flatline " : "",
+             flags & SQ_SATURATED ? "saturated " : "", flags & SQ_NOISY ? "noisy " : "",
+             flags & SQ_LEAD_OFF ? "lead-off " : "");
+    return text;
+}
+
+/*
+ * quality: signal quality estimator throughput, and the flags it gives for synthetic 250 Hz signals, read
+ * back through a waveform export the way a consumer would see them.
+ */
+static int benchQuality(int argc, char* argv[])
+{
+    double seconds = 2.0;
+    std::string name = "gnostic_bench_quality";
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "t:n:")) != -1) {
+        switch (c) {
+        case 't': seconds = atof(g.optarg); break;
+        case 'n': name = g.optarg; break;
+        default:
+            std::cerr << "quality [-t seconds] [-n shmname]" << std::endl;
+            return 1;
+        }
+    }
+    const size_t block = 32;
+    const int rate = 250;
+    std::vector<int16_t> in(rate * 4);
+    uint32_t noise = 1;
+    const auto random = [&noise]() { noise = noise * 1103515245u + 12345u; return static_cast<int>(noise >> 16 & 0x7FFF) - 16384; };
+
+    // Throughput on a clean signal.
+    for (size_t i = 0; i < in.size(); ++i) {
+        in[i] = static_cast<int16_t>(8000 * std::sin(2 * M_PI * 1.2 * i / rate));
+    }
+    SignalQualityEstimator sq;
+    unsigned long samples = 0;
+    const int64_t start = monotonicNs();
+    int64_t now = start;
+    while (now - start < static_cast<int64_t>(seconds * 1e9)) {
+        for (size_t i = 0; i + block <= in.size(); i += block) {
+            sq.process(&in[i], block);
+            samples += block;
+        }
+        now = monotonicNs();
+    }
+    const double rateIn = samples / ((now - start) / 1e9);
+    printf("%.1f M samples/s, %.0f channels per core at %d Hz\n", rateIn / 1e6, rateIn / rate, rate);
+
+    WaveformExport exporter;
+    WaveformReader reader;
+    if (!exporter.create(name, 8, 4096) || !reader.attach(name)) {
+        return 1;
+    }
+    const char* signals[] = {"clean", "flat", "clipped", "noisy", "lead-off", "clean+dither"};
+    const size_t signalCount = sizeof(signals) / sizeof(signals[0]);
+    for (size_t k = 0; k < signalCount; ++k) {
+        for (size_t i = 0; i < in.size(); ++i) {
+            const double x = 8000 * std::sin(2 * M_PI * 1.2 * i / rate) + 3000 * std::sin(2 * M_PI * 17.0 * i / rate);
+            double v = x;
+            switch (k) {
+            case 1: v = 120 + random() % 3; break;
+            case 2: v = std::max(-32767.0, std::min(32767.0, 5 * x)); break;
+            case 3: v = x + random() / 4; break;
+            case 4: v = 32767; break;
+            case 5: v = x + random() % 4; break;
+            }
+            in[i] = static_cast<int16_t>(v);
+        }
+        SignalQualityEstimator estimator;
+        for (size_t i = 0; i + block <= in.size(); i += block) {
+            const uint8_t q = estimator.process(&in[i], block);
+            exporter.write(0, static_cast<int>(k), &in[i], block, static_cast<int64_t>(i) * 4000, q);
+        }
+        // What a consumer sees: the flags of the samples in the second half, after the window filled.
+        const int index = reader.find(0, static_cast<int>(k));
+        uint64_t cursor = reader.head(static_cast<uint32_t>(index)) - in.size() / 2;
+        WaveformSpan spans[2];
+        const size_t n = reader.peek(static_cast<uint32_t>(index), cursor, spans);
+        uint8_t flags = 0xFF;
+        size_t same = 0;
+        for (size_t s = 0; s < 2; ++s) {
+            for (size_t i = 0; i < spans[s].count; ++i) {
+                flags = flags == 0xFF ? spans[s].quality[i] : flags;
+                same += spans[s].quality[i] == flags ? 1 : 0;
+            }
+        }
+        printf("%-12s %-20s on %zu of %zu samples, noise ratio %.2f\n", signals[k], qualityName(flags), same, n,
+               estimator.noiseRatio());
+    }
+    return shm_unlink(("/" + name).c_str()) == 0 ? 0 : 1;
+}
+
+// Textbook iterative radix-2 FFT with a twiddle table, the reference for the spectrum bench.
+static void referenceFft(std::vector<double>& re, std::vector<double>& im)
+{
+    const size_t n = re.size();
+    for (size_t i = 1, j = 0; i < n; ++i) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+    static std::vector<double> wr, wi;
+    if (wr.size() != n / 2) {
+        wr.resize(n / 2);
+        wi.resize(n / 2);
+        for (size_t k = 0; k < n / 2; ++k) {
+            wr[k] = std::cos(-2 * M_PI * k / n);
+            wi[k] = std::sin(-2 * M_PI * k / n);
+        }
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        for (size_t i = 0; i < n; i += len) {
+            for (size_t k = 0; k < len / 2; ++k) {
+                const double cr = wr[k * (n / len)], ci = wi[k * (n / len)];
+                const double ur = re[i + k], ui = im[i + k];
+                const double vr = re[i + k + len / 2] * cr - im[i + k + len / 2] * ci;
+                const double vi = re[i + k + len / 2] * ci + im[i + k + len / 2] * cr;
+                re[i + k] = ur + vr;
+                im[i + k] = ui + vi;
+                re[i + k + len / 2] = ur - vr;
+                im[i + k + len / 2] = ui - vi;
+            }
+        }
+    }
+}
+
+/*
+ * spectrum: FFT accuracy and speed against a textbook radix-2 FFT, then the analyzer on 500 Hz channels
+ * with a 5 Hz signal, 50 Hz mains and noise: windows per second and the band powers it reports.
+ */
+static int benchSpectrum(int argc, char* argv[])
+{
+    int channels = 16;
+    double seconds = 2.0;
+    SpectrumConfig config;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "c:t:n:h:w:")) != -1) {
+        switch (c) {
+        case 'c': channels = atoi(g.optarg); break;
+        case 't': seconds = atof(g.optarg); break;
+        case 'n': config.fftSize = static_cast<size_t>(atoi(g.optarg)); break;
+        case 'h': config.hop = static_cast<size_t>(atoi(g.optarg)); break;
+        case 'w': config.workers = atoi(g.optarg); break;
+        default:
+            std::cerr << "spectrum [-c channels] [-t seconds] [-n fftsize] [-h hop] [-w workers]" << std::endl;
+            return 1;
+        }
+    }
+    for (size_t n = 64; n <= 4096; n *= 4) {
+        Fft fft(n);
+        std::vector<float> re(n), im(n);
+        std::vector<double> rr(n), ri(n);
+        for (size_t i = 0; i < n; ++i) {
+            rr[i] = re[i] = static_cast<float>(rand() % 20000 - 10000);
+            ri[i] = im[i] = 0.0f;
+        }
+        fft.forward(re.data(), im.data());
+        referenceFft(rr, ri);
+        double err = 0.0, peak = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            err = std::max(err, std::hypot(re[i] - rr[i], im[i] - ri[i]));
+            peak = std::max(peak, std::hypot(rr[i], ri[i]));
+        }
+        const int rounds = static_cast<int>(2000000 / n);
+        int64_t start = monotonicNs();
+        for (int r = 0; r < rounds; ++r) {
+            fft.forward(re.data(), im.data());
+        }
+        const double fastUs = (monotonicNs() - start) / 1e3 / rounds;
+        start = monotonicNs();
+        for (int r = 0; r < rounds / 10 + 1; ++r) {
+            referenceFft(rr, ri);
+        }
+        const double refUs = (monotonicNs() - start) / 1e3 / (rounds / 10 + 1);
+        printf("fft %4zu: %7.1f us (textbook radix-2 %7.1f us), relative error %.1e\n", n, fastUs, refUs, err / peak);
+    }
+
+    SpectrumAnalyzer analyzer;
+    if (!analyzer.setConfig(config)) {
+        return 1;
+    }
+    const double rate = 500.0;
+    for (int ch = 0; ch < channels; ++ch) {
+        analyzer.addChannel(0, ch, rate);
+    }
+    if (!analyzer.start()) {
+        return 1;
+    }
+    const size_t block = 32;
+    std::vector<int16_t> samples(static_cast<size_t>(rate) * 4);
+    uint32_t noise = 1;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        noise = noise * 1103515245u + 12345u;
+        samples[i] = static_cast<int16_t>(8000 * std::sin(2 * M_PI * 5.0 * i / rate) + 500 * std::sin(2 * M_PI * 50.0 * i / rate)
+                                          + static_cast<int>(noise >> 16 & 0xFF) - 128);
+    }
+    unsigned long pushed = 0;
+    size_t pos = 0;
+    int64_t ts = 0;
+    const int64_t start = monotonicNs();
+    int64_t now = start;
+    while (now - start < static_cast<int64_t>(seconds * 1e9)) {
+        for (int ch = 0; ch < channels; ++ch) {
+            analyzer.push(0, ch, &samples[pos], block, ts);
+        }
+        pushed += block * channels;
+        pos = (pos + block) % samples.size();
+        ts += static_cast<int64_t>(block * 1e6 / rate);
+        if (pushed % (block * channels * 64) == 0) {
+            now = monotonicNs();
+        }
+    }
+    analyzer.stop();
+    const double elapsed = (monotonicNs() - start) / 1e9;
+    const SpectrumStats st = analyzer.stats();
+    printf("%d channels, fft %zu hop %zu, %d workers: %.0f windows/s analyzed, %lu skipped, %.0f channels per core "
+           "at %.0f Hz\n", channels, config.fftSize, config.hop, config.workers, st.windows / elapsed, st.skipped,
+           st.windows / elapsed * config.hop / rate / config.workers, rate);
+    std::vector<SpectrumResult> results;
+    analyzer.collect(results);
+    if (!results.empty()) {
+        const std::vector<SpectrumBand>& bands = analyzer.bands();
+        printf("channel %d band powers:", results[0].channel);
+        for (size_t b = 0; b < bands.size(); ++b) {
+            printf(" %s %.4g", bands[b].name.c_str(), results[0].bandPower[b]);
+        }
+        printf(" (expected signal %.4g, mains50 %.4g, noise %.4g over all bands)\n", 8000.0 * 8000 / 2,
+               500.0 * 500 / 2, 256.0 * 256 / 12);
+    }
+    return 0;
+}
+
+// Synthetic ECG: P, Q, R, S and T waves as Gaussians around each R peak, amplitude modulated, with baseline
+// wander, 50 Hz mains and white noise. The R peak sample indices are returned in peaks.
+static void syntheticEcg(double rate, double seconds, double noise, std::vector<int16_t>& out, std::vector<uint64_t>& peaks)
+{
+    struct Wave { double offsetS, amplitude, widthS; };
+    const Wave waves[] = {{-0.20, 0.15, 0.025}, {-0.03, -0.10, 0.010}, {0.0, 1.0, 0.010}, {0.03, -0.25, 0.010},
+                          {0.25, 0.30, 0.050}};
+    const size_t n = static_cast<size_t>(rate * seconds);
+    std::vector<double> x(n, 0.0);
+    uint32_t seed = 12345;
+    const auto uniform = [&seed]() { seed = seed * 1103515245u + 12345u; return (seed >> 8 & 0xFFFF) / 65536.0; };
+    peaks.clear();
+    for (double t = 0.5; t < seconds - 0.5;) {
+        const uint64_t r = static_cast<uint64_t>(t * rate + 0.5);
+        peaks.push_back(r);
+        // Respiration modulates the amplitude, and every 25th beat is half size.
+        const double scale = (peaks.size() % 25 == 0 ? 0.5 : 1.0) * (0.8 + 0.2 * std::sin(2 * M_PI * 0.25 * t));
+        for (size_t w = 0; w < sizeof(waves) / sizeof(waves[0]); ++w) {
+            const double center = r / rate + waves[w].offsetS;
+            const int64_t first = std::max<int64_t>(0, static_cast<int64_t>((center - 4 * waves[w].widthS) * rate));
+            const int64_t last = std::min<int64_t>(static_cast<int64_t>(n) - 1, static_cast<int64_t>((center + 4 * waves[w].widthS) * rate));
+            for (int64_t i = first; i <= last; ++i) {
+                const double d = (i / rate - center) / waves[w].widthS;
+                x[static_cast<size_t>(i)] += 1000.0 * scale * waves[w].amplitude * std::exp(-0.5 * d * d);
+            }
+        }
+        // Heart rate drifting between 50 and 130 bpm, with beat to beat variation.
+        const double hr = 90 + 40 * std::sin(2 * M_PI * t / 60.0);
+        t += 60.0 / hr * (0.95 + 0.1 * uniform());
+    }
+    out.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        const double t = i / rate;
+        const double v = x[i] + 300 * std::sin(2 * M_PI * 0.3 * t) + 50 * std::sin(2 * M_PI * 50.0 * t)
+                         + noise * (uniform() + uniform() + uniform() - 1.5) * 2;
+        out[i] = static_cast<int16_t>(std::max(-32768.0, std::min(32767.0, v)));
+    }
+}
+
+/*
+ * beat: QRS detection on a synthetic ECG, or on a recorded one (raw little endian int16 samples and a text
+ * file of R peak sample indices). Reports sensitivity, positive predictivity, R peak timing error,
+ * detection latency from the R peak to the detection, and throughput in channels per core.
+ */
+static int benchBeat(int argc, char* argv[])
+{
+    double rate = 0.0;
+    double seconds = 600.0;
+    std::string file;
+    std::string annotations;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "r:t:f:a:")) != -1) {
+        switch (c) {
+        case 'r': rate = atof(g.optarg); break;
+        case 't': seconds = atof(g.optarg); break;
+        case 'f': file = g.optarg; break;
+        case 'a': annotations = g.optarg; break;
+        default:
+            std::cerr << "beat [-r rate] [-t seconds] [-f samples.raw -a rpeaks.txt -r rate]" << std::endl;
+            return 1;
+        }
+    }
+    struct Record { std::string name; double rate; std::vector<int16_t> samples; std::vector<uint64_t> peaks; };
+    std::vector<Record> records;
+    if (!file.empty()) {
+        Record r;
+        r.name = file;
+        r.rate = rate > 0.0 ? rate : 360.0;
+        FILE* f = fopen(file.c_str(), "rb");
+        FILE* a = fopen(annotations.c_str(), "r");
+        if (f == nullptr || a == nullptr) {
+            std::cerr << "beat: cannot open " << (f == nullptr ? file : annotations) << std::endl;
+            return 1;
+        }
+        int16_t buf[4096];
+        size_t got;
+        while ((got = fread(buf, sizeof(int16_t), 4096, f)) > 0) {
+            r.samples.insert(r.samples.end(), buf, buf + got);
+        }
+        unsigned long long peak;
+        while (fscanf(a, "%llu", &peak) == 1) {
+            r.peaks.push_back(peak);
+        }
+        fclose(f);
+        fclose(a);
+        records.push_back(r);
+    } else {
+        const double rates[] = {250.0, 500.0};
+        const double noises[] = {20.0, 150.0};
+        for (size_t i = 0; i < 2; ++i) {
+            for (size_t k = 0; k < 2; ++k) {
+                Record r;
+                char name[64];
+                snprintf(name, sizeof(name), "synthetic %.0f Hz noise %.0f", rates[i], noises[k]);
+                r.name = name;
+                r.rate = rate > 0.0 ? rate : rates[i];
+                syntheticEcg(r.rate, seconds, noises[k], r.samples, r.peaks);
+                records.push_back(r);
+            }
+        }
+    }
+
+    const size_t frame = 32;
+    for (size_t ri = 0; ri < records.size(); ++ri) {
+        const Record& r = records[ri];
+        BeatDetector detector(r.rate);
+        std::vector<Beat> beats;
+        beats.reserve(r.peaks.size() * 2);
+        const int64_t start = monotonicNs();
+        for (size_t i = 0; i < r.samples.size(); i += frame) {
+            detector.process(&r.samples[i], std::min(frame, r.samples.size() - i),
+                             static_cast<int64_t>(i * 1e6 / r.rate), beats);
+        }
+        const double elapsed = (monotonicNs() - start) / 1e9;
+
+        // Match beats to peaks within 75 ms, after the learning phase.
+        const uint64_t skip = static_cast<uint64_t>(2.5 * r.rate);
+        const uint64_t tolerance = static_cast<uint64_t>(0.075 * r.rate);
+        size_t tp = 0, fn = 0, fp = 0, searchBack = 0;
+        std::vector<double> errorsMs, latencyMs;
+        size_t b = 0;
+        std::vector<bool> used(beats.size(), false);
+        for (size_t p = 0; p < r.peaks.size(); ++p) {
+            const uint64_t peak = r.peaks[p];
+            if (peak < skip) {
+                continue;
+            }
+            while (b < beats.size() && beats[b].sample + tolerance < peak) {
+                b++;
+            }
+            if (b < beats.size() && beats[b].sample <= peak + tolerance) {
+                tp++;
+                used[b] = true;
+                errorsMs.push_back((static_cast<double>(beats[b].sample) - peak) * 1000.0 / r.rate);
+                latencyMs.push_back((static_cast<double>(beats[b].detectedAt) - peak) * 1000.0 / r.rate);
+                searchBack += beats[b].searchBack ? 1 : 0;
+                b++;
+            } else {
+                fn++;
+            }
+        }
+        for (size_t k = 0; k < beats.size(); ++k) {
+            fp += !used[k] && beats[k].sample >= skip ? 1 : 0;
+        }
+        std::sort(latencyMs.begin(), latencyMs.end());
+        double meanError = 0.0, maxError = 0.0;
+        for (size_t k = 0; k < errorsMs.size(); ++k) {
+            meanError += errorsMs[k];
+            maxError = std::max(maxError, std::fabs(errorsMs[k]));
+        }
+        meanError /= std::max<size_t>(1, errorsMs.size());
+        const auto pct = [&latencyMs](double q) { return latencyMs.empty() ? 0.0 : latencyMs[static_cast<size_t>(q * (latencyMs.size() - 1))]; };
+        printf("%s: %zu beats, Se %.2f%% +P %.2f%% (%zu missed, %zu false, %zu by search back)\n", r.name.c_str(),
+               r.peaks.size(), 100.0 * tp / std::max<size_t>(1, tp + fn), 100.0 * tp / std::max<size_t>(1, tp + fp), fn,
+               fp, searchBack);
+        printf("    R timing error mean %+.1f ms max %.1f ms, detection latency p50 %.0f p99 %.0f max %.0f ms, "
+               "%.1f M samples/s = %.0f channels per core\n", meanError, maxError, pct(0.5), pct(0.99), pct(1.0),
+               r.samples.size() / elapsed / 1e6, r.samples.size() / elapsed / r.rate);
+    }
+    return 0;
+}
+
+/*
+ * pool: decoded frames taken by a reader thread, handed to a dispatcher thread through a lock-free ring and
+ * returned there, as in the driver. 'new' allocates every frame with new and deletes it in the dispatcher,
+ * 'pool' takes it from a FramePool and returns it with put(), a remote free. Also run with both ends in one
+ * thread, where the default allocator has its per-thread cache.
+ */
+static int benchPool(int argc, char* argv[])
+{
+    long frames = 5000000;
+    size_t inFlight = 1024;
+    size_t capacity = 4096;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "n:d:c:")) != -1) {
+        switch (c) {
+        case 'n': frames = atol(g.optarg); break;
+        case 'd': inFlight = static_cast<size_t>(atol(g.optarg)); break;
+        case 'c': capacity = static_cast<size_t>(atol(g.optarg)); break;
+        default:
+            std::cerr << "pool [-n frames] [-d frames in flight] [-c pool capacity]" << std::endl;
+            return 1;
+        }
+    }
+    size_t ringSize = 1;
+    while (ringSize < inFlight) {
+        ringSize <<= 1;
+    }
+
+    uint8_t payload[64];
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+    for (int threaded = 0; threaded < 2; ++threaded) {
+        for (int pooled = 0; pooled < 2; ++pooled) {
+            FramePool pool(capacity);
+            std::vector<Frame*> ring(ringSize);
+            std::atomic<size_t> head(0);    // Next frame the dispatcher takes.
+            std::atomic<size_t> tail(0);    // Next slot the reader fills.
+            unsigned long checksum = 0;
+            const auto release = [&](Frame* f) {
+                checksum += f->seq + f->payload[f->length - 1];
+                if (pooled) {
+                    FramePool::put(f);
+                } else {
+                    delete f;
+                }
+            };
+            const auto dispatcher = [&] {
+                size_t h = head.load(std::memory_order_relaxed);
+                for (long n = 0; n < frames; ++n, ++h) {
+                    while (h == tail.load(std::memory_order_acquire)) {
+                        std::this_thread::yield();
+                    }
+                    release(ring[h & (ringSize - 1)]);
+                    head.store(h + 1, std::memory_order_release);
+                }
+            };
+
+            const int64_t start = monotonicNs();
+            std::thread consumer;
+            if (threaded) {
+                consumer = std::thread(dispatcher);
+            }
+            size_t t = 0;
+            for (long n = 0; n < frames; ++n, ++t) {
+                if (t - head.load(std::memory_order_acquire) >= inFlight) {
+                    if (!threaded) {
+                        // Deliver the whole batch, like a dispatcher that woke up.
+                        for (size_t h = head.load(std::memory_order_relaxed); h < t; ++h) {
+                            release(ring[h & (ringSize - 1)]);
+                        }
+                        head.store(t, std::memory_order_release);
+                    }
+                    while (t - head.load(std::memory_order_acquire) >= inFlight) {
+                        std::this_thread::yield();
+                    }
+                }
+                Frame* f = pooled ? pool.get() : new Frame;
+                f->port = 0;
+                f->frameClass = FRAME_WAVEFORM;
+                f->channel = 0;
+                f->seq = static_cast<uint16_t>(n);
+                f->deviceTime = static_cast<uint32_t>(n);
+                f->timestampUs = n;
+                f->length = sizeof(payload);
+                std::memcpy(f->payload, payload, sizeof(payload));
+                ring[t & (ringSize - 1)] = f;
+                tail.store(t + 1, std::memory_order_release);
+            }
+            if (threaded) {
+                consumer.join();
+            } else {
+                for (size_t h = head.load(std::memory_order_relaxed); h < t; ++h) {
+                    release(ring[h & (ringSize - 1)]);
+                }
+            }
+            const double elapsed = (monotonicNs() - start) / 1e9;
+            const FramePoolStats st = pool.stats();
+            printf("%-4s %-12s %6.1f ns/frame, %5.2f M frames/s", pooled ? "pool" : "new",
+                   threaded ? "two threads" : "one thread", elapsed * 1e9 / frames, frames / elapsed / 1e6);
+            if (pooled) {
+                printf(", %lu from the heap, %lu refills", st.heap, st.refills);
+            }
+            printf(" (checksum %lu)\n", checksum);
+        }
+    }
+    return 0;
+}
+
+/*
+ * memory: random dependent reads, one per cache line, over a large buffer from std::vector and from
+ * allocateBuffer(), which uses huge pages when it can. The difference is mostly TLB misses. Also prints
+ * where allocateBuffer() placed its buffer, to check the fallbacks on machines without huge pages or NUMA.
+ */
+static int benchMemory(int argc, char* argv[])
+{
+    size_t megabytes = 256;
+    long reads = 20000000;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "m:n:")) != -1) {
+        switch (c) {
+        case 'm': megabytes = static_cast<size_t>(atol(g.optarg)); break;
+        case 'n': reads = atol(g.optarg); break;
+        default:
+            std::cerr << "memory [-m megabytes] [-n reads]" << std::endl;
+            return 1;
+        }
+    }
+    const size_t bytes = megabytes * 1024 * 1024;
+    const size_t lines = bytes / 64;
+    if (lines < 2) {
+        std::cerr << "memory: buffer too small" << std::endl;
+        return 1;
+    }
+    printf("%d NUMA nodes, huge pages of %zu kB, on node %d\n", numaNodes(), hugePageSize() / 1024, currentNode());
+
+    for (int placed = 0; placed < 2; ++placed) {
+        std::vector<uint64_t> vec;
+        uint64_t* buffer;
+        if (placed) {
+            buffer = static_cast<uint64_t*>(allocateBuffer(bytes, "bench buffer"));
+        } else {
+            vec.resize(bytes / sizeof(uint64_t));
+            buffer = vec.data();
+        }
+        // One cycle through all lines in random order (Sattolo), the same for both buffers.
+        std::vector<uint32_t> order(lines);
+        for (size_t i = 0; i < lines; ++i) {
+            order[i] = static_cast<uint32_t>(i);
+        }
+        srand(1);
+        for (size_t i = lines - 1; i > 0; --i) {
+            const size_t j = (static_cast<size_t>(rand()) << 16 ^ rand()) % i;
+            std::swap(order[i], order[j]);
+        }
+        for (size_t i = 0; i < lines; ++i) {
+            buffer[static_cast<size_t>(order[i]) * 8] = static_cast<uint64_t>(order[(i + 1) % lines]) * 8;
+        }
+
+        uint64_t at = 0;
+        const int64_t start = monotonicNs();
+        for (long n = 0; n < reads; ++n) {
+            at = buffer[at];
+        }
+        const double elapsed = (monotonicNs() - start) / 1e9;
+        printf("%-14s %6.1f ns/read (end %lu)\n", placed ? "allocateBuffer" : "std::vector", elapsed * 1e9 / reads,
+               static_cast<unsigned long>(at));
+        if (placed) {
+            const std::vector<BufferPlacement> buffers = placements();
+            for (size_t i = 0; i < buffers.size(); ++i) {
+                const BufferPlacement& b = buffers[i];
+                printf("    %s: %zu kB, %s pages (%zu kB huge), node %d, pages on node %s\n", b.name.c_str(),
+                       b.bytes / 1024, pageKindName(b.pages), b.hugeBytes / 1024, b.node, b.nodes.c_str());
+            }
+            freeBuffer(buffer);
+        }
+    }
+    return 0;
+}
+
+/*
+ * trace: TRACE_PRINT in traced scopes and in scopes suppressed by "maxDepth" and by "suppressBelow", with the
+ * output of Trace captured. Prints the cost per call and fails if a suppressed scope printed a line.
+ */
+static void traceLeaf(int i)
+{
+    TRACE();
+    TRACE_PRINT("bench", ("leaf %d", i));
+}
+
+static void traceMiddle(int i)
+{
+    TRACE();
+    traceLeaf(i);
+}
+
+static void traceQuiet(int i)
+{
+    TRACE();
+    TRACE_PRINT("bench", ("quiet %d", i));
+    traceLeaf(i);
+}
+
+static size_t countLines(const std::string& text, const std::string& word)
+{
+    size_t n = 0;
+    for (size_t at = text.find(word); at != std::string::npos; at = text.find(word, at + word.size())) {
+        n++;
+    }
+    return n;
+}
+
+static int benchTrace(int argc, char* argv[])
+{
+    int calls = 100000;
+    GetOpt g;
+    char c;
+    while ((c = g.getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+        case 'n': calls = atoi(g.optarg); break;
+        default:
+            std::cerr << "trace [-n calls]" << std::endl;
+            return 1;
+        }
+    }
+    // The context writes to std::cout as it is when the context is created. Static, the context outlives this call.
+    static std::stringstream captured;
+    std::streambuf* const out = std::cout.rdbuf(captured.rdbuf());
+    TRACE_CREATE_CONTEXT("bench", "p");
+    std::cout.rdbuf(out);
+
+    struct Case {
+        const char* name;
+        int maxDepth;
+        const char* suppressBelow;
+        void (*func)(int);
+        size_t leafLines;
+        size_t quietLines;
+    };
+    // The scope of this function is at depth 1, traceMiddle at 2 and traceLeaf at 3.
+    const Case cases[] = {
+        {"unlimited", 0, "", traceMiddle, static_cast<size_t>(calls), 0},
+        {"maxDepth 2", 2, "", traceMiddle, 0, 0},
+        {"suppressBelow", 0, "traceQuiet", traceQuiet, 0, static_cast<size_t>(calls)},
+    };
+    TRACE();
+    bool ok = true;
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); ++k) {
+        const Case& cs = cases[k];
+        Trace::setMaxDepth(cs.maxDepth);
+        Trace::setSuppressBelow(*cs.suppressBelow ? std::vector<std::string>(1, cs.suppressBelow)
+                                                  : std::vector<std::string>());
+        captured.str("");
+        const int64_t start = monotonicNs();
+        for (int i = 0; i < calls; ++i) {
+            cs.func(i);
+        }
+        const double ns = static_cast<double>(monotonicNs() - start) / calls;
+        const std::string text = captured.str();
+        const size_t leaf = countLines(text, " leaf ");
+        const size_t quiet = countLines(text, " quiet ");
+        const bool passed = leaf == cs.leafLines && quiet == cs.quietLines;
+        printf("%-14s %7.1f ns/call, %zu leaf lines (expected %zu), %zu quiet lines (expected %zu)%s\n", cs.name, ns,
+               leaf, cs.leafLines, quiet, cs.quietLines, passed ? "" : " WRONG");
+        ok = ok && passed;
+    }
+    Trace::setMaxDepth(0);
+    Trace::setSuppressBelow(std::vector<std::string>());
+    return ok ? 0 : 1;
+}
+
+typedef int (*BenchFunc)(int argc, char* argv[]);
+
+int main(int argc, char* argv[])
+{
+    std::map<std::string, BenchFunc> benches;
+    benches["latency"] = benchLatency;
+    benches["modbus"] = benchModbus;
+    benches["modbus-sim"] = benchModbusSim;
+    benches["priority"] = benchPriority;
+    benches["latest"] = benchLatest;
+    benches["waveform"] = benchWaveform;
+    benches["stream"] = benchStream;
+    benches["trend"] = benchTrend;
+    benches["resample"] = benchResample;
+    benches["quality"] = benchQuality;
+    benches["spectrum"] = benchSpectrum;
+    benches["beat"] = benchBeat;
+    benches["pool"] = benchPool;
+    benches["memory"] = benchMemory;
+    benches["trace"] = benchTrace;
+
+    if (argc < 2 || benches.find(argv[1]) == benches.end()) {
+        std::cerr << "Usage: " << argv[0] << " <benchmark> [options]" << std::endl << "Benchmarks:" << std::endl;
+        for (std::map<std::string, BenchFunc>::const_iterator it = benches.begin(); it != benches.end(); ++it) {
+            std::cerr << "  " << it->first << std::endl;
+        }
+        return 1;
+    }
+    return benches[argv[1]](argc - 1, argv + 1);
+}
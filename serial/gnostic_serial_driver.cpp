@@ -1,28 +1,36 @@
 #include "Trace.hpp"
 #include "GetOpt.hpp"
+#include "SerialDriver.hpp"
 
+#include <cstdlib>
 #include <iostream>
 
+#include <boost/algorithm/string.hpp>
 
-void test2()
+static void usage(const char* prog)
 {
-	TRACE();
-	TRACE_PRINT("", ("Hej babberiba!"));
-}
-
-void test3()
-{
-	TRACE();
-	test2();
-}
-
-void test1()
-{
-	TRACE();
-	int a=3;
-	TRACE_CHECK(a == 3);
-	TRACE_COMPARE(a,3);
-	test3();
+    std::cerr << "Usage: " << prog << " [-# traceopts] [-f traceconfig] [-s snapshotfile] [-i snapshotinterval] [-u socket] [-H socket] [-b cpu] [-w idleus] [-q strict|weighted[:p,w,d]] [-Q capacity] [-L name] [-W name[:channels[:samples]]] [-S socket|host:port] [-O drop|disconnect[:backlog]] [-T trenddir] [-X port:channel:inrate:outrate] [-F port:channel:rate ...] [-E fftsize[:hop[:intervalms[:workers]]]] [-B port:channel:rate ...] -p device[:baud] ... -P device[:baud] ... [-M device:baud[:parity] -R slave:start:count[:function] ...]" << std::endl
+              << "  -p  Serial device, may be repeated. Baud rate 0 or none means autodetect." << std::endl
+              << "  -P  High priority serial device, read by a busy polling thread." << std::endl
+              << "  -b  Core to pin the busy polling thread to." << std::endl
+              << "  -w  Microseconds without data before busy polling falls back to epoll (default 1000)." << std::endl
+              << "  -q  Scheduling of parameter, waveform and diagnostic frames after alarms, weights default 8,4,1." << std::endl
+              << "  -Q  Frames queued before low priority classes are shed (default 4096)." << std::endl
+              << "  -L  Publish the latest parameter values in shared memory /dev/shm/name." << std::endl
+              << "  -W  Export waveforms in shared memory /dev/shm/name, default 64 channels of 16384 samples." << std::endl
+              << "  -S  Stream frames to local clients on a UNIX socket path or loopback host:port." << std::endl
+              << "  -O  Slow stream clients lose their oldest frames (default) or are disconnected, backlog default 4096." << std::endl
+              << "  -T  Persist 1s/1m/1h parameter trends in this directory." << std::endl
+              << "  -X  Also export a waveform channel resampled to outrate, as port 1000 + port (needs -W)." << std::endl
+              << "  -F  Band powers of a waveform channel, published as port 2000 + port diagnostic frames." << std::endl
+              << "  -E  Spectrum FFT size, hop, publish interval and worker threads (default 512:128:1000:1)." << std::endl
+              << "  -B  Detect beats on an ECG channel, heart rate as parameter port 3000 + port." << std::endl
+              << "  -s  Device state snapshot, restored at start and written at exit." << std::endl
+              << "  -i  Seconds between periodic snapshots (default 10, 0 disables)." << std::endl
+              << "  -u  Accept port handover requests from a new driver on this UNIX socket." << std::endl
+              << "  -H  Take over the ports of the driver listening on this UNIX socket." << std::endl
+              << "  -M  Modbus RTU bus, parity N, E (default) or O." << std::endl
+              << "  -R  Registers to poll on the last -M bus, function 3 (default) or 4." << std::endl;
 }
 
 int main(int argc, char* argv[])
@@ -31,7 +39,29 @@ int main(int argc, char* argv[])
     std::string opt;
     GetOpt g;
     std::string configFile;
-    while ((c = g.getopt(argc, argv, "#:f:")) != -1)
+    std::vector<std::string> ports;
+    std::vector<std::string> busyPorts;
+    int busyPollCpu = -1;
+    long busyPollIdleUs = 1000;
+    std::string snapshotFile;
+    int snapshotInterval = 10;
+    std::vector<std::unique_ptr<ModbusMaster> > modbusBuses;
+    std::string handoverSocket;
+    std::string takeOverSocket;
+    SchedulePolicy schedule = SCHEDULE_STRICT;
+    unsigned weights[FRAME_CLASS_COUNT] = {1, 8, 4, 1};
+    size_t queueCapacity = 4096;
+    std::string latestValueName;
+    std::vector<std::string> waveformExport;
+    std::string streamEndpoint;
+    SlowClientPolicy slowClientPolicy = SLOW_CLIENT_DROP_OLDEST;
+    size_t streamBacklog = 4096;
+    std::string trendDir;
+    std::vector<std::string> resamplers;
+    std::vector<std::string> spectra;
+    std::string spectrumConfig;
+    std::vector<std::string> beatChannels;
+    while ((c = g.getopt(argc, argv, "#:f:p:P:s:i:u:H:b:w:q:Q:L:W:S:O:T:X:F:E:B:M:R:")) != -1)
     {        
         switch (c)
         {
@@ -41,6 +71,111 @@ int main(int argc, char* argv[])
         case 'f':
         	TRACE_READ_CONFIG_FILE("example", g.optarg);
         	break;
+        case 'p':
+            ports.push_back(g.optarg);
+            break;
+        case 'P':
+            busyPorts.push_back(g.optarg);
+            break;
+        case 'b':
+            busyPollCpu = atoi(g.optarg);
+            break;
+        case 'w':
+            busyPollIdleUs = atol(g.optarg);
+            break;
+        case 'q': {
+            std::vector<std::string> f;
+            boost::split(f, g.optarg, boost::is_any_of(":,"));
+            if (f[0] == "weighted") {
+                schedule = SCHEDULE_WEIGHTED;
+            } else if (f[0] != "strict") {
+                std::cerr << "-q needs strict or weighted" << std::endl;
+                exit(1);
+            }
+            for (size_t i = 1; i < f.size() && i < FRAME_CLASS_COUNT; ++i) {
+                weights[i] = static_cast<unsigned>(atoi(f[i].c_str()));
+            }
+            break;
+        }
+        case 'Q':
+            queueCapacity = static_cast<size_t>(atol(g.optarg));
+            break;
+        case 'L':
+            latestValueName = g.optarg;
+            break;
+        case 'W':
+            boost::split(waveformExport, g.optarg, boost::is_any_of(":"));
+            break;
+        case 'S':
+            streamEndpoint = g.optarg;
+            break;
+        case 'O': {
+            std::vector<std::string> f;
+            boost::split(f, g.optarg, boost::is_any_of(":"));
+            if (f[0] == "disconnect") {
+                slowClientPolicy = SLOW_CLIENT_DISCONNECT;
+            } else if (f[0] != "drop") {
+                std::cerr << "-O needs drop or disconnect" << std::endl;
+                exit(1);
+            }
+            if (f.size() > 1) {
+                streamBacklog = static_cast<size_t>(atol(f[1].c_str()));
+            }
+            break;
+        }
+        case 'T':
+            trendDir = g.optarg;
+            break;
+        case 'X':
+            resamplers.push_back(g.optarg);
+            break;
+        case 'F':
+            spectra.push_back(g.optarg);
+            break;
+        case 'E':
+            spectrumConfig = g.optarg;
+            break;
+        case 'B':
+            beatChannels.push_back(g.optarg);
+            break;
+        case 's':
+            snapshotFile = g.optarg;
+            break;
+        case 'i':
+            snapshotInterval = atoi(g.optarg);
+            break;
+        case 'M': {
+            std::vector<std::string> f;
+            boost::split(f, g.optarg, boost::is_any_of(":"));
+            if (f.size() < 2) {
+                std::cerr << "-M needs device:baud" << std::endl;
+                exit(1);
+            }
+            const char parity = f.size() > 2 && !f[2].empty() ? f[2][0] : 'E';
+            modbusBuses.push_back(std::unique_ptr<ModbusMaster>(new ModbusMaster(f[0], atoi(f[1].c_str()), parity)));
+            break;
+        }
+        case 'R': {
+            std::vector<std::string> f;
+            boost::split(f, g.optarg, boost::is_any_of(":"));
+            if (modbusBuses.empty() || f.size() < 3) {
+                std::cerr << "-R needs slave:start:count after -M" << std::endl;
+                exit(1);
+            }
+            ModbusPoll poll;
+            poll.slave = static_cast<uint8_t>(atoi(f[0].c_str()));
+            poll.start = static_cast<uint16_t>(atoi(f[1].c_str()));
+            poll.count = static_cast<uint16_t>(atoi(f[2].c_str()));
+            poll.function = f.size() > 3 ? static_cast<uint8_t>(atoi(f[3].c_str())) : MODBUS_READ_HOLDING_REGISTERS;
+            modbusBuses.back()->addPoll(poll);
+            break;
+        }
+        case 'u':
+            handoverSocket = g.optarg;
+            break;
+        case 'H':
+            takeOverSocket = g.optarg;
+            break;
         case '?':
         	if (g.optopt == 'c') {
                 std::cerr << "Option -`" << g.optopt << "' requires an argument." <<std::endl;
@@ -58,9 +193,99 @@ int main(int argc, char* argv[])
        }
 	}
 
-	TRACE_CREATE_CONTEXT("thread1", "tl");
+    if (ports.empty() && busyPorts.empty() && modbusBuses.empty() && takeOverSocket.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    SerialDriver driver;
+    driver.queue().setPolicy(schedule);
+    driver.queue().setWeights(weights);
+    driver.queue().setCapacity(queueCapacity);
+    if (!latestValueName.empty()) {
+        driver.setLatestValueTable(latestValueName);
+    }
+    if (!resamplers.empty() && waveformExport.empty()) {
+        std::cerr << "-X needs -W" << std::endl;
+        return 1;
+    }
+    for (size_t i = 0; i < resamplers.size(); ++i) {
+        std::vector<std::string> f;
+        boost::split(f, resamplers[i], boost::is_any_of(":"));
+        if (f.size() != 4 || !driver.addResampler(atoi(f[0].c_str()), atoi(f[1].c_str()), atoi(f[2].c_str()),
+                                                  atoi(f[3].c_str()))) {
+            std::cerr << "-X needs port:channel:inrate:outrate" << std::endl;
+            return 1;
+        }
+    }
+    if (!spectrumConfig.empty()) {
+        std::vector<std::string> f;
+        boost::split(f, spectrumConfig, boost::is_any_of(":"));
+        SpectrumConfig config;
+        config.fftSize = static_cast<size_t>(atoi(f[0].c_str()));
+        config.hop = f.size() > 1 ? static_cast<size_t>(atoi(f[1].c_str())) : config.fftSize / 4;
+        if (f.size() > 2) {
+            driver.setSpectrumInterval(atoi(f[2].c_str()));
+        }
+        config.workers = f.size() > 3 ? atoi(f[3].c_str()) : 1;
+        if (!driver.spectrum().setConfig(config)) {
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < spectra.size(); ++i) {
+        std::vector<std::string> f;
+        boost::split(f, spectra[i], boost::is_any_of(":"));
+        if (f.size() != 3 || !driver.spectrum().addChannel(atoi(f[0].c_str()), atoi(f[1].c_str()), atof(f[2].c_str()))) {
+            std::cerr << "-F needs port:channel:rate" << std::endl;
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < beatChannels.size(); ++i) {
+        std::vector<std::string> f;
+        boost::split(f, beatChannels[i], boost::is_any_of(":"));
+        if (f.size() != 3 || !driver.addBeatDetector(atoi(f[0].c_str()), atoi(f[1].c_str()), atof(f[2].c_str()))) {
+            std::cerr << "-B needs port:channel:rate" << std::endl;
+            return 1;
+        }
+    }
+    if (!trendDir.empty() && !driver.trends().setDirectory(trendDir)) {
+        return 1;
+    }
+    if (!streamEndpoint.empty()) {
+        driver.setStreamServer(streamEndpoint, slowClientPolicy, streamBacklog);
+    }
+    if (!waveformExport.empty()) {
+        const uint32_t channels = waveformExport.size() > 1 ? static_cast<uint32_t>(atoi(waveformExport[1].c_str())) : 64;
+        const uint32_t samples = waveformExport.size() > 2 ? static_cast<uint32_t>(atoi(waveformExport[2].c_str())) : 16384;
+        driver.setWaveformExport(waveformExport[0], channels, samples);
+    }
+    if (!snapshotFile.empty()) {
+        driver.setSnapshotFile(snapshotFile, snapshotInterval);
+    }
+    if (!takeOverSocket.empty() && !driver.takeOver(takeOverSocket)) {
+        return 1;
+    }
+    if (!handoverSocket.empty()) {
+        driver.setHandoverSocket(handoverSocket);
+    }
+    driver.setBusyPoll(busyPollCpu, busyPollIdleUs);
+    for (size_t i = 0; i < ports.size() + busyPorts.size(); ++i) {
+        const bool busyPoll = i >= ports.size();
+        std::string path = busyPoll ? busyPorts[i - ports.size()] : ports[i];
+        int baudRate = 0;
+        const size_t colon = path.rfind(':');
+        if (colon != std::string::npos) {
+            baudRate = atoi(path.c_str() + colon + 1);
+            path.erase(colon);
+        }
+        if (!driver.addPort(path, baudRate, busyPoll)) {
+            return 1;
+        }
+    }
 
-	test1();
+    for (size_t i = 0; i < modbusBuses.size(); ++i) {
+        driver.addModbusBus(std::move(modbusBuses[i]));
+    }
 
-	return 0;
+	return driver.run() ? 0 : 1;
 }
@@ -0,0 +1,275 @@
+/**
+ * \file    JsonReader.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+#include "JsonReader.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+JsonReader::JsonReader(const char* data, size_t size) :
+    pos_(data),
+    end_(data + size),
+    line_(1),
+    token_(Null),
+    depth_(0),
+    expect_(ExpectValue)
+{
+    text_.reserve(64);
+}
+
+JsonReader::Token JsonReader::fail(const std::string& what)
+{
+    if (token_ != Error) {
+        std::stringstream ss;
+        ss << "line " << line_ << ": " << what;
+        error_ = ss.str();
+    }
+    token_ = Error;
+    return Error;
+}
+
+void JsonReader::skipWhitespace()
+{
+    while (pos_ < end_) {
+        const char c = *pos_;
+        if (c == '\n') {
+            line_++;
+        } else if (c != ' ' && c != '\t' && c != '\r') {
+            return;
+        }
+        pos_++;
+    }
+}
+
+JsonReader::Token JsonReader::next()
+{
+    if (token_ == Error || token_ == End) {
+        return token_;
+    }
+    skipWhitespace();
+    if (pos_ == end_) {
+        if (depth_ == 0 && expect_ == ExpectCommaOrEnd) {
+            return token_ = End;
+        }
+        return fail("unexpected end of input");
+    }
+
+    const char c = *pos_;
+    switch (expect_) {
+    case ExpectKeyOrEnd:
+        if (c == '}') {
+            return endContainer(c);
+        }
+        return parseKey();
+    case ExpectValueOrEnd:
+        if (c == ']') {
+            return endContainer(c);
+        }
+        return parseValue();
+    case ExpectValue:
+        return parseValue();
+    case ExpectCommaOrEnd:
+        if (depth_ == 0) {
+            return fail("trailing characters after document");
+        }
+        if (c == '}' || c == ']') {
+            return endContainer(c);
+        }
+        if (c != ',') {
+            return fail(std::string("expected ',' but found '") + c + "'");
+        }
+        pos_++;
+        skipWhitespace();
+        if (stack_[depth_ - 1] == '{') {
+            return parseKey();
+        }
+        return parseValue();
+    }
+    return fail("internal error");
+}
+
+JsonReader::Token JsonReader::endContainer(char close)
+{
+    const char open = close == '}' ? '{' : '[';
+    if (depth_ == 0 || stack_[depth_ - 1] != open) {
+        return fail(std::string("unbalanced '") + close + "'");
+    }
+    pos_++;
+    depth_--;
+    expect_ = ExpectCommaOrEnd;
+    return token_ = (close == '}') ? EndObject : EndArray;
+}
+
+JsonReader::Token JsonReader::parseKey()
+{
+    if (pos_ == end_ || *pos_ != '"') {
+        return fail("expected key");
+    }
+    if (!parseString()) {
+        return Error;
+    }
+    skipWhitespace();
+    if (pos_ == end_ || *pos_ != ':') {
+        return fail("expected ':' after key \"" + text_ + "\"");
+    }
+    pos_++;
+    expect_ = ExpectValue;
+    return token_ = Key;
+}
+
+JsonReader::Token JsonReader::parseValue()
+{
+    if (pos_ == end_) {
+        return fail("expected value");
+    }
+    expect_ = ExpectCommaOrEnd;
+    switch (*pos_) {
+    case '{':
+    case '[':
+        if (depth_ == MAX_DEPTH) {
+            return fail("nesting too deep");
+        }
+        stack_[depth_++] = *pos_;
+        expect_ = (*pos_ == '{') ? ExpectKeyOrEnd : ExpectValueOrEnd;
+        return token_ = (*pos_++ == '{') ? BeginObject : BeginArray;
+    case '"':
+        return parseString() ? (token_ = String) : Error;
+    case 't':
+        return parseLiteral("true", 4) ? (token_ = True) : Error;
+    case 'f':
+        return parseLiteral("false", 5) ? (token_ = False) : Error;
+    case 'n':
+        return parseLiteral("null", 4) ? (token_ = Null) : Error;
+    default:
+        return parseNumber() ? (token_ = Number) : Error;
+    }
+}
+
+bool JsonReader::parseLiteral(const char* lit, size_t len)
+{
+    if (static_cast<size_t>(end_ - pos_) < len || std::memcmp(pos_, lit, len) != 0) {
+        fail("invalid literal");
+        return false;
+    }
+    pos_ += len;
+    return true;
+}
+
+bool JsonReader::parseNumber()
+{
+    const char* start = pos_;
+    while (pos_ < end_) {
+        const char c = *pos_;
+        if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+            pos_++;
+        } else {
+            break;
+        }
+    }
+    if (pos_ == start) {
+        fail(std::string("unexpected character '") + *pos_ + "'");
+        return false;
+    }
+    text_.assign(start, pos_);
+    return true;
+}
+
+static void appendUtf8(std::string& s, unsigned long cp)
+{
+    if (cp < 0x80) {
+        s += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        s += static_cast<char>(0xC0 | (cp >> 6));
+        s += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        s += static_cast<char>(0xE0 | (cp >> 12));
+        s += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        s += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+bool JsonReader::parseString()
+{
+    pos_++; // Opening quote
+    text_.clear();
+    const char* run = pos_;
+    while (pos_ < end_) {
+        const char c = *pos_;
+        if (c == '"') {
+            text_.append(run, pos_);
+            pos_++;
+            return true;
+        }
+        if (c == '\n') {
+            break;
+        }
+        if (c != '\\') {
+            pos_++;
+            continue;
+        }
+        // Escape sequence, flush the plain run before it.
+        text_.append(run, pos_);
+        if (++pos_ == end_) {
+            break;
+        }
+        switch (*pos_) {
+        case '"': text_ += '"'; break;
+        case '\\': text_ += '\\'; break;
+        case '/': text_ += '/'; break;
+        case 'b': text_ += '\b'; break;
+        case 'f': text_ += '\f'; break;
+        case 'n': text_ += '\n'; break;
+        case 'r': text_ += '\r'; break;
+        case 't': text_ += '\t'; break;
+        case 'u': {
+            if (end_ - pos_ < 5) {
+                fail("truncated \\u escape");
+                return false;
+            }
+            const std::string hex(pos_ + 1, 4);
+            char* hexEnd = nullptr;
+            const unsigned long cp = std::strtoul(hex.c_str(), &hexEnd, 16);
+            if (hexEnd != hex.c_str() + 4) {
+                fail("invalid \\u escape");
+                return false;
+            }
+            appendUtf8(text_, cp);
+            pos_ += 4;
+            break;
+        }
+        default:
+            fail("invalid escape sequence");
+            return false;
+        }
+        pos_++;
+        run = pos_;
+    }
+    fail("unterminated string");
+    return false;
+}
+
+bool JsonReader::skipValue()
+{
+    Token t = token_;
+    if (t == Key) {
+        t = next();
+    }
+    if (t != BeginObject && t != BeginArray) {
+        return t != Error && t != End;
+    }
+    const int depth = depth_;
+    while (depth_ >= depth) {
+        t = next();
+        if (t == Error || t == End) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,92 @@
+/******************************************************************************/
+/**
+ * \file    JsonReader.hpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ ******************************************************************************/
+
+/*
+ * JsonReader is a small pull parser for JSON text held in memory. It does not build a tree, the caller
+ * asks for one token at a time and copies out only the values it needs. Duplicate keys in an object are
+ * allowed and reported in document order, which is what the Trace configuration files rely on.
+ *
+ * Example:
+ *    JsonReader r(buf, len);
+ *    if (r.next() == JsonReader::BeginObject) {
+ *        while (r.next() == JsonReader::Key) {
+ *            if (r.text() == "name") { r.next(); name = r.text(); } else { r.skipValue(); }
+ *        }
+ *    }
+ **/
+
+#ifndef JSON_READER_HPP
+#define JSON_READER_HPP
+
+#include <string>
+#include <cstddef>
+
+class JsonReader
+{
+public:
+    enum Token {
+        BeginObject,
+        EndObject,
+        BeginArray,
+        EndArray,
+        Key,
+        String,
+        Number,
+        True,
+        False,
+        Null,
+        End,
+        Error
+    };
+
+    explicit JsonReader(const char* data, size_t size);
+
+    Token next();
+    Token token() const {return token_;}
+    // Text of the last Key, String or Number token.
+    const std::string& text() const {return text_;}
+    // Skips the value following a Key, or the rest of the current object/array if positioned at its start.
+    bool skipValue();
+
+    int line() const {return line_;}
+    const std::string& error() const {return error_;}
+
+private:
+    enum Expect {
+        ExpectValue,
+        ExpectValueOrEnd, // Just after '['
+        ExpectKeyOrEnd,   // Just after '{'
+        ExpectCommaOrEnd
+    };
+
+    Token fail(const std::string& what);
+    void skipWhitespace();
+    Token parseKey();
+    Token parseValue();
+    bool parseString();
+    bool parseNumber();
+    bool parseLiteral(const char* lit, size_t len);
+    Token endContainer(char close);
+
+    const char* pos_;
+    const char* end_;
+    int line_;
+    Token token_;
+    std::string text_;
+    std::string error_;
+
+    // Nesting stack, '{' or '['. Configuration files are shallow, a fixed array avoids allocation.
+    static const int MAX_DEPTH = 64;
+    char stack_[MAX_DEPTH];
+    int depth_;
+    Expect expect_;
+};
+
+#endif // JSON_READER_HPP
@@ -14,20 +14,34 @@
 
 //#include "ErrorMacros.h"
 #include <cstdio>
+#include <cstdlib>
 #include <cstdarg>
 #include <cstring>
 #include <cerrno>
 #include <cstdint>
+#include <ctime>
 
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <limits>
 #include <thread>
 
 // #include <QThread>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/regex.hpp>
 
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
-#include <boost/foreach.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/utility.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "JsonReader.hpp"
 
 #define CHECK(a)
 
@@ -39,6 +53,9 @@ std::vector<Trace::Context*> Trace::contexts_;
 
 std::map<std::string, Trace::Configuration*> Trace::configMap_;
 
+// Configurations read by readConfig(). A deque keeps the addresses in configMap_ stable.
+static std::deque<Trace::Configuration> s_configurations;
+
 std::mutex Trace::mutex_;
 
 std::ostream* Trace::m_logStream = nullptr;
@@ -51,7 +68,7 @@ FILE* Trace::logFile_ = stderr;
 std::atomic<bool> Trace::s_disabled(false);
 
 //QTime Trace::timeElapsedStart_ ;
-boost::timer Trace::timeElapsedStart_ ;
+Trace::clock_t::time_point Trace::timeElapsedStart_ = Trace::clock_t::now();
 
 static const std::string entrySymbol = ">";
 static const std::string exitSymbol = "<";
@@ -72,6 +89,11 @@ static std::atomic<unsigned long>s_rowNumber{0};
 #define OPT_FUNC_NAME 0x200
 #define OPT_ROW_NUMBER 0x400
 #define OPT_TIME_ELAPSED 0x800
+#define OPT_STATISTICS 0x1000
+#define OPT_OUTLIERS 0x2000
+#define OPT_CPU_TIME 0x4000
+#define OPT_CPU_CORE 0x8000
+#define OPT_OVERHEAD 0x10000
 
 // 'f'
 #define PRINT_FILE_NAME(a) (a & OPT_FILE_NAME)
@@ -109,15 +131,94 @@ static std::atomic<unsigned long>s_rowNumber{0};
 // 'T'
 #define PRINT_TIME_ELAPSED(a) (a & OPT_TIME_ELAPSED)
 
+// 's'
+#define PRINT_STATISTICS(a) (a & OPT_STATISTICS)
+
+// 'o'
+#define PRINT_OUTLIERS(a) (a & OPT_OUTLIERS)
+
+// 'u'
+#define PRINT_CPU_TIME(a) (a & OPT_CPU_TIME)
+
+// 'k'
+#define PRINT_CPU_CORE(a) (a & OPT_CPU_CORE)
+
+// 'v'
+#define PRINT_OVERHEAD(a) (a & OPT_OVERHEAD)
+
 #define NO_PRINT(a) (a == 0)
 
-static char s_argBuffer[256];
+// Per thread, since the recent lines of one thread must not be overwritten by another.
+static thread_local char s_argBuffer[256];
+
+// TRACE_PRINT lines kept per thread for outlier reports.
+static const size_t RECENT_LINES = 16;
+
+// One in this many calls of each kind is timed with 'v'.
+static const unsigned long OVERHEAD_SAMPLE_EVERY = 64;
+
+// Times one call of Trace if it is sampled, and prints the periodic overhead summary when it is due.
+class OverheadSample
+{
+public:
+    OverheadSample(const Trace::Context& c, Trace::OverheadKind kind) :
+        context_(c),
+        stats_(nullptr)
+    {
+        if (!PRINT_OVERHEAD(c.conf->options)) {
+            return;
+        }
+        Trace::OverheadStats& o = c.overhead[kind];
+        if (o.calls++ % OVERHEAD_SAMPLE_EVERY == 0) {
+            stats_ = &o;
+            kind_ = kind;
+            start_ = Trace::clock_t::now();
+        }
+    }
+    ~OverheadSample()
+    {
+        if (stats_ == nullptr) {
+            return;
+        }
+        const Trace::clock_t::time_point now = Trace::clock_t::now();
+        stats_->sampled++;
+        stats_->sampledNs += std::chrono::duration_cast<std::chrono::nanoseconds>(now - start_).count();
+        // Output is sampled within the other kinds, it would print in the middle of them.
+        const int interval = context_.conf->overheadInterval;
+        if (kind_ != Trace::OVERHEAD_OUTPUT && interval > 0 && now - context_.lastOverheadReport >= std::chrono::seconds(interval)) {
+            const_cast<Trace::Context&>(context_).lastOverheadReport = now;
+            Trace::printOverhead(context_);
+        }
+    }
+
+private:
+    const Trace::Context& context_;
+    Trace::OverheadStats* stats_;
+    Trace::OverheadKind kind_;
+    Trace::clock_t::time_point start_;
+};
+
+
+void Trace::printOverheadAtExit()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < contexts_.size(); ++i) {
+        if (PRINT_OVERHEAD(contexts_[i]->conf->options)) {
+            printOverhead(*contexts_[i]);
+        }
+    }
+}
 
-Trace::Trace(const std::string& func, const std::string& file, const int line):
-    funcName_(func),
-    fileName_(file),
-    line_(line),
-    exitLine_(-1)
+Trace::Trace(const CallSite& site):
+    site_(&site),
+    exitLine_(-1),
+    savedDepthLimit_(-1),
+    deadlineMs_(-1.0),
+    timed_(false),
+    lapStats_(nullptr),
+    cpuTimed_(false),
+    entryCpu_(-1),
+    entryMigrations_(0)
 {
     if (s_disabled) return;
 
@@ -125,14 +226,41 @@ Trace::Trace(const std::string& func, const std::string& file, const int line):
     Context* ct = context();
 
     if (ct != 0) {
+        if (ct->nestingLevel > ct->depthLimit) {
+            // Below maxDepth or a "suppressBelow" function, only count the call.
+            ct->nestingLevel++;
+            if (PRINT_STATISTICS(ct->conf->options)) {
+                ct->stats[site_].suppressed++;
+            }
+            return;
+        }
+        OverheadSample sample(*ct, OVERHEAD_ENTER);
         const options_t opt = ct->conf->options;
   
-        if (PRINT_EXECUTION_TIME(opt)){
-            timer_.restart();
+        if (PRINT_EXECUTION_TIME(opt) || PRINT_STATISTICS(opt) || PRINT_OUTLIERS(opt)){
+            startTime_ = clock_t::now();
+            lapTime_ = startTime_;
+            timed_ = true;
+        }
+        if (PRINT_CPU_TIME(opt) && (PRINT_STATISTICS(opt) || PRINT_OUTLIERS(opt))) {
+            cpuUsage(cpuStart_);
+            cpuTimed_ = true;
+        }
+        if (PRINT_CPU_CORE(opt)) {
+            entryCpu_ = sampleCpu(*ct);
+            entryMigrations_ = ct->migrations;
+        }
+        if (PRINT_OUTLIERS(opt)) {
+            deadlineMs_ = deadline(*ct, site_);
+            ct->scopes.push_back(this);
         }
 
         if (PRINT_NESTING(opt)) {
-            traceOut((const Context*) ct, entrySymbol, funcName_, "", fileName_, line_);
+            traceOut((const Context*) ct, entrySymbol, site_->func, "", site_->file, site_->line);
+        }
+        if (!ct->conf->suppressBelow.empty() && isSuppressBelow(*ct->conf, site_->func)) {
+            savedDepthLimit_ = ct->depthLimit;
+            ct->depthLimit = ct->nestingLevel;
         }
         ct->nestingLevel++;
     }
@@ -146,18 +274,72 @@ Trace::~Trace()
 
     if (ct != 0) {
         ct->nestingLevel--;
+        if (ct->nestingLevel > ct->depthLimit) {
+            return;
+        }
+        OverheadSample sample(*ct, OVERHEAD_EXIT);
+        if (savedDepthLimit_ != -1) {
+            ct->depthLimit = savedDepthLimit_;
+        }
         const options_t opt = ct->conf->options;
+        double ms = -1.0;
+        if (timed_) {
+            ms = elapsedMs(startTime_);
+        }
+        double cpuMs = -1.0;
+        CpuUsage cpu;
+        if (cpuTimed_) {
+            cpuUsage(cpu);
+            cpuMs = (cpu.cpuNs - cpuStart_.cpuNs) / 1e6;
+        }
+        unsigned long migrations = 0;
+        if (entryCpu_ != -1) {
+            sampleCpu(*ct);
+            migrations = ct->migrations - entryMigrations_;
+        }
+        const bool slow = deadlineMs_ >= 0.0 && ms > deadlineMs_;
+        if (PRINT_STATISTICS(opt)) {
+            CallStats& st = ct->stats[site_];
+            st.calls++;
+            st.totalMs += ms;
+            if (ms > st.maxMs) {
+                st.maxMs = ms;
+            }
+            if (slow) {
+                st.slow++;
+            }
+            if (cpuTimed_) {
+                st.cpuMs += cpuMs;
+                st.voluntarySwitches += cpu.voluntarySwitches - cpuStart_.voluntarySwitches;
+                st.involuntarySwitches += cpu.involuntarySwitches - cpuStart_.involuntarySwitches;
+            }
+            if (migrations > 0) {
+                st.migrations += migrations;
+                st.migratedCalls++;
+            }
+        }
+        // The options may have changed since the constructor, then this scope is not on the stack.
+        if (!ct->scopes.empty() && ct->scopes.back() == this) {
+            if (slow) {
+                reportSlow(*ct, ms, cpuMs);
+            }
+            ct->scopes.pop_back();
+        }
         if (!PRINT_NESTING(opt)){
             return;
         }
         if (PRINT_EXECUTION_TIME(opt)) {
-            traceOut((const Context*) ct, exitSymbol, funcName_, "", fileName_, exitLine_, timer_.elapsed());
+            traceOut((const Context*) ct, exitSymbol, site_->func, "", site_->file, exitLine_, ms);
         } else {
-            traceOut((const Context*) ct, exitSymbol, funcName_, "",fileName_, exitLine_);
+            traceOut((const Context*) ct, exitSymbol, site_->func, "", site_->file, exitLine_);
         }
     }
 }
 
+double Trace::elapsedMs(const clock_t::time_point& start)
+{
+    return std::chrono::duration<double, std::milli>(clock_t::now() - start).count();
+}
 
 void Trace::setName(const std::string& name)
 {
@@ -177,11 +359,222 @@ void Trace::setOptions(options_t options)
     }    
 }
 
+void Trace::setMaxDepth(int depth)
+{
+    Context* c = Trace::context();
+    if (c != nullptr)
+    {
+        c->conf->maxDepth = depth;
+        updateDepthLimit(*c);
+    }
+}
+
+void Trace::setSuppressBelow(const std::vector<std::string>& functions)
+{
+    Context* c = Trace::context();
+    if (c != nullptr)
+    {
+        c->conf->suppressBelow = functions;
+        std::sort(c->conf->suppressBelow.begin(), c->conf->suppressBelow.end());
+    }
+}
+
+void Trace::setDeadlines(const std::vector<std::pair<std::string, double> >& deadlines)
+{
+    Context* c = Trace::context();
+    if (c != nullptr)
+    {
+        c->conf->deadlines = deadlines;
+        std::sort(c->conf->deadlines.begin(), c->conf->deadlines.end());
+        c->deadlines.clear();
+    }
+}
+
+void Trace::setDeadline(double ms)
+{
+    if (s_disabled) return;
+    const Context* ct = context();
+    // Only scopes on the stack are checked on exit.
+    if (ct != nullptr && !ct->scopes.empty() && ct->scopes.back() == this) {
+        deadlineMs_ = ms;
+    }
+}
+
+void Trace::lap(const char* name, int lineNo)
+{
+    // Scopes beyond the depth limit and scopes entered without timing options are not timed.
+    if (s_disabled || !timed_) return;
+    Context* ct = context();
+    if (ct == nullptr) {
+        return;
+    }
+    const options_t opt = ct->conf->options;
+    const clock_t::time_point now = clock_t::now();
+    const double ms = std::chrono::duration<double, std::milli>(now - lapTime_).count();
+    lapTime_ = now;
+    if (PRINT_STATISTICS(opt)) {
+        if (lapStats_ == nullptr) {
+            lapStats_ = &ct->stats[site_];
+        }
+        std::vector<PhaseStats>& phases = lapStats_->phases;
+        size_t i = 0;
+        while (i < phases.size() && phases[i].name != name && std::strcmp(phases[i].name, name) != 0) {
+            ++i;
+        }
+        if (i == phases.size()) {
+            phases.push_back(PhaseStats());
+            phases.back().name = name;
+        }
+        PhaseStats& ps = phases[i];
+        ps.calls++;
+        ps.totalMs += ms;
+        if (ms > ps.maxMs) {
+            ps.maxMs = ms;
+        }
+    }
+    if (PRINT_EXECUTION_TIME(opt)) {
+        traceOut((const Context*) ct, " ", site_->func, std::string("lap ") + name, site_->file, lineNo, ms);
+    }
+}
+
+double Trace::deadline(Context& c, const CallSite* site)
+{
+    const std::vector<std::pair<std::string, double> >& v = c.conf->deadlines;
+    if (v.empty()) {
+        return -1.0;
+    }
+    const std::unordered_map<const CallSite*, double>::const_iterator it = c.deadlines.find(site);
+    if (it != c.deadlines.end()) {
+        return it->second;
+    }
+    // First call from this site, look the function up once.
+    double ms = -1.0;
+    size_t lo = 0;
+    size_t hi = v.size();
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        const int r = std::strcmp(v[mid].first.c_str(), site->func);
+        if (r == 0) {
+            ms = v[mid].second;
+            break;
+        } else if (r < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    c.deadlines[site] = ms;
+    return ms;
+}
+
+void Trace::cpuUsage(CpuUsage& u)
+{
+    // The user and system times of getrusage() are rescaled by the kernel and can jump by a tick,
+    // so the CPU time comes from the thread's CPU clock.
+    struct timespec ts;
+    u.cpuNs = clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0 ? static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec : 0;
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) != 0) {
+        u.voluntarySwitches = 0;
+        u.involuntarySwitches = 0;
+        return;
+    }
+    u.voluntarySwitches = ru.ru_nvcsw;
+    u.involuntarySwitches = ru.ru_nivcsw;
+}
+
+int Trace::sampleCpu(Context& c)
+{
+    const int cpu = sched_getcpu();
+    if (cpu != c.cpu && c.cpu != -1 && cpu != -1) {
+        c.migrations++;
+    }
+    c.cpu = cpu;
+    return cpu;
+}
+
+void Trace::reportSlow(const Context& c, double ms, double cpuMs) const
+{
+    if (c.logStream_ == nullptr) {
+        return;
+    }
+    std::ostream& s = *c.logStream_;
+    const clock_t::time_point now = clock_t::now();
+    s << c.conf->prompt << "SLOW " << site_->func << " " << ms << " ms > " << deadlineMs_ << " ms";
+    if (cpuMs >= 0.0) {
+        s << " cpu: " << cpuMs << " ms off-cpu: " << std::max(0.0, ms - cpuMs) << " ms";
+    }
+    if (entryCpu_ != -1) {
+        // The destructor has just read the core.
+        s << " core: " << entryCpu_ << "->" << c.cpu << " migrations: " << c.migrations - entryMigrations_;
+    }
+    s << " (" << site_->file << ":" << (exitLine_ != -1 ? exitLine_ : site_->line) << ")" << std::endl;
+    // Enclosing scopes, innermost first, with the time spent in each so far.
+    for (size_t i = c.scopes.size() - 1; i-- > 0; ) {
+        const Trace* t = c.scopes[i];
+        s << c.conf->prompt << TR_TAB << "in " << t->site_->func << " (" << t->site_->file << ":" << t->site_->line << ") "
+          << std::chrono::duration<double, std::milli>(now - t->startTime_).count() << " ms" << std::endl;
+    }
+    // Oldest line first.
+    const size_t n = c.recent.size();
+    for (size_t i = 0; i < n; ++i) {
+        const std::string& line = c.recent[(c.recentNext + i) % n];
+        if (!line.empty()) {
+            s << c.conf->prompt << TR_TAB << "recent " << line << std::endl;
+        }
+    }
+}
+
+// A TRACE_PRINT belongs to the innermost scope, which raised the nesting level by one. Nothing of a scope beyond
+// maxDepth or below a "suppressBelow" function is printed, the scope itself is only counted.
+static bool inSuppressedScope(const Trace::Context& c)
+{
+    return c.nestingLevel - 1 > c.depthLimit;
+}
+
+void Trace::updateDepthLimit(Context& c)
+{
+    // Nesting level starts at 1 for a new context, so the outermost scope has depth 1.
+    c.depthLimit = c.conf->maxDepth > 0 ? c.conf->maxDepth : std::numeric_limits<int>::max();
+}
+
+bool Trace::isSuppressBelow(const Configuration& conf, const char* funcName)
+{
+    const std::vector<std::string>& v = conf.suppressBelow;
+    size_t lo = 0;
+    size_t hi = v.size();
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        const int r = std::strcmp(v[mid].c_str(), funcName);
+        if (r == 0) {
+            return true;
+        } else if (r < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+// Serializes changes of keyword filters, each one is built from the filter it replaces.
+static std::mutex s_keywordFilterMutex;
+
+void Trace::publishKeywordFilter(Configuration& conf, const std::shared_ptr<const KeywordFilter>& filter)
+{
+    std::atomic_store(&conf.keywordFilter, filter);
+    // After the filter, so a thread that sees the new generation also gets the new filter.
+    conf.keywordGeneration.value.fetch_add(1, std::memory_order_release);
+}
+
 void Trace::setSimpleSearchStr(const std::string& str)
 {
     Context* c = context();
     if (c != 0) {
-        c->conf->simpleSearchStr = str;
+        std::lock_guard<std::mutex> lock(s_keywordFilterMutex);
+        std::shared_ptr<KeywordFilter> f = std::make_shared<KeywordFilter>(*std::atomic_load(&c->conf->keywordFilter));
+        f->simpleSearchStr = str;
+        publishKeywordFilter(*c->conf, f);
     }
 }
 
@@ -189,8 +582,112 @@ void Trace::setRegExpStr(const std::string& re)
 {
     Context* c = context();
     if (c != 0) {
-        c->conf->regexpStr = re;
+        std::lock_guard<std::mutex> lock(s_keywordFilterMutex);
+        std::shared_ptr<KeywordFilter> f = std::make_shared<KeywordFilter>(*std::atomic_load(&c->conf->keywordFilter));
+        f->regexpStr = re;
+        publishKeywordFilter(*c->conf, f);
+    }
+}
+
+void Trace::setKeywords(const std::vector<std::string>& include, const std::vector<std::string>& exclude)
+{
+    Context* c = context();
+    if (c != nullptr) {
+        std::lock_guard<std::mutex> lock(s_keywordFilterMutex);
+        std::shared_ptr<KeywordFilter> f = std::make_shared<KeywordFilter>(*std::atomic_load(&c->conf->keywordFilter));
+        f->includeKeywords = include;
+        f->excludeKeywords = exclude;
+        std::sort(f->includeKeywords.begin(), f->includeKeywords.end());
+        std::sort(f->excludeKeywords.begin(), f->excludeKeywords.end());
+        publishKeywordFilter(*c->conf, f);
+    }
+}
+
+// Interned keywords; a deque, so the strings never move.
+static std::mutex s_keywordMutex;
+static std::deque<std::string> s_keywords;
+static std::unordered_map<std::string, size_t> s_keywordIds;
+
+Trace::Keyword::Keyword(const std::string& keyword)
+{
+    std::lock_guard<std::mutex> lock(s_keywordMutex);
+    const std::unordered_map<std::string, size_t>::const_iterator it = s_keywordIds.find(keyword);
+    if (it != s_keywordIds.end()) {
+        id = it->second;
+    } else {
+        id = s_keywords.size();
+        s_keywords.push_back(keyword);
+        s_keywordIds[keyword] = id;
+    }
+    text = &s_keywords[id];
+}
+
+enum { VERDICT_UNKNOWN = 0, VERDICT_PRINT, VERDICT_SKIP };
+
+bool Trace::matchKeyword(const KeywordFilter& conf, const std::string& keyword)
+{
+    if (keyword.empty()) {
+        return true;
+    }
+    if (std::binary_search(conf.excludeKeywords.begin(), conf.excludeKeywords.end(), keyword)) {
+        return false;
+    }
+    if (conf.includeKeywords.empty() && conf.simpleSearchStr.empty() && conf.regexpStr.empty()) {
+        return true;
+    }
+    if (keyword == conf.simpleSearchStr ||
+        std::binary_search(conf.includeKeywords.begin(), conf.includeKeywords.end(), keyword)) {
+        return true;
+    }
+    if (!conf.regexpStr.empty()) {
+        try
+        {
+            return boost::regex_search(keyword, boost::regex(conf.regexpStr));
+        } catch(std::exception& e)
+        {
+            std::cerr << "Trace: invalid regexp \"" << conf.regexpStr << "\": " << e.what() << std::endl;
+        }
+    }
+    return false;
+}
+
+const Trace::KeywordFilter& Trace::keywordFilter(const Context& c)
+{
+    const unsigned long generation = c.conf->keywordGeneration.value.load(std::memory_order_acquire);
+    if (generation != c.keywordGeneration || !c.keywordFilter) {
+        // The filter changed, maybe in another thread with the same configuration.
+        c.keywordFilter = std::atomic_load(&c.conf->keywordFilter);
+        c.keywordVerdicts.clear();
+        c.keywordGeneration = generation;
+    }
+    return *c.keywordFilter;
+}
+
+bool Trace::printKeyword(Context& c, const Keyword& keyword)
+{
+    const KeywordFilter& filter = keywordFilter(c);
+    std::vector<uint8_t>& v = c.keywordVerdicts;
+    if (keyword.id >= v.size()) {
+        v.resize(keyword.id + 1, VERDICT_UNKNOWN);
+    }
+    uint8_t& verdict = v[keyword.id];
+    if (verdict == VERDICT_UNKNOWN) {
+        // Once per keyword and thread, so the set sizes and the regexp do not matter after that.
+        verdict = matchKeyword(filter, *keyword.text) ? VERDICT_PRINT : VERDICT_SKIP;
     }
+    return verdict == VERDICT_PRINT;
+}
+
+bool Trace::wants(const Keyword& keyword)
+{
+    if (s_disabled) return false;
+    Context* ct = context();
+    if (ct == nullptr || inSuppressedScope(*ct)) {
+        return false;
+    }
+    // The outlier ring keeps every line.
+    const options_t opt = ct->conf->options;
+    return PRINT_OUTLIERS(opt) || (PRINT_STRINGS(opt) && printKeyword(*ct, keyword));
 }
 
 void Trace::setPrompt(const std::string& p)
@@ -258,63 +755,68 @@ void Trace::out(const int line)
     exitLine_ = line;
 }
 
-void Trace::printState(const std::string& keyword, const char* file, int line, char* args)
+void Trace::printState(const Keyword& keyword, const char* file, int line, const char* format, ...)
 {
     if (s_disabled) return;
 
-    const Context* ct = context();
-    if  (ct != 0) {
-        if (PRINT_STRINGS(ct->conf->options)) {
-            const std::string& simpstr = ct->conf->simpleSearchStr;
-            const std::string& regxp = ct->conf->regexpStr;
-            bool printString = false;
-            if (keyword.empty() || (simpstr.empty() && regxp.empty())) {
-                printString = true;
-            } else if (simpstr == keyword) {
-                printString = true;
-            } else if (!regxp.empty()) {
-                /*
-                QRegExp re(regxp);
-                if (re.indexIn(keyword) != -1){
-                    printString = true;
-                }
-                */
-            }
-            if (printString) {
-                traceOut(ct, " ", funcName_, args, file, line);
+    Context* ct = context();
+    if  (ct != 0 && !inSuppressedScope(*ct)) {
+        // Formatting is part of the cost of a print, so it is within the sample.
+        OverheadSample sample(*ct, OVERHEAD_PRINT);
+        const char* args = s_argBuffer;
+        if (!NO_PRINT(ct->conf->options)) {
+            va_list list;
+            va_start(list, format);
+            (void) vsnprintf(s_argBuffer, sizeof(s_argBuffer), format, list);
+            va_end(list);
+        } else {
+            s_argBuffer[0] = '\0';
+        }
+        if (PRINT_CPU_CORE(ct->conf->options)) {
+            sampleCpu(*ct);
+        }
+        if (PRINT_OUTLIERS(ct->conf->options)) {
+            if (ct->recent.empty()) {
+                ct->recent.resize(RECENT_LINES);
             }
+            // Assigned in place, so the ring stops allocating once its strings have grown.
+            std::string& r = ct->recent[ct->recentNext];
+            ct->recentNext = (ct->recentNext + 1) % RECENT_LINES;
+            r.assign(site_->func);
+            r.append(": ");
+            r.append(args);
+            r.append(" (");
+            r.append(file);
+            r.append(":");
+            r.append(std::to_string(line));
+            r.append(")");
+        }
+        if (PRINT_STRINGS(ct->conf->options) && printKeyword(*ct, keyword)) {
+            traceOut(ct, " ", site_->func, args, file, line);
         }
     }
 }
 
-char*  Trace::printArgs(const char *format, ...)
-{
-    Context* ct = context();
-    if (ct && !NO_PRINT(ct->conf->options)){
-        va_list args;
-        va_start(args, format);
-        (void) vsprintf(s_argBuffer, format, args);
-        va_end(args);
-    } else {
-        s_argBuffer[0] = '\0';
-    }
-    return s_argBuffer;
-}
-
 Trace::Context* Trace::context()
 {
+    // Cached per thread, since this is called from every Trace constructor and destructor.
+    static thread_local Context* t_context = nullptr;
+    if (t_context != nullptr) {
+        return t_context;
+    }
     // Is the context for this thread already created?
     const std::thread::id tId= std::this_thread::get_id();
     for(size_t i=0; i<contexts_.size(); ++i){
         Context* c = contexts_[i];
         if (c->threadId == tId){
+            t_context = c;
             return c;
         }
     }
     return nullptr;
 }
 
-void Trace::traceOut(const Context* ct, const std::string& extra, const std::string& funcName, const std::string& args, const std::string& fileName, int lineNo, double ms) // Construct string based on options.
+void Trace::traceOut(const Context* ct, const std::string& extra, const char* funcName, const std::string& args, const char* fileName, int lineNo, double ms) // Construct string based on options.
 {
     std::ostream* s = ct->logStream_;
 
@@ -324,6 +826,7 @@ void Trace::traceOut(const Context* ct, const std::string& extra, const std::str
 
    if (NO_PRINT(opt))
         return;
+    OverheadSample sample(*ct, OVERHEAD_OUTPUT);
 
     if (PRINT_ROW_NUMBER(opt)) {
         char rownumstr[16];
@@ -337,9 +840,16 @@ void Trace::traceOut(const Context* ct, const std::string& extra, const std::str
         *s << '(' << ct->threadId << ')';
     }
 
+    if (PRINT_CPU_CORE(opt)) {
+        // The core last read by sampleCpu, which entries, exits and prints do just before their line, so the
+        // core shown agrees with the migrations counted.
+        *s << '[' << ct->cpu << ']';
+    }
+
     *s << ct->conf->prompt;
-    if (conf->regexpStr.length() > 0) {
-        *s << " \"" + conf->regexpStr + "\" ";
+    const std::string& regexpStr = keywordFilter(*ct).regexpStr;
+    if (regexpStr.length() > 0) {
+        *s << " \"" + regexpStr + "\" ";
     }
 
     if (PRINT_NESTING(opt)) { // Print nesting level.
@@ -380,14 +890,17 @@ void Trace::traceOut(const Context* ct, const std::string& extra, const std::str
   //      s << QDateTime::currentDateTime().toString(" yyyy-MM-d, hh:mm:ss.zzz");
  //   }
     if (PRINT_TIME_ELAPSED(opt)) { // TBD: Compensate for wrap-around at 23:59:59.999 -> 00:00:00.0
-        int ms = timeElapsedStart_.elapsed();
-        const int hours = ms / (60*60*1000);
+        // Wall clock milliseconds since start, the same in all threads, so logs of threads can be merged by it.
+        long long ms = static_cast<long long>(elapsedMs(timeElapsedStart_));
+        const long long hours = ms / (60*60*1000);
         ms -= hours * (60*60*1000);
-        const int minutes = ms / (60*1000) ;
+        const long long minutes = ms / (60*1000) ;
         ms -= minutes * (60*1000);
-        const int seconds = ms / (1000);
+        const long long seconds = ms / (1000);
         ms -= seconds*1000;
-        *s << " T:" << hours << ":" << minutes << ":" << seconds << "."  << ms;
+        char text[96];
+        snprintf(text, sizeof(text), " T:%lld:%lld:%lld.%03lld", hours, minutes, seconds, ms);
+        *s << text;
     }
     *s << std::endl; 
 }
@@ -397,8 +910,8 @@ void Trace::profTimerStart(int lineNo)
     if (s_disabled) return;
     const Context* ct = context();
     if (ct != 0) {
-        profTime_.restart();
-        traceOut(ct, " ", funcName_, "PTime started", fileName_, lineNo);
+        profTime_ = clock_t::now();
+        traceOut(ct, " ", site_->func, "PTime started", site_->file, lineNo);
     }
 }
 
@@ -413,7 +926,7 @@ void Trace::profTimerElapsed(int lineNo)
         if (!prExecTime) {
             ct->conf->options |= OPT_EXECUTION_TIME;
         }
-        traceOut((const Context*) ct, " ", funcName_, "PTime elapsed", fileName_, lineNo, profTime_.elapsed());
+        traceOut((const Context*) ct, " ", site_->func, "PTime elapsed", site_->file, lineNo, elapsedMs(profTime_));
         // If PRINT_EXECUTION_TIME wasn't defined, we clear it.
         if (!prExecTime) {
             ct->conf->options &= ~OPT_EXECUTION_TIME;
@@ -431,7 +944,7 @@ void Trace::check(const char* expression, bool result, int lineNo)
             std::string s(expression);
             s += " : ";
             s += result ? "true" : "false";
-            traceOut((const Context*) ct, " ", funcName_, s, fileName_, lineNo);
+            traceOut((const Context*) ct, " ", site_->func, s, site_->file, lineNo);
         }
     }
 }
@@ -481,7 +994,7 @@ void Trace::compareHelper(const char* first, const char* second, int result, int
             } else {
                 s = s1 + " == " + s2;
             }
-            traceOut((const Context*) ct, " ", funcName_, s, fileName_, lineNo);
+            traceOut((const Context*) ct, " ", site_->func, s, site_->file, lineNo);
         }
     }
 }
@@ -507,51 +1020,350 @@ void Trace::compareHelper(const char* first, const char* second, int result, int
 *
 *******************************************************************************************/
 
-bool Trace::readConfig(const std::string& appName, const std::string& pathToConfigFile)
+// Bumped whenever the cached Configuration layout changes.
+static const unsigned int CONFIG_CACHE_VERSION = 4;
+
+namespace boost {
+namespace serialization {
+template<class Archive>
+void serialize(Archive& ar, Trace::Configuration& c, const unsigned int /*version*/)
 {
-    namespace pt = boost::property_tree;
-    pt::ptree conf;
+    ar & c.name & c.options & c.prompt & c.simpleSearchStr & c.regexpStr & c.logFileName_ & c.logFileMode_
+       & c.maxDepth & c.suppressBelow & c.deadlines & c.overheadInterval
+       & c.includeKeywords & c.excludeKeywords;
+}
+} // namespace serialization
+} // namespace boost
+
+// Key identifying the configuration file contents a cache was built from.
+struct ConfigCacheKey {
+    explicit ConfigCacheKey(){version=CONFIG_CACHE_VERSION;mtimeSec=0;mtimeNsec=0;size=0;}
+    unsigned int version;
+    long long mtimeSec;
+    long long mtimeNsec;
+    long long size;
+    std::string appName;
+
+    bool operator==(const ConfigCacheKey& o) const {
+        return version == o.version && mtimeSec == o.mtimeSec && mtimeNsec == o.mtimeNsec && size == o.size && appName == o.appName;
+    }
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int /*version*/) {
+        ar & version & mtimeSec & mtimeNsec & size & appName;
+    }
+};
 
+static bool readConfigCache(const std::string& cacheFile, const ConfigCacheKey& key, std::vector<Trace::Configuration>& confs)
+{
+    std::ifstream is(cacheFile, std::ios_base::binary);
+    if (!is) {
+        return false;
+    }
     try
     {
-        pt::read_json(pathToConfigFile, conf);
-        //std::size_t appcnt = conf.count(appName);
-        pt::ptree subconf = conf.get_child(appName);
+        boost::archive::binary_iarchive ia(is);
+        ConfigCacheKey cached;
+        ia >> cached;
+        if (!(cached == key)) {
+            return false;
+        }
+        ia >> confs;
+    } catch(std::exception& e)
+    {
+        std::cerr << cacheFile << ": ignoring invalid cache: " << e.what() << std::endl;
+        confs.clear();
+        return false;
+    }
+    return true;
+}
 
-        BOOST_FOREACH(const pt::ptree::value_type &v, conf.get_child(appName)) 
+static void writeConfigCache(const std::string& cacheFile, const ConfigCacheKey& key, const std::vector<Trace::Configuration>& confs)
+{
+    // Write to a temporary file and rename, so a concurrent reader never sees a partial cache.
+    const std::string tmpFile = cacheFile + ".tmp";
+    try
+    {
         {
-            // v.first is the name of the child.
-            // v.second is the child tree.
-            const pt::ptree subTree = v.second;
-            if (v.first == "thr")
-            {    
-                Configuration* c = new Configuration;
-                try{
-                    c->name = subTree.get<std::string>("name");
-                    c->options=parseOptions(subTree.get<std::string>("options"));
-                    c->simpleSearchStr=subTree.get<std::string>("searchStr");
-                    c->regexpStr=subTree.get<std::string>("regexp");
-                    c->prompt=subTree.get<std::string>("prompt");
-                    pt::ptree logfile = subTree.get_child("logfile");
-                    c->logFileName_ = logfile.get<std::string>("name");
-                    c->logFileMode_ = logfile.get<std::string>("mode");
-                    configMap_[c->name] = c;
-
-                } catch(std::exception& e) {
-                    delete c;
-                    std::cerr << e.what() << std::endl;
-                    return false;
-                }
-            } 
+            std::ofstream os(tmpFile, std::ios_base::binary | std::ios_base::trunc);
+            if (!os) {
+                return;
+            }
+            boost::archive::binary_oarchive oa(os);
+            oa << key;
+            oa << confs;
         }
-    }catch(std::exception& e)
+        if (std::rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+            std::cerr << cacheFile << ": " << strerror(errno) << std::endl;
+            std::remove(tmpFile.c_str());
+        }
+    } catch(std::exception& e)
     {
-        std::cerr << e.what() << std::endl;
+        std::cerr << cacheFile << ": failed to write cache: " << e.what() << std::endl;
+        std::remove(tmpFile.c_str());
+    }
+}
+
+// Reads a string value into s. Anything but a string is reported as an error.
+static bool readString(JsonReader& r, const std::string& where, const std::string& key, std::string& s)
+{
+    if (r.next() != JsonReader::String) {
+        if (r.token() != JsonReader::Error) {
+            std::cerr << where << ": \"" << key << "\" must be a string" << std::endl;
+            r.skipValue();
+        }
         return false;
     }
+    s = r.text();
     return true;
 }
 
+// Reads an array of strings into v, sorted.
+static bool readStrings(JsonReader& r, const std::string& where, const std::string& key, std::vector<std::string>& v)
+{
+    if (r.next() != JsonReader::BeginArray) {
+        if (r.token() != JsonReader::Error) {
+            std::cerr << where << ": \"" << key << "\" must be an array" << std::endl;
+            r.skipValue();
+        }
+        return false;
+    }
+    bool ok = true;
+    while (r.next() != JsonReader::EndArray && r.token() != JsonReader::Error) {
+        if (r.token() == JsonReader::String) {
+            v.push_back(r.text());
+        } else {
+            std::cerr << where << ": \"" << key << "\" must contain strings" << std::endl;
+            r.skipValue();
+            ok = false;
+        }
+    }
+    std::sort(v.begin(), v.end());
+    return ok && r.token() != JsonReader::Error;
+}
+
+// Parses one "thr" object. Returns false if the entry must be dropped, errors are reported with 'where' as prefix.
+static bool readThread(JsonReader& r, const std::string& where, Trace::Configuration& c)
+{
+    enum { HAS_NAME = 0x1, HAS_OPTIONS = 0x2 };
+    int found = 0;
+    bool ok = true;
+
+    if (r.next() != JsonReader::BeginObject) {
+        if (r.token() != JsonReader::Error) {
+            std::cerr << where << ": expected an object" << std::endl;
+            r.skipValue();
+        }
+        return false;
+    }
+    while (r.next() == JsonReader::Key) {
+        const std::string key = r.text();
+        if (key == "name") {
+            ok = readString(r, where, key, c.name) && ok;
+            found |= HAS_NAME;
+        } else if (key == "options") {
+            std::string opts;
+            ok = readString(r, where, key, opts) && ok;
+            c.options = Trace::parseOptions(opts);
+            found |= HAS_OPTIONS;
+        } else if (key == "searchStr") {
+            ok = readString(r, where, key, c.simpleSearchStr) && ok;
+        } else if (key == "regexp") {
+            ok = readString(r, where, key, c.regexpStr) && ok;
+            try
+            {
+                boost::regex re(c.regexpStr);
+            } catch(std::exception& e)
+            {
+                std::cerr << where << ": invalid \"regexp\": " << e.what() << std::endl;
+                ok = false;
+            }
+        } else if (key == "prompt") {
+            ok = readString(r, where, key, c.prompt) && ok;
+        } else if (key == "maxDepth") {
+            if (r.next() == JsonReader::Number) {
+                c.maxDepth = std::atoi(r.text().c_str());
+            } else if (r.token() == JsonReader::String) {
+                c.maxDepth = std::atoi(r.text().c_str());
+            } else {
+                std::cerr << where << ": \"maxDepth\" must be a number" << std::endl;
+                r.skipValue();
+                ok = false;
+            }
+        } else if (key == "suppressBelow") {
+            ok = readStrings(r, where, key, c.suppressBelow) && ok;
+        } else if (key == "include") {
+            ok = readStrings(r, where, key, c.includeKeywords) && ok;
+        } else if (key == "exclude") {
+            ok = readStrings(r, where, key, c.excludeKeywords) && ok;
+        } else if (key == "overheadInterval") {
+            if (r.next() == JsonReader::Number) {
+                c.overheadInterval = std::atoi(r.text().c_str());
+            } else {
+                std::cerr << where << ": \"overheadInterval\" must be a number of seconds" << std::endl;
+                r.skipValue();
+                ok = false;
+            }
+        } else if (key == "deadlines") {
+            if (r.next() != JsonReader::BeginObject) {
+                std::cerr << where << ": \"deadlines\" must be an object" << std::endl;
+                r.skipValue();
+                ok = false;
+                continue;
+            }
+            while (r.next() == JsonReader::Key) {
+                const std::string func = r.text();
+                if (r.next() == JsonReader::Number && std::atof(r.text().c_str()) >= 0.0) {
+                    c.deadlines.push_back(std::make_pair(func, std::atof(r.text().c_str())));
+                } else {
+                    std::cerr << where << ": deadline of \"" << func << "\" must be a number of milliseconds" << std::endl;
+                    r.skipValue();
+                    ok = false;
+                }
+            }
+            std::sort(c.deadlines.begin(), c.deadlines.end());
+        } else if (key == "logfile") {
+            if (r.next() != JsonReader::BeginObject) {
+                std::cerr << where << ": \"logfile\" must be an object" << std::endl;
+                r.skipValue();
+                ok = false;
+                continue;
+            }
+            while (r.next() == JsonReader::Key) {
+                const std::string lkey = r.text();
+                if (lkey == "name") {
+                    ok = readString(r, where, "logfile.name", c.logFileName_) && ok;
+                } else if (lkey == "mode") {
+                    ok = readString(r, where, "logfile.mode", c.logFileMode_) && ok;
+                } else {
+                    r.skipValue();
+                }
+            }
+        } else {
+            r.skipValue();
+        }
+    }
+    if (r.token() == JsonReader::Error) {
+        return false;
+    }
+    if (!(found & HAS_NAME)) {
+        std::cerr << where << ": missing key \"name\", entry skipped" << std::endl;
+        ok = false;
+    } else if (!(found & HAS_OPTIONS)) {
+        std::cerr << where << " (" << c.name << "): missing key \"options\", entry skipped" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+/*
+ * Reads the "thr" entries of appName. "name" and "options" are required, an entry missing either is
+ * reported and skipped without affecting the other entries. All other keys are optional.
+ * Returns false if the file could not be parsed or any entry had errors.
+ */
+static bool parseConfig(const std::string& appName, const std::string& path, const char* data, size_t size,
+                        std::vector<Trace::Configuration>& confs)
+{
+    JsonReader r(data, size);
+    bool ok = true;
+    bool appFound = false;
+
+    if (r.next() != JsonReader::BeginObject) {
+        std::cerr << path << ": " << (r.token() == JsonReader::Error ? r.error() : "top level must be an object") << std::endl;
+        return false;
+    }
+    while (r.next() == JsonReader::Key) {
+        if (r.text() != appName) {
+            r.skipValue();
+            continue;
+        }
+        appFound = true;
+        if (r.next() != JsonReader::BeginObject) {
+            std::cerr << path << ": \"" << appName << "\" must be an object" << std::endl;
+            return false;
+        }
+        int thrIndex = 0;
+        while (r.next() == JsonReader::Key) {
+            if (r.text() != "thr") {
+                r.skipValue();
+                continue;
+            }
+            std::stringstream where;
+            where << path << ": " << appName << ".thr[" << thrIndex++ << "]";
+            Trace::Configuration c;
+            if (readThread(r, where.str(), c)) {
+                confs.push_back(c);
+            } else {
+                ok = false;
+            }
+            if (r.token() == JsonReader::Error) {
+                break;
+            }
+        }
+        if (r.token() == JsonReader::Error) {
+            break;
+        }
+    }
+    if (r.token() == JsonReader::Error) {
+        std::cerr << path << ": " << r.error() << std::endl;
+        return false;
+    }
+    if (!appFound) {
+        std::cerr << path << ": no configuration for \"" << appName << "\"" << std::endl;
+        return false;
+    }
+    return ok;
+}
+
+bool Trace::readConfig(const std::string& appName, const std::string& pathToConfigFile, bool useCache)
+{
+    struct stat st;
+    if (stat(pathToConfigFile.c_str(), &st) != 0) {
+        std::cerr << pathToConfigFile << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    ConfigCacheKey key;
+    key.mtimeSec = st.st_mtim.tv_sec;
+    key.mtimeNsec = st.st_mtim.tv_nsec;
+    key.size = st.st_size;
+    key.appName = appName;
+    const std::string cacheFile = pathToConfigFile + ".cache";
+
+    std::vector<Configuration> confs;
+    bool ok = true;
+    if (!useCache || !readConfigCache(cacheFile, key, confs)) {
+        std::vector<char> buf(st.st_size);
+        FILE* fp = fopen(pathToConfigFile.c_str(), "rb");
+        if (fp == nullptr) {
+            std::cerr << pathToConfigFile << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        const size_t n = fread(buf.data(), 1, buf.size(), fp);
+        fclose(fp);
+        if (n != buf.size()) {
+            std::cerr << pathToConfigFile << ": short read" << std::endl;
+            return false;
+        }
+        ok = parseConfig(appName, pathToConfigFile, buf.data(), buf.size(), confs);
+        // Only a fully valid file is cached, so errors are reported again on the next start.
+        if (useCache && ok) {
+            writeConfigCache(cacheFile, key, confs);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < confs.size(); ++i) {
+        std::shared_ptr<KeywordFilter> f = std::make_shared<KeywordFilter>();
+        f->simpleSearchStr = confs[i].simpleSearchStr;
+        f->regexpStr = confs[i].regexpStr;
+        f->includeKeywords = confs[i].includeKeywords;
+        f->excludeKeywords = confs[i].excludeKeywords;
+        confs[i].keywordFilter = f;
+        s_configurations.push_back(confs[i]);
+        configMap_[confs[i].name] = &s_configurations.back();
+    }
+    return ok;
+}
+
 Trace::options_t Trace::parseOptions(const std::string& o)
 {
 	options_t options = OPT_NO_OPTIONS;
@@ -591,6 +1403,21 @@ Trace::options_t Trace::parseOptions(const std::string& o)
     }
 	if (boost::algorithm::contains(o,"T")){
 		options += OPT_TIME_ELAPSED;
+    }
+	if (boost::algorithm::contains(o,"s")){
+		options += OPT_STATISTICS;
+    }
+	if (boost::algorithm::contains(o,"o")){
+		options += OPT_OUTLIERS;
+    }
+	if (boost::algorithm::contains(o,"u")){
+		options += OPT_CPU_TIME;
+    }
+	if (boost::algorithm::contains(o,"k")){
+		options += OPT_CPU_CORE;
+    }
+	if (boost::algorithm::contains(o,"v")){
+		options += OPT_OVERHEAD;
     }
 	return options;
 }
@@ -614,7 +1441,14 @@ void Trace::createContext(const std::string& name, const std::string& opts)
 		c->options = parseOptions(opts);
 	}
 	ct->conf = c;
+    ct->created = clock_t::now();
+    ct->lastOverheadReport = ct->created;
+    updateDepthLimit(*ct);
     setLogStream(*ct);
+    static bool atExitRegistered = false;
+    if (!atExitRegistered) {
+        atExitRegistered = std::atexit(printOverheadAtExit) == 0;
+    }
 }
 /*
 void Trace::disable(const std::string& file, const int line)
@@ -628,7 +1462,80 @@ void Trace::disable(const std::string& file, const int line)
 */
 void Trace::setTimeElapsedStart()
 {
-	timeElapsedStart_.restart();
+	timeElapsedStart_ = clock_t::now();
+}
+
+void Trace::printStatistics()
+{
+    const Context* ct = context();
+    if (ct == nullptr || ct->logStream_ == nullptr) {
+        return;
+    }
+    std::ostream& s = *ct->logStream_;
+    s << ct->conf->prompt << "Statistics for " << ct->conf->name << std::endl;
+    for (const auto& e : ct->stats) {
+        const CallSite* site = e.first;
+        const CallStats& st = e.second;
+        s << ct->conf->prompt << TR_TAB << site->func << " (" << site->file << ":" << site->line << ")"
+          << " calls: " << st.calls << " suppressed: " << st.suppressed;
+        if (st.slow > 0) {
+            s << " slow: " << st.slow;
+        }
+        if (st.calls > 0) {
+            s << " total: " << st.totalMs << " ms mean: " << st.totalMs / st.calls << " ms max: " << st.maxMs << " ms";
+        }
+        if (PRINT_CPU_TIME(ct->conf->options) && st.calls > 0) {
+            s << " cpu: " << st.cpuMs << " ms off-cpu: " << std::max(0.0, st.totalMs - st.cpuMs) << " ms"
+              << " switches: " << st.voluntarySwitches << " voluntary " << st.involuntarySwitches << " involuntary";
+        }
+        if (PRINT_CPU_CORE(ct->conf->options)) {
+            s << " migrations: " << st.migrations << " in " << st.migratedCalls << " calls";
+        }
+        s << std::endl;
+        for (size_t i = 0; i < st.phases.size(); ++i) {
+            const PhaseStats& ps = st.phases[i];
+            s << ct->conf->prompt << TR_TAB2 << "lap " << ps.name << " calls: " << ps.calls << " total: " << ps.totalMs
+              << " ms mean: " << ps.totalMs / ps.calls << " ms max: " << ps.maxMs << " ms";
+            if (st.totalMs > 0.0) {
+                s << " share: " << 100.0 * ps.totalMs / st.totalMs << "%";
+            }
+            s << std::endl;
+        }
+    }
+}
+
+void Trace::printOverhead()
+{
+    const Context* ct = context();
+    if (ct != nullptr) {
+        printOverhead(*ct);
+    }
+}
+
+void Trace::printOverhead(const Context& c)
+{
+    if (c.logStream_ == nullptr) {
+        return;
+    }
+    static const char* const names[OVERHEAD_KINDS] = {"enter", "exit", "print", "output"};
+    // Output happens within the others, so it is not added to the total.
+    double totalMs = 0.0;
+    for (int k = 0; k < OVERHEAD_OUTPUT; ++k) {
+        totalMs += c.overhead[k].estimatedMs();
+    }
+    const double tracedMs = std::chrono::duration<double, std::milli>(clock_t::now() - c.created).count();
+    std::ostream& s = *c.logStream_;
+    s << c.conf->prompt << "Overhead for " << c.conf->name << ": " << totalMs << " ms of " << tracedMs << " ms traced ("
+      << (tracedMs > 0.0 ? 100.0 * totalMs / tracedMs : 0.0) << "%), " << c.countingBuf_.bytes() << " bytes written" << std::endl;
+    for (int k = 0; k < OVERHEAD_KINDS; ++k) {
+        const OverheadStats& o = c.overhead[k];
+        s << c.conf->prompt << TR_TAB << names[k] << " calls: " << o.calls << " sampled: " << o.sampled
+          << " estimated: " << o.estimatedMs() << " ms";
+        if (o.sampled > 0) {
+            s << " mean: " << 1e-3 * o.sampledNs / o.sampled << " us";
+        }
+        s << std::endl;
+    }
 }
 
 void Trace::flush()
@@ -650,13 +1557,14 @@ void Trace::setLogStream(Trace::Context& c)
                 mode = std::ios_base::app;
             }
             c.logFile_.open(c.conf->logFileName_, mode);
-            c.logStream_ = &c.logFile_;
+            c.countingBuf_.setTarget(c.logFile_.rdbuf());
         } 
         else
         {
-            c.logStream_ = &std::cout;  
+            c.countingBuf_.setTarget(std::cout.rdbuf());
             std::cout << "BEPA" << std::endl;
         }
+        c.logStream_ = &c.countedStream_;
     } catch(std::exception& e)
     {
         std::cerr << "Failed to open " << c.conf->logFileName_ << ":" << e.what() << std::endl;
@@ -666,7 +1574,8 @@ void Trace::setLogStream(Trace::Context& c)
 std::ostream& operator<<(std::ostream& os, const Trace::Configuration& c)
 {
     os << "name=" << c.name << "&options=" << std::hex << c.options <<"&prompt=" << c.prompt << "&simpleSearchStr=" 
-        << c.simpleSearchStr << "&regexpStr=" << c.regexpStr << "&logfileName=" << c.logFileName_ << "&logFileMode=" << c.logFileMode_;
+        << c.simpleSearchStr << "&regexpStr=" << c.regexpStr << "&logfileName=" << c.logFileName_ << "&logFileMode=" << c.logFileMode_
+        << "&maxDepth=" << std::dec << c.maxDepth << "&deadlines=" << c.deadlines.size();
     return os;
 }
 
@@ -27,6 +27,11 @@
  * 'd' print date and time for each string.
  * 'c' print out strings generated by TRACE_CHECK. Otherwise just execute the call silently.
  * 'r' print row numbers.
+ * 's' collect aggregated statistics (calls, suppressed calls and execution time) per call site.
+ * 'o' report outliers: scopes that take longer than their deadline, see below.
+ * 'u' measure thread CPU time and context switches of each scope, for 's' and 'o'. Costs two system calls at entry and exit.
+ * 'k' print the CPU core of each line and count migrations of the thread between cores, for 's' and 'o'.
+ * 'v' account for the time Trace itself spends and the bytes it writes, see below.
  *
  * The options must be specified per thread, e.g. in the QThread::run method. This makes it possible to debug threads separately.
  * QThread::currentThreadId() is used internally to bind options to a specific thread.
@@ -37,9 +42,43 @@
  * TRACE_VOID_RETURN. Used instead of 'return' to obtain line number of the return when tracing.
  * TRACE_PRINT: Used to print arbitrary strings. Has printf style argument list. Can also take a keyword to filter output.
  *    Example: TRACE_PRINT("mytest",("Value returned %d", aValue));
+ * TRACE_PRINT_STATISTICS. Prints the aggregated statistics collected with the 's' option for the current thread.
+ * TRACE_PRINT_OVERHEAD. Prints the overhead of Trace measured with the 'v' option for the current thread.
+ * TRACE_DEADLINE(ms). Sets the deadline of the current scope, overriding "deadlines" in the configuration.
+ * TRACE_LAP("name"). Ends a phase of the current scope, that started at the previous lap or at the start of the scope.
+ *    With 'm' the time of each phase is printed, with 's' it is added to the statistics of the phase for the call site.
+ *    Example: TRACE(); read(); TRACE_LAP("read"); decode(); TRACE_LAP("decode"); dispatch(); TRACE_LAP("dispatch");
  *
- * Filtering output: To print only lines with a special keyword, use the method Trace::setRegExpStr(). Then only lines tagged with
- * a keyword that satisfies the regular expression will be printed by the TRACE_PRINT macro.
+ * Limiting output: "maxDepth" in the configuration limits the nesting depth that is traced, and "suppressBelow" lists
+ * functions whose callees are not traced. Scopes beyond the limit cost one integer comparison, but are still counted
+ * when 's' is enabled. Their TRACE_PRINT lines are neither printed nor formatted.
+ *
+ * Outliers: with 'o', nothing is printed for a scope unless it takes longer than its deadline, given per function name
+ * by "deadlines" in the configuration, e.g. "deadlines": {"deliver": 2.5}, or by TRACE_DEADLINE. A late scope prints its
+ * time, the enclosing scopes with the time spent in each so far, and the last TRACE_PRINT lines of the thread, which are
+ * kept in a small ring whether 'p' is enabled or not. Combine with 's' to count late calls per call site.
+ *
+ * CPU time: with 'u', the statistics split the time of each call site into time on the CPU and time off it (blocked
+ * or waiting to run), and count the voluntary (blocking) and involuntary (preempted) context switches. An outlier
+ * report then shows whether the late scope was computing or waiting.
+ *
+ * Migrations: with 'k', the core is read (sched_getcpu, through the vDSO) at scope entry and exit and at TRACE_PRINT,
+ * and a change since the previous read counts as a migration of the thread. A move and back between two reads is not
+ * seen. The statistics show the migrations per call site and how many calls migrated.
+ *
+ * Overhead: with 'v', every scope entry, scope exit, TRACE_PRINT and output line is counted, and one in 64 of each is
+ * timed; the time of the others is estimated from those. A TRACE_PRINT is timed with the formatting of its arguments.
+ * Entries and exits of suppressed scopes are not counted. The bytes written to the log are counted. The estimate is
+ * printed as a share of the wall time since the context was created, every "overheadInterval" seconds of the
+ * configuration if set, by TRACE_PRINT_OVERHEAD and for all threads with 'v' at exit.
+ *
+ * Filtering output: "include" and "exclude" in the configuration are lists of keywords. A TRACE_PRINT with a keyword in
+ * "exclude" is not printed; if "include", "searchStr" or "regexp" is given, only keywords in "include", equal to
+ * "searchStr" or matching the regular expression "regexp" are printed. Lines without a keyword are always printed.
+ * Keywords are interned to a small number when a TRACE_PRINT is first executed, and each thread keeps the decision for
+ * each number, so the filter costs one table lookup however many keywords it has; the arguments of a filtered line
+ * are not formatted. The keyword of a TRACE_PRINT must therefore be the same each time it is executed. A thread may
+ * change the filter of a configuration while other threads with the same configuration print.
  **/
 
 
@@ -58,22 +97,27 @@
 #include <mutex>
 #include <thread>
 #include <map>
+#include <memory>
 #include <fstream>
 #include <atomic>
+#include <chrono>
+#include <unordered_map>
 #include <boost/date_time/posix_time/posix_time.hpp>
-#include <boost/timer.hpp>
 
 #ifdef TRACE
 #undef TRACE
 #endif
     #define TRACE_READ_CONFIG_FILE(app,path) Trace::readConfig(app,path);
+    #define TRACE_READ_CONFIG_FILE_CACHED(app,path) Trace::readConfig(app,path,true);
     #define TRACE_CREATE_CONTEXT(a,b) Trace::createContext(a,b);
     #define TRACE_SET_LOG_STREAM(a) Trace::setLogStream(a);
-    #define TRACE() Trace __traceObject__(__func__ , __FILE__, __LINE__)
-    #define TRACE_ENTER(a) Trace __traceObject__(a , __FILE__, __LINE__)
+    #define TRACE() static const Trace::CallSite __traceSite__ = {__func__ , __FILE__, __LINE__}; Trace __traceObject__(__traceSite__)
+    #define TRACE_ENTER(a) static const Trace::CallSite __traceSite__ = {a , __FILE__, __LINE__}; Trace __traceObject__(__traceSite__)
     #define TRACE_RETURN(a) __traceObject__.out(__LINE__);return a;
     #define TRACE_VOID_RETURN __traceObject__.out(__LINE__);return;
-    #define TRACE_PRINT(keyword, argList) {__traceObject__.printState(keyword, __FILE__, __LINE__, Trace::printArgs argList);}
+    // Unwraps the parenthesized format and arguments of TRACE_PRINT, they are formatted in printState.
+    #define TRACE_ARGS_(...) __VA_ARGS__
+    #define TRACE_PRINT(keyword, argList) {static const Trace::Keyword __traceKeyword__(keyword); if (__traceObject__.wants(__traceKeyword__)) {__traceObject__.printState(__traceKeyword__, __FILE__, __LINE__, TRACE_ARGS_ argList);}}
     #define TRACE_PROF_START {__traceObject__.profTimerStart(__LINE__);}
     #define TRACE_PROF_ELAPSED {__traceObject__.profTimerElapsed(__LINE__);}
     #define TRACE_CHECK(a) __traceObject__.check(#a, a, __LINE__);
@@ -83,15 +127,75 @@
     #define TRACE_SET_TIME_ELAPSED_START Trace::setTimeElapsedStart();
     #define TRACE_COMPARE(a,b) __traceObject__.compare(#a,#b, a, b, __LINE__)
     #define TRACE_FLUSH __traceObject__.flush();
+    #define TRACE_PRINT_STATISTICS Trace::printStatistics();
+    #define TRACE_PRINT_OVERHEAD Trace::printOverhead();
+    #define TRACE_DEADLINE(ms) __traceObject__.setDeadline(ms);
+    #define TRACE_LAP(name) __traceObject__.lap(name, __LINE__);
 
     class Trace
     {
     public:
         // Below is only internal stuff, do not use explicitly!
         typedef  unsigned long options_t;
+        typedef std::chrono::steady_clock clock_t;
+
+        // One per TRACE/TRACE_ENTER statement, statically allocated.
+        struct CallSite {
+            const char* func;
+            const char* file;
+            int line;
+        };
+
+        // One per TRACE_PRINT statement, statically allocated. Equal keywords have the same id.
+        struct Keyword {
+            explicit Keyword(const std::string& text);
+            const std::string* text; // Interned, never freed.
+            size_t id;
+        };
+
+        // Time between two TRACE_LAP statements, or from the start of the scope to the first.
+        struct PhaseStats {
+            explicit PhaseStats(){name=nullptr;calls=0;totalMs=0.0;maxMs=0.0;}
+            const char* name;
+            unsigned long calls;
+            double totalMs;
+            double maxMs;
+        };
+
+        struct CallStats {
+            explicit CallStats(){calls=0;suppressed=0;slow=0;totalMs=0.0;maxMs=0.0;cpuMs=0.0;voluntarySwitches=0;involuntarySwitches=0;migrations=0;migratedCalls=0;}
+            unsigned long calls;
+            unsigned long suppressed; // Calls beyond the depth limit, not timed.
+            unsigned long slow;       // Calls that missed their deadline, counted with 'o'.
+            double totalMs;
+            double maxMs;
+            double cpuMs;             // Thread CPU time of the calls, measured with 'u'.
+            unsigned long voluntarySwitches;
+            unsigned long involuntarySwitches;
+            unsigned long migrations;     // Core changes seen within the calls, with 'k'.
+            unsigned long migratedCalls;
+            std::vector<PhaseStats> phases; // In the order they were first seen.
+        };
+
+        // Atomic counter that is copied with its Configuration.
+        struct Generation {
+            explicit Generation():value(0){}
+            Generation(const Generation& g):value(g.value.load()){}
+            Generation& operator=(const Generation& g){value.store(g.value.load());return *this;}
+            std::atomic<unsigned long> value;
+        };
+
+        // The keyword filter in effect. Never changed once published in a Configuration, a change publishes a new
+        // one, so threads can go on using the one they hold.
+        struct KeywordFilter {
+            std::string simpleSearchStr;
+            std::string regexpStr;
+            std::vector<std::string> includeKeywords; // Sorted.
+            std::vector<std::string> excludeKeywords; // Sorted.
+        };
 
         struct Configuration  {
-            explicit Configuration(){options=0;}
+            explicit Configuration():keywordFilter(std::make_shared<const KeywordFilter>()){options=0;maxDepth=0;overheadInterval=0;}
             std::string name;
             options_t options;
             std::string prompt;
@@ -99,35 +203,106 @@
             std::string regexpStr;
             std::string logFileName_;
             std::string logFileMode_;
+            int maxDepth; // 0 means unlimited.
+            std::vector<std::string> suppressBelow; // Sorted function names.
+            std::vector<std::pair<std::string, double> > deadlines; // Milliseconds per function name, sorted by name.
+            int overheadInterval; // Seconds between overhead summaries with 'v', 0 for none.
+            std::vector<std::string> includeKeywords; // Sorted.
+            std::vector<std::string> excludeKeywords; // Sorted.
+            // Built from the four fields above when the configuration is read, replaced by setKeywords() and the
+            // like. Only accessed with std::atomic_load/atomic_store, it is shared by the threads of the configuration.
+            std::shared_ptr<const KeywordFilter> keywordFilter;
+            // Bumped after a new keywordFilter is published, so every thread sharing the configuration drops its verdicts.
+            Generation keywordGeneration;
 
             friend std::ostream& operator<<(std::ostream& os, const Configuration& c); 
         };        
+        // Counted and sampled time of one kind of Trace work, for 'v'.
+        enum OverheadKind { OVERHEAD_ENTER, OVERHEAD_EXIT, OVERHEAD_PRINT, OVERHEAD_OUTPUT, OVERHEAD_KINDS };
+        struct OverheadStats {
+            explicit OverheadStats(){calls=0;sampled=0;sampledNs=0;}
+            unsigned long calls;
+            unsigned long sampled;
+            int64_t sampledNs;
+            double estimatedMs() const {return sampled > 0 ? 1e-6 * sampledNs * calls / sampled : 0.0;}
+        };
+
+        // Passes output to the stream buffer of the log and counts the bytes.
+        class CountingBuf : public std::streambuf {
+        public:
+            explicit CountingBuf(){target_=nullptr;bytes_=0;}
+            void setTarget(std::streambuf* target) {target_ = target;}
+            unsigned long long bytes() const {return bytes_;}
+        protected:
+            int overflow(int c) {
+                if (c == traits_type::eof()) {
+                    return traits_type::not_eof(c);
+                }
+                bytes_++;
+                return target_ != nullptr ? target_->sputc(static_cast<char>(c)) : c;
+            }
+            std::streamsize xsputn(const char* s, std::streamsize n) {
+                bytes_ += n;
+                return target_ != nullptr ? target_->sputn(s, n) : n;
+            }
+            int sync() {return target_ != nullptr ? target_->pubsync() : 0;}
+        private:
+            std::streambuf* target_;
+            unsigned long long bytes_;
+        };
+
         struct Context {
-            explicit Context(){nestingLevel=0;conf=nullptr;logStream_=nullptr;}
+            explicit Context():countedStream_(&countingBuf_){nestingLevel=0;depthLimit=0;conf=nullptr;logStream_=nullptr;recentNext=0;cpu=-1;migrations=0;keywordGeneration=0;}
             std::thread::id threadId;
             int nestingLevel;
+            int depthLimit; // Scopes entered at a nesting level above this are suppressed.
             Configuration* conf;
             std::ostream* logStream_;
             std::ofstream logFile_;
+            std::unordered_map<const CallSite*, CallStats> stats;
+            // For 'o': the active scopes, innermost last, the deadline of each call site looked up so far
+            // (-1 for none), and the last TRACE_PRINT lines.
+            std::vector<const Trace*> scopes;
+            std::unordered_map<const CallSite*, double> deadlines;
+            std::vector<std::string> recent;
+            size_t recentNext;
+            // For 'k': the core at the last read, -1 before the first, and the core changes seen so far.
+            int cpu;
+            unsigned long migrations;
+            // For 'v'. Output goes through countedStream_ to the log file or std::cout.
+            mutable OverheadStats overhead[OVERHEAD_KINDS];
+            clock_t::time_point created;
+            clock_t::time_point lastOverheadReport;
+            CountingBuf countingBuf_;
+            std::ostream countedStream_;
+            // Whether to print each keyword id, decided at its first TRACE_PRINT; cleared when the filter changes.
+            // Refreshed by keywordFilter(), also from output of a const Context.
+            mutable std::vector<uint8_t> keywordVerdicts;
+            mutable std::shared_ptr<const KeywordFilter> keywordFilter;
+            mutable unsigned long keywordGeneration; // Of conf, when keywordFilter was taken.
 
             friend std::ostream& operator<<(std::ostream& os, const Context& c); 
         };
 
-		static bool readConfig(const std::string& appName, const std::string& pathToConfigFile);
+		// With useCache, the parsed configuration is kept in <pathToConfigFile>.cache and reused while the file's mtime and size are unchanged.
+		static bool readConfig(const std::string& appName, const std::string& pathToConfigFile, bool useCache=false);
         static void createContext(const std::string& name, const std::string& opts);
 //		static void disable(const std::string& file, const int line);
         static void disable(){s_disabled = true;}
         static void enable(){s_disabled = false;}
 
         static void closeLogFile();
+        static void printStatistics();
+        static void printOverhead();
+        static void printOverhead(const Context&);
 
         
         // static int getopt(int nargc, char * const nargv[], const char *ostr);    
-		explicit Trace(const std::string& func, const std::string& file, const int line);
+		explicit Trace(const CallSite& site);
         void out(const int line);
 		void flush();
-		void printState(const std::string& keyword, const char* file, int line, char* args);
-        static char* printArgs(const char* format, ...);
+		bool wants(const Keyword& keyword);
+		void printState(const Keyword& keyword, const char* file, int line, const char* format, ...);
         ~Trace();
         void profTimerStart(int lineNo);
         void profTimerElapsed(int lineNo);
@@ -146,6 +321,12 @@
         // Set context attributes from code. Call from appropriate thread!
         static void setName(const std::string& name);
         static void setOptions(options_t options);
+        static void setMaxDepth(int depth);
+        static void setSuppressBelow(const std::vector<std::string>& functions);
+        static void setKeywords(const std::vector<std::string>& include, const std::vector<std::string>& exclude);
+        static void setDeadlines(const std::vector<std::pair<std::string, double> >& deadlines);
+        void setDeadline(double ms);
+        void lap(const char* name, int lineNo);
         std::string simpleSearchStr;
             std::string regexpStr;
             std::string prompt;
@@ -166,26 +347,51 @@
 		void compareHelper(const char* first, const char* second, int result, int lineNo, const std::string& valStr1="", const std::string& valStr2="");
 
         static Context* context();
-		static void traceOut(const Context* ct, const std::string& extra, const std::string& funcName, const std::string& args, const std::string& fileName, int lineNo, double  ms = -1.0); // Construct string based on options.
+		static void traceOut(const Context* ct, const std::string& extra, const char* funcName, const std::string& args, const char* fileName, int lineNo, double  ms = -1.0); // Construct string based on options.
         static void setLogStream(Context&);
+        static void updateDepthLimit(Context&);
+        static bool isSuppressBelow(const Configuration&, const char* funcName);
+        static bool printKeyword(Context&, const Keyword&);
+        static const KeywordFilter& keywordFilter(const Context&);
+        static void publishKeywordFilter(Configuration&, const std::shared_ptr<const KeywordFilter>&);
+        static bool matchKeyword(const KeywordFilter&, const std::string& keyword);
+        static double deadline(Context&, const CallSite* site);
+        void reportSlow(const Context&, double ms, double cpuMs) const;
+        // Thread CPU time in nanoseconds and context switches so far.
+        struct CpuUsage {
+            int64_t cpuNs;
+            long voluntarySwitches;
+            long involuntarySwitches;
+        };
+        static void cpuUsage(CpuUsage& u);
+        static int sampleCpu(Context&);
+        static double elapsedMs(const clock_t::time_point& start);
+        static void printOverheadAtExit();
 
 		static std::vector<Context*> contexts_; // One context per thread
         // static QMutex mutex_;
         static std::mutex mutex_;
 
-		std::string  funcName_;
-        std::string fileName_;
-        int line_;
+        const CallSite* site_;
         int exitLine_;
+        int savedDepthLimit_; // Restored on exit if this scope is a "suppressBelow" function, otherwise -1.
+        double deadlineMs_;   // -1 if the scope has no deadline.
         // QTime time_;
-        boost::timer timer_;
+        bool timed_;          // startTime_ was set.
+        clock_t::time_point startTime_;
+        clock_t::time_point lapTime_;   // End of the previous phase, startTime_ before the first TRACE_LAP.
+        CallStats* lapStats_; // Statistics of the call site, looked up at the first TRACE_LAP.
+        bool cpuTimed_;       // cpuStart_ was set.
+        CpuUsage cpuStart_;
+        int entryCpu_;        // -1 unless 'k' was set at entry.
+        unsigned long entryMigrations_;
 
 
         // Attributes for "profiling".
         int profStartLine_;
         int profEndLine_;
         // QTime profTime_;
-        boost::timer profTime_;
+        clock_t::time_point profTime_;
 
         static FILE* logFile_;
         static std::ostream* m_logStream;
@@ -196,7 +402,7 @@
 
         static std::atomic<bool> s_disabled;
 
-        static boost::timer timeElapsedStart_;
+        static clock_t::time_point timeElapsedStart_;
         static options_t s_globalOptions; // Shared by all contexts.
         // UDP stuff
 /*
@@ -221,12 +427,17 @@
     #define TRACE_CHECK(a) a
     #define TRACE_CREATE_CONTEXT(a)
     #define TRACE_READ_CONFIG_FILE
+    #define TRACE_READ_CONFIG_FILE_CACHED(app,path)
     #define TRACE_DISABLE
     #define TRACE_ENABLE
     #define TRACE_CLOSE_LOGFILE
     #define TRACE_SET_TIME_ELAPSED_START
     #define TRACE_COMPARE(a,b)
     #define TRACE_FLUSH
+    #define TRACE_PRINT_STATISTICS
+    #define TRACE_PRINT_OVERHEAD
+    #define TRACE_DEADLINE(ms)
+    #define TRACE_LAP(name)
     #endif // USE_TRACE
 
 #endif // TRACE_HPP
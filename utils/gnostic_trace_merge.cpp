@@ -0,0 +1,392 @@
+/**
+ * \file    gnostic_trace_merge.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ * Merges Trace logs of several threads, e.g. one "logfile" per thread configuration, into one log ordered by row
+ * number (option 'r', numbered across all threads) or by elapsed time (option 'T').
+ *
+ * Each input is read and split into lines by its own thread, in chunks into a bounded queue, so memory does not grow
+ * with the size of the logs. The main thread merges the inputs: it takes lines from the input with the smallest key
+ * for as long as they are not greater than the smallest key of the others, and only then goes back to the heap.
+ * Lines without a key (statistics, outlier reports) keep the key of the line before them, so they stay with it.
+ *
+ ******************************************************************************/
+
+#include "GetOpt.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+enum KeyMode { KEY_ROW, KEY_TIME };
+
+struct Line {
+    uint64_t key;
+    size_t begin;
+    size_t length;   // Including the newline.
+};
+
+// Whole lines of one chunk of an input.
+struct Batch {
+    std::vector<char> data;
+    std::vector<Line> lines;
+};
+
+class Input
+{
+public:
+    Input(const std::string& path, KeyMode mode, size_t chunkSize, size_t depth) :
+        path_(path),
+        mode_(mode),
+        chunkSize_(chunkSize),
+        depth_(depth),
+        fp_(nullptr),
+        done_(false),
+        failed_(false),
+        lastKey_(0),
+        lines_(0),
+        bytes_(0)
+    {
+    }
+
+    ~Input()
+    {
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        if (fp_ != nullptr) {
+            fclose(fp_);
+        }
+    }
+
+    bool open()
+    {
+        fp_ = fopen(path_.c_str(), "rb");
+        if (fp_ == nullptr) {
+            std::cerr << path_ << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void start()
+    {
+        thread_ = std::thread(&Input::run, this);
+    }
+
+    // Blocks until the next batch is decoded, returns nullptr at the end of the input.
+    std::unique_ptr<Batch> next()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this] { return !batches_.empty() || done_; });
+        if (batches_.empty()) {
+            return std::unique_ptr<Batch>();
+        }
+        std::unique_ptr<Batch> b = std::move(batches_.front());
+        batches_.pop_front();
+        space_.notify_one();
+        return b;
+    }
+
+    // Returns a merged batch for reuse by the reader.
+    void release(std::unique_ptr<Batch> b)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(std::move(b));
+    }
+
+    const std::string& path() const {return path_;}
+    bool failed() const {return failed_;}
+    unsigned long long lines() const {return lines_;}
+    unsigned long long bytes() const {return bytes_;}
+
+private:
+    void run()
+    {
+        std::vector<char> carry;
+        for (;;) {
+            std::unique_ptr<Batch> b;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                space_.wait(lock, [this] { return batches_.size() < depth_; });
+                if (!free_.empty()) {
+                    b = std::move(free_.back());
+                    free_.pop_back();
+                }
+            }
+            if (!b) {
+                b.reset(new Batch);
+            }
+            b->data.swap(carry);
+            carry.clear();
+            const size_t kept = b->data.size();
+            b->data.resize(kept + chunkSize_);
+            const size_t n = fread(b->data.data() + kept, 1, chunkSize_, fp_);
+            b->data.resize(kept + n);
+            if (n == 0 && ferror(fp_)) {
+                std::cerr << path_ << ": " << strerror(errno) << std::endl;
+                failed_ = true;
+            }
+            const bool eof = n == 0;
+            if (eof && !b->data.empty() && b->data.back() != '\n') {
+                b->data.push_back('\n');
+            }
+            // A partial last line is carried over to the next chunk.
+            size_t end = b->data.size();
+            while (end > 0 && b->data[end - 1] != '\n') {
+                --end;
+            }
+            carry.assign(b->data.begin() + end, b->data.end());
+            b->data.resize(end);
+            split(*b);
+            bytes_ += b->data.size();
+            lines_ += b->lines.size();
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!b->lines.empty()) {
+                batches_.push_back(std::move(b));
+            }
+            if (eof) {
+                done_ = true;
+            }
+            ready_.notify_one();
+            if (eof) {
+                return;
+            }
+        }
+    }
+
+    void split(Batch& b)
+    {
+        b.lines.clear();
+        const char* data = b.data.data();
+        const size_t size = b.data.size();
+        size_t begin = 0;
+        while (begin < size) {
+            const char* nl = static_cast<const char*>(memchr(data + begin, '\n', size - begin));
+            const size_t end = nl - data + 1;
+            uint64_t key;
+            if (parseKey(data + begin, end - begin - 1, key)) {
+                lastKey_ = key;
+            }
+            Line l;
+            l.key = lastKey_;
+            l.begin = begin;
+            l.length = end - begin;
+            b.lines.push_back(l);
+            begin = end;
+        }
+    }
+
+    bool parseKey(const char* s, size_t n, uint64_t& key) const
+    {
+        if (mode_ == KEY_ROW) {
+            // "#00001234:  "
+            if (n < 2 || s[0] != '#' || s[1] < '0' || s[1] > '9') {
+                return false;
+            }
+            key = 0;
+            for (size_t i = 1; i < n && s[i] >= '0' && s[i] <= '9'; ++i) {
+                key = key * 10 + (s[i] - '0');
+            }
+            return true;
+        }
+        // " T:h:m:s.ms" at the end; " T: x ms" is the execution time of 'm'.
+        for (size_t i = n; i-- > 2; ) {
+            if (s[i - 2] == ' ' && s[i - 1] == 'T' && s[i] == ':' && i + 1 < n && s[i + 1] >= '0' && s[i + 1] <= '9') {
+                uint64_t fields[4] = {0, 0, 0, 0};
+                int f = 0;
+                for (size_t j = i + 1; j < n && f < 4; ++j) {
+                    if (s[j] >= '0' && s[j] <= '9') {
+                        fields[f] = fields[f] * 10 + (s[j] - '0');
+                    } else if (s[j] == ':' || s[j] == '.') {
+                        f++;
+                    } else {
+                        break;
+                    }
+                }
+                if (f != 3) {
+                    return false;
+                }
+                key = ((fields[0] * 60 + fields[1]) * 60 + fields[2]) * 1000 + fields[3];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string path_;
+    KeyMode mode_;
+    size_t chunkSize_;
+    size_t depth_;
+    FILE* fp_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable space_;
+    std::deque<std::unique_ptr<Batch> > batches_;
+    std::vector<std::unique_ptr<Batch> > free_;
+    bool done_;
+    bool failed_;
+    uint64_t lastKey_;
+    unsigned long long lines_;
+    unsigned long long bytes_;
+};
+
+// The current batch of an input and the next line in it.
+struct Cursor {
+    Input* input;
+    std::unique_ptr<Batch> batch;
+    size_t pos;
+
+    const Line& line() const {return batch->lines[pos];}
+    // Advances to the next line, fetching the next batch when needed. Returns false at the end of the input.
+    bool advance()
+    {
+        if (++pos < batch->lines.size()) {
+            return true;
+        }
+        input->release(std::move(batch));
+        batch = input->next();
+        pos = 0;
+        return batch.get() != nullptr;
+    }
+};
+
+static void usage(const char* prog)
+{
+    std::cerr << "Usage: " << prog << " [-k row|time] [-o output] [-c chunkkb] [-d depth] log ..." << std::endl
+              << "  -k  Merge by row number ('r', default) or by elapsed time ('T')." << std::endl
+              << "  -o  Output file (default stdout)." << std::endl
+              << "  -c  Kilobytes read at a time per input (default 1024)." << std::endl
+              << "  -d  Decoded chunks queued per input (default 4)." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    GetOpt g;
+    int c;
+    KeyMode mode = KEY_ROW;
+    std::string output;
+    size_t chunkSize = 1024 * 1024;
+    size_t depth = 4;
+    while ((c = g.getopt(argc, argv, "k:o:c:d:")) != -1) {
+        switch (c) {
+        case 'k':
+            if (std::string(g.optarg) == "time") {
+                mode = KEY_TIME;
+            } else if (std::string(g.optarg) != "row") {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o':
+            output = g.optarg;
+            break;
+        case 'c':
+            chunkSize = static_cast<size_t>(atol(g.optarg)) * 1024;
+            break;
+        case 'd':
+            depth = static_cast<size_t>(atol(g.optarg));
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (g.optind >= argc || chunkSize == 0 || depth == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (!output.empty()) {
+        out = fopen(output.c_str(), "wb");
+        if (out == nullptr) {
+            std::cerr << output << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+    }
+    // Static, stdout may be flushed at exit.
+    static std::vector<char> outBuffer(4 * 1024 * 1024);
+    setvbuf(out, outBuffer.data(), _IOFBF, outBuffer.size());
+
+    std::vector<std::unique_ptr<Input> > inputs;
+    for (int i = g.optind; i < argc; ++i) {
+        std::unique_ptr<Input> in(new Input(argv[i], mode, chunkSize, depth));
+        if (!in->open()) {
+            return 1;
+        }
+        inputs.push_back(std::move(in));
+    }
+    // Started when all are open, so an error leaves no reader blocked on a full queue.
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        inputs[i]->start();
+    }
+
+    // Smallest (key, input) on top; the input index keeps lines of equal keys in input order.
+    typedef std::pair<uint64_t, size_t> HeapEntry;
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry> > heap;
+    std::vector<Cursor> cursors(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        cursors[i].input = inputs[i].get();
+        cursors[i].batch = inputs[i]->next();
+        cursors[i].pos = 0;
+        if (cursors[i].batch) {
+            heap.push(HeapEntry(cursors[i].line().key, i));
+        }
+    }
+
+    while (!heap.empty()) {
+        const size_t i = heap.top().second;
+        heap.pop();
+        Cursor& cur = cursors[i];
+        // Copy a run of lines while this input stays the smallest.
+        for (;;) {
+            const Line& l = cur.line();
+            fwrite(cur.batch->data.data() + l.begin, 1, l.length, out);
+            if (!cur.advance()) {
+                break;
+            }
+            const HeapEntry next(cur.line().key, i);
+            if (!heap.empty() && heap.top() < next) {
+                heap.push(next);
+                break;
+            }
+        }
+    }
+
+    bool ok = true;
+    unsigned long long lines = 0;
+    unsigned long long bytes = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        ok = ok && !inputs[i]->failed();
+        lines += inputs[i]->lines();
+        bytes += inputs[i]->bytes();
+    }
+    if (fflush(out) != 0) {
+        std::cerr << (output.empty() ? "stdout" : output) << ": " << strerror(errno) << std::endl;
+        ok = false;
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    std::cerr << "Merged " << lines << " lines, " << bytes << " bytes from " << inputs.size() << " logs" << std::endl;
+    return ok ? 0 : 1;
+}
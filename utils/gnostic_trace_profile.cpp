@@ -0,0 +1,450 @@
+/**
+ * \file    gnostic_trace_profile.cpp
+ *
+ * \author  Peter Lidbjork
+ *
+ * Copyright &copy; Maquet Critical Care AB, Sweden
+ *
+ * Profile of functions from Trace text logs written with the 't' option ("| | >func: ", "| | <func "), with 'm' for
+ * the times ("T: 1.5 ms"): calls, inclusive and exclusive time, and percentiles of the inclusive time per function.
+ * Lines of several threads in one log are told apart by the thread id of option 'i'; each log is its own set of
+ * threads.
+ *
+ * The logs are mapped and cut into chunks at line boundaries, which worker threads parse in parallel. A chunk does
+ * not know the scopes that were open when it starts, so the time of a scope that ends inside a chunk but whose caller
+ * started before it is kept aside, with the caller's depth. A sequential pass over the chunks in order then follows
+ * the open scopes from chunk to chunk and charges that time to the right callers. Percentiles come from log scale
+ * histograms, 8 buckets per octave, and are the upper edge of a bucket, at most 9% high.
+ *
+ ******************************************************************************/
+
+#include "GetOpt.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Histogram of 1 us to about 16 minutes.
+static const int BUCKETS_PER_OCTAVE = 8;
+static const int BUCKETS = 30 * BUCKETS_PER_OCTAVE;
+static const double MIN_MS = 0.001;
+
+// A function or thread name within a mapped log.
+struct Name {
+    const char* p;
+    size_t n;
+    bool operator==(const Name& o) const {return n == o.n && std::memcmp(p, o.p, n) == 0;}
+};
+
+struct NameHash {
+    size_t operator()(const Name& s) const {
+        // FNV-1a
+        size_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < s.n; ++i) {
+            h = (h ^ static_cast<unsigned char>(s.p[i])) * 1099511628211ULL;
+        }
+        return h;
+    }
+};
+
+struct FuncStats {
+    explicit FuncStats(){calls=0;timed=0;inclusiveMs=0.0;childMs=0.0;maxMs=0.0;histogram.assign(BUCKETS, 0);}
+    unsigned long long calls;
+    unsigned long long timed;     // Exits with a time.
+    double inclusiveMs;
+    double childMs;               // Inclusive time of direct callees, subtracted for the exclusive time.
+    double maxMs;
+    std::vector<uint32_t> histogram;
+
+    void add(const FuncStats& o) {
+        calls += o.calls;
+        timed += o.timed;
+        inclusiveMs += o.inclusiveMs;
+        childMs += o.childMs;
+        maxMs = std::max(maxMs, o.maxMs);
+        for (int i = 0; i < BUCKETS; ++i) {
+            histogram[i] += o.histogram[i];
+        }
+    }
+    void addTime(double ms) {
+        timed++;
+        inclusiveMs += ms;
+        maxMs = std::max(maxMs, ms);
+        int b = ms <= MIN_MS ? 0 : static_cast<int>(std::log2(ms / MIN_MS) * BUCKETS_PER_OCTAVE);
+        histogram[std::min(b, BUCKETS - 1)]++;
+    }
+    // Upper edge of the bucket holding the fraction q of the timed calls.
+    double percentile(double q) const {
+        const unsigned long long target = static_cast<unsigned long long>(std::ceil(q * timed));
+        unsigned long long n = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            n += histogram[i];
+            if (n >= target && n > 0) {
+                return std::min(maxMs, MIN_MS * std::pow(2.0, (i + 1.0) / BUCKETS_PER_OCTAVE));
+            }
+        }
+        return maxMs;
+    }
+};
+
+typedef std::unordered_map<Name, FuncStats, NameHash> StatsMap;
+
+// A scope open in a thread. Unknown scopes were opened before the chunk, or are missing from the log.
+struct Frame {
+    Name func;
+    bool known;
+};
+
+// Time of a scope whose caller was open when the chunk started.
+struct Orphan {
+    size_t depth;       // Index of the caller in the thread's stack.
+    double ms;
+};
+
+struct ThreadState {
+    explicit ThreadState(){lowWater=SIZE_MAX;}
+    std::vector<Frame> stack;
+    // Stack entries below this index have not been popped in the chunk, so unknown ones are those open at its start.
+    size_t lowWater;
+    std::vector<Orphan> orphans;
+};
+
+struct Chunk {
+    size_t log;
+    const char* begin;
+    const char* end;
+    StatsMap stats;
+    std::unordered_map<Name, ThreadState, NameHash> threads;
+    unsigned long long lines;
+};
+
+static void truncate(ThreadState& t, size_t size)
+{
+    if (t.stack.size() > size) {
+        t.stack.resize(size);
+    }
+    t.lowWater = std::min(t.lowWater, size);
+}
+
+static void pad(ThreadState& t, size_t size)
+{
+    Frame unknown;
+    unknown.func.p = nullptr;
+    unknown.func.n = 0;
+    unknown.known = false;
+    while (t.stack.size() < size) {
+        t.stack.push_back(unknown);
+    }
+}
+
+static bool startsWith(const char* p, const char* end, const char* s)
+{
+    const size_t n = std::strlen(s);
+    return static_cast<size_t>(end - p) >= n && std::memcmp(p, s, n) == 0;
+}
+
+// Parses " T: 1.25 ms" after p, the time printed by 'm'. Returns -1 if there is none.
+static double parseTime(const char* p, const char* end)
+{
+    for (; p + 4 <= end; ++p) {
+        p = static_cast<const char*>(memchr(p, ' ', end - p));
+        if (p == nullptr) {
+            return -1.0;
+        }
+        if (startsWith(p, end, " T: ")) {
+            char buf[32];
+            const size_t n = std::min<size_t>(sizeof(buf) - 1, end - p - 4);
+            std::memcpy(buf, p + 4, n);
+            buf[n] = '\0';
+            char* e;
+            const double ms = std::strtod(buf, &e);
+            return e != buf ? ms : -1.0;
+        }
+    }
+    return -1.0;
+}
+
+static void parseLine(Chunk& c, const char* p, const char* end)
+{
+    // "#00000012:  " row number, "(tid)" thread id, "[n]" core.
+    if (p < end && *p == '#') {
+        p = static_cast<const char*>(memchr(p, ' ', end - p));
+        if (p == nullptr) {
+            return;
+        }
+        while (p < end && *p == ' ') {
+            ++p;
+        }
+    }
+    Name thread = {p, 0};
+    if (p < end && *p == '(') {
+        const char* close = static_cast<const char*>(memchr(p, ')', end - p));
+        if (close != nullptr) {
+            thread.n = close + 1 - p;
+            p = close + 1;
+        }
+    }
+    // The nesting bars follow the prompt.
+    const char* bar = static_cast<const char*>(memchr(p, '|', end - p));
+    if (bar == nullptr) {
+        return;
+    }
+    size_t depth = 0;
+    p = bar;
+    while (p + 1 < end && p[0] == '|' && p[1] == ' ') {
+        depth++;
+        p += 2;
+    }
+    if (depth == 0 || p >= end || (*p != '>' && *p != '<')) {
+        return;
+    }
+    const bool entry = *p++ == '>';
+    const char* name = p;
+    while (p < end && *p != ' ' && !(*p == ':' && (p + 1 == end || p[1] == ' '))) {
+        ++p;
+    }
+    if (p == name) {
+        return;
+    }
+    Frame f;
+    f.func.p = name;
+    f.func.n = p - name;
+    f.known = true;
+    ThreadState& t = c.threads[thread];
+    if (entry) {
+        truncate(t, depth - 1);
+        pad(t, depth - 1);
+        t.stack.push_back(f);
+        return;
+    }
+    FuncStats& st = c.stats[f.func];
+    st.calls++;
+    const double ms = parseTime(p, end);
+    if (ms >= 0.0) {
+        st.addTime(ms);
+        if (depth >= 2) {
+            const size_t caller = depth - 2;
+            pad(t, depth - 1);
+            if (t.stack[caller].known) {
+                c.stats[t.stack[caller].func].childMs += ms;
+            } else if (caller < t.lowWater) {
+                Orphan o;
+                o.depth = caller;
+                o.ms = ms;
+                t.orphans.push_back(o);
+            }
+        }
+    }
+    truncate(t, depth - 1);
+}
+
+static void parseChunk(Chunk& c)
+{
+    c.lines = 0;
+    const char* p = c.begin;
+    while (p < c.end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', c.end - p));
+        const char* e = nl != nullptr ? nl : c.end;
+        parseLine(c, p, e);
+        c.lines++;
+        p = e + 1;
+    }
+}
+
+struct Log {
+    std::string path;
+    const char* data;
+    size_t size;
+};
+
+static bool mapLog(Log& log)
+{
+    const int fd = ::open(log.path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << log.path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        std::cerr << log.path << ": " << strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+    log.size = static_cast<size_t>(st.st_size);
+    log.data = nullptr;
+    if (log.size > 0) {
+        void* m = mmap(nullptr, log.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            std::cerr << log.path << ": " << strerror(errno) << std::endl;
+            ::close(fd);
+            return false;
+        }
+        madvise(m, log.size, MADV_SEQUENTIAL);
+        log.data = static_cast<const char*>(m);
+    }
+    ::close(fd);
+    return true;
+}
+
+static void usage(const char* prog)
+{
+    std::cerr << "Usage: " << prog << " [-j threads] [-c chunkmb] [-n top] log ..." << std::endl
+              << "  -j  Parsing threads (default: the number of cores)." << std::endl
+              << "  -c  Megabytes per chunk (default 16)." << std::endl
+              << "  -n  Only the top functions by exclusive time (default all)." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    GetOpt g;
+    int c;
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    size_t chunkSize = 16 * 1024 * 1024;
+    size_t top = 0;
+    while ((c = g.getopt(argc, argv, "j:c:n:")) != -1) {
+        switch (c) {
+        case 'j':
+            threads = atoi(g.optarg);
+            break;
+        case 'c':
+            chunkSize = static_cast<size_t>(atof(g.optarg) * 1024 * 1024);
+            break;
+        case 'n':
+            top = static_cast<size_t>(atol(g.optarg));
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (g.optind >= argc || chunkSize == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    threads = std::max(1, threads);
+
+    std::vector<Log> logs;
+    std::vector<std::unique_ptr<Chunk> > chunks;
+    for (int i = g.optind; i < argc; ++i) {
+        Log log;
+        log.path = argv[i];
+        if (!mapLog(log)) {
+            return 1;
+        }
+        logs.push_back(log);
+        // Cut after the newline following each chunkSize bytes.
+        const char* p = log.data;
+        const char* end = log.data + log.size;
+        while (p < end) {
+            const char* e = p + std::min(chunkSize, static_cast<size_t>(end - p));
+            if (e < end) {
+                const char* nl = static_cast<const char*>(memchr(e, '\n', end - e));
+                e = nl != nullptr ? nl + 1 : end;
+            }
+            std::unique_ptr<Chunk> ch(new Chunk);
+            ch->log = logs.size() - 1;
+            ch->begin = p;
+            ch->end = e;
+            chunks.push_back(std::move(ch));
+            p = e;
+        }
+    }
+
+    std::atomic<size_t> nextChunk(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.push_back(std::thread([&chunks, &nextChunk] {
+            for (size_t k = nextChunk++; k < chunks.size(); k = nextChunk++) {
+                parseChunk(*chunks[k]);
+            }
+        }));
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+
+    // Follow the open scopes of each thread through the chunks, charging the orphans to their callers.
+    StatsMap total;
+    unsigned long long lines = 0;
+    std::vector<std::unordered_map<Name, std::vector<Frame>, NameHash> > open(logs.size());
+    for (size_t k = 0; k < chunks.size(); ++k) {
+        Chunk& ch = *chunks[k];
+        lines += ch.lines;
+        for (StatsMap::const_iterator it = ch.stats.begin(); it != ch.stats.end(); ++it) {
+            total[it->first].add(it->second);
+        }
+        for (std::unordered_map<Name, ThreadState, NameHash>::iterator it = ch.threads.begin(); it != ch.threads.end(); ++it) {
+            std::vector<Frame>& stack = open[ch.log][it->first];
+            const ThreadState& t = it->second;
+            for (size_t i = 0; i < t.orphans.size(); ++i) {
+                const Orphan& o = t.orphans[i];
+                if (o.depth < stack.size() && stack[o.depth].known) {
+                    total[stack[o.depth].func].childMs += o.ms;
+                }
+            }
+            std::vector<Frame> next = t.stack;
+            for (size_t i = 0; i < next.size(); ++i) {
+                if (!next[i].known && i < t.lowWater && i < stack.size()) {
+                    next[i] = stack[i];
+                }
+            }
+            stack.swap(next);
+        }
+        // The chunk's maps are merged, only the names in the mapped log are still used.
+        ch.stats.clear();
+        ch.threads.clear();
+    }
+
+    std::vector<std::pair<double, Name> > order;
+    double allExclusive = 0.0;
+    for (StatsMap::const_iterator it = total.begin(); it != total.end(); ++it) {
+        const double exclusive = std::max(0.0, it->second.inclusiveMs - it->second.childMs);
+        order.push_back(std::make_pair(exclusive, it->first));
+        allExclusive += exclusive;
+    }
+    std::sort(order.begin(), order.end(), [](const std::pair<double, Name>& a, const std::pair<double, Name>& b) {
+        return a.first > b.first;
+    });
+    if (top > 0 && order.size() > top) {
+        order.resize(top);
+    }
+
+    printf("%-32s %10s %12s %12s %6s %10s %10s %10s %10s %10s\n", "function", "calls", "incl ms", "excl ms", "excl%",
+           "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (size_t i = 0; i < order.size(); ++i) {
+        const FuncStats& st = total[order[i].second];
+        const std::string name(order[i].second.p, order[i].second.n);
+        printf("%-32s %10llu %12.3f %12.3f %6.2f", name.c_str(), st.calls, st.inclusiveMs, order[i].first,
+               allExclusive > 0.0 ? 100.0 * order[i].first / allExclusive : 0.0);
+        if (st.timed > 0) {
+            printf(" %10.4f %10.4f %10.4f %10.4f %10.4f\n", st.inclusiveMs / st.timed, st.percentile(0.5),
+                   st.percentile(0.9), st.percentile(0.99), st.maxMs);
+        } else {
+            printf(" %10s %10s %10s %10s %10s\n", "-", "-", "-", "-", "-");
+        }
+    }
+    std::cerr << "Parsed " << lines << " lines in " << chunks.size() << " chunks of " << logs.size() << " logs with "
+              << threads << " threads" << std::endl;
+    for (size_t i = 0; i < logs.size(); ++i) {
+        if (logs[i].data != nullptr) {
+            munmap(const_cast<char*>(logs[i].data), logs[i].size);
+        }
+    }
+    return 0;
+}